@@ -0,0 +1,47 @@
+# - Try to find libzstd
+# Once done this will define
+#
+#  LIBZSTD_FOUND - system has libzstd
+#  LIBZSTD_INCLUDE_DIRS - the libzstd include directory
+#  LIBZSTD_LIBRARIES - Link these to use libzstd
+
+find_path (LIBZSTD_INCLUDE_DIRS
+  NAMES
+    zstd.h
+  PATHS
+    /usr/include
+    /usr/local/include
+    /opt/local/include
+    /sw/include
+    ENV CPATH)
+
+find_library (LIBZSTD_LIBRARIES
+  NAMES
+    zstd
+  PATHS
+    /usr/lib
+    /usr/local/lib
+    /opt/local/lib
+    /sw/lib
+    ENV LIBRARY_PATH
+    ENV LD_LIBRARY_PATH)
+
+include (FindPackageHandleStandardArgs)
+
+# handle the QUIETLY and REQUIRED arguments and set LIBZSTD_FOUND to TRUE if all listed variables are TRUE
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(LibZstd "Please install the libzstd development package"
+  LIBZSTD_LIBRARIES
+  LIBZSTD_INCLUDE_DIRS)
+
+mark_as_advanced(LIBZSTD_INCLUDE_DIRS LIBZSTD_LIBRARIES)
+
+# ZSTD_compressStream2() is needed for flushing the compressed output
+if (LIBZSTD_FOUND)
+  include(CheckSymbolExists)
+  SET(CMAKE_REQUIRED_LIBRARIES ${LIBZSTD_LIBRARIES})
+  check_symbol_exists(ZSTD_compressStream2 "${LIBZSTD_INCLUDE_DIRS}/zstd.h" HAVE_ZSTD_COMPRESSSTREAM2)
+  unset(CMAKE_REQUIRED_LIBRARIES)
+  if (NOT HAVE_ZSTD_COMPRESSSTREAM2)
+    set(LIBZSTD_FOUND FALSE)
+  endif()
+endif()
@@ -10,6 +10,11 @@ std::unordered_set<std::string>& Expression::getResolve() {
   return s;
 }
 
+std::unordered_set<std::string>& Expression::getResolveFields() {
+  static std::unordered_set<std::string> s;
+  return s;
+}
+
 void Integer::accept(Visitor &v) {
   v.visit(*this);
 }
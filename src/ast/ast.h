@@ -36,6 +36,7 @@ public:
   Expression() : Node(){};
   Expression(location loc) : Node(loc){};
   static std::unordered_set<std::string>& getResolve();
+  static std::unordered_set<std::string>& getResolveFields();
 };
 using ExpressionList = std::vector<Expression *>;
 
@@ -165,8 +166,12 @@ public:
 
 class FieldAccess : public Expression {
 public:
-  FieldAccess(Expression *expr, const std::string &field) : expr(expr), field(field) { }
-  FieldAccess(Expression *expr, const std::string &field, location loc) : Expression(loc), expr(expr), field(field) { }
+  FieldAccess(Expression *expr, const std::string &field) : expr(expr), field(field) {
+    getResolveFields().insert(field);
+  }
+  FieldAccess(Expression *expr, const std::string &field, location loc) : Expression(loc), expr(expr), field(field) {
+    getResolveFields().insert(field);
+  }
   Expression *expr;
   std::string field;
 
@@ -350,6 +355,7 @@ public:
   std::string name() const;
   bool need_expansion = false;        // must build a BPF program per wildcard match
   bool need_tp_args_structs = false;  // must import struct for tracepoints
+  bool use_attach_cookie = false;     // matches share a program, probe id is the BPF cookie
 
   int index();
   void set_index(int index);
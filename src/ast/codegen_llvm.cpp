@@ -5,8 +5,9 @@
 #include "arch/arch.h"
 #include "types.h"
 #include "utils.h"
-#include <time.h>
+#include <chrono>
 #include <arpa/inet.h>
+#include "timings.h"
 #include "tracepoint_format_parser.h"
 
 #include <llvm/Support/raw_os_ostream.h>
@@ -82,10 +83,25 @@ void CodegenLLVM::visit(Builtin &builtin)
   }
   else if (builtin.ident == "elapsed")
   {
-    struct timespec ts;
-    // this time will be calculated during codegen and baked into the BPF
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    expr_ = b_.CreateSub(b_.CreateGetNs(), b_.getInt64(1000000000ULL * ts.tv_sec + ts.tv_nsec));
+    // The start time is written to the elapsed map when the program is run,
+    // rather than baked in, so cached and saved programs measure from their
+    // own start. See BPFtrace::run().
+    Function *parent = b_.GetInsertBlock()->getParent();
+    AllocaInst *start = b_.CreateAllocaBPF(b_.getInt64Ty(), "elapsed_start");
+    b_.CreateStore(b_.getInt64(0), start);
+    Value *elem = b_.CreateGetElapsedStart();
+
+    BasicBlock *found = BasicBlock::Create(module_->getContext(), "elapsed.found", parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(), "elapsed.done", parent);
+    b_.CreateCondBr(b_.CreateICmpNE(elem, ConstantExpr::getCast(Instruction::IntToPtr, b_.getInt64(0), b_.getInt8PtrTy()), "elapsedcond"), found, done);
+
+    b_.SetInsertPoint(found);
+    b_.CreateStore(b_.CreateLoad(b_.CreatePointerCast(elem, b_.getInt64Ty()->getPointerTo())), start);
+    b_.CreateBr(done);
+
+    b_.SetInsertPoint(done);
+    expr_ = b_.CreateSub(b_.CreateGetNs(), b_.CreateLoad(start));
+    b_.CreateLifetimeEnd(start);
   }
   else if (builtin.ident == "kstack" || builtin.ident == "ustack")
   {
@@ -178,16 +194,16 @@ void CodegenLLVM::visit(Builtin &builtin)
   }
   else if (builtin.ident == "probe")
   {
-    auto begin = bpftrace_.probe_ids_.begin();
-    auto end = bpftrace_.probe_ids_.end();
-    auto found = std::find(begin, end, probefull_);
-    if (found == end) {
-      bpftrace_.probe_ids_.push_back(probefull_);
-      builtin.probe_id = bpftrace_.next_probe_id();
-    } else {
-      builtin.probe_id = std::distance(begin, found);
+    if (probe_id_)
+    {
+      // Shared probe body, the stub for each match passes its id in
+      expr_ = probe_id_;
+    }
+    else
+    {
+      builtin.probe_id = getProbeId();
+      expr_ = b_.getInt64(builtin.probe_id);
     }
-    expr_ = b_.getInt64(builtin.probe_id);
   }
   else if (builtin.ident == "args")
   {
@@ -319,6 +335,140 @@ void CodegenLLVM::visit(Call &call)
 
     expr_ = nullptr;
   }
+  else if (call.func == "topk")
+  {
+    // topk stores a count-min sketch of TOPK_SKETCH_DEPTH rows followed by a
+    // table of TOPK_SIZE (value, count) pairs in a per-cpu array. Values are
+    // admitted into the table when their estimate beats the smallest entry.
+    // The per-cpu tables are merged and re-estimated when printing.
+    Map &map = *call.map;
+    Function *parent = b_.GetInsertBlock()->getParent();
+    call.vargs->front()->accept(*this);
+    // promote int to 64-bit
+    Value *value = b_.CreateIntCast(expr_, b_.getInt64Ty(), call.vargs->front()->type.is_signed);
+    Function *hash_func = module_->getFunction("hash");
+    Value *hash = b_.CreateCall(hash_func, value, "hash");
+
+    AllocaInst *key = b_.CreateAllocaBPF(b_.getInt32Ty(), map.ident + "_key");
+    AllocaInst *newval = b_.CreateAllocaBPF(map.type, map.ident + "_val");
+
+    // update the sketch, the estimate is the smallest counter
+    Value *estimate = b_.getInt64(UINT64_MAX);
+    for (int row = 0; row < TOPK_SKETCH_DEPTH; row++)
+    {
+      Value *column = b_.CreateAnd(b_.CreateLShr(hash, 16 * row), b_.getInt64(TOPK_SKETCH_WIDTH - 1));
+      Value *cell = b_.CreateAdd(column, b_.getInt64(row * TOPK_SKETCH_WIDTH));
+      b_.CreateStore(b_.CreateIntCast(cell, b_.getInt32Ty(), false), key);
+      Value *oldval = b_.CreateMapLookupElem(map, key);
+      Value *counter = b_.CreateAdd(oldval, b_.getInt64(1));
+      b_.CreateStore(counter, newval);
+      b_.CreateMapUpdateElem(map, key, newval);
+      estimate = b_.CreateSelect(b_.CreateICmpULT(counter, estimate), counter, estimate);
+    }
+
+    // find the table slot holding this value, or else the smallest one
+    int table = TOPK_SKETCH_DEPTH * TOPK_SKETCH_WIDTH;
+    Value *match_slot = b_.getInt64(-1);
+    Value *min_slot = b_.getInt64(0);
+    Value *min_count = b_.getInt64(UINT64_MAX);
+    for (int slot = 0; slot < TOPK_SIZE; slot++)
+    {
+      b_.CreateStore(b_.getInt32(table + 2 * slot), key);
+      Value *slot_value = b_.CreateMapLookupElem(map, key);
+      b_.CreateStore(b_.getInt32(table + 2 * slot + 1), key);
+      Value *slot_count = b_.CreateMapLookupElem(map, key);
+
+      Value *is_match = b_.CreateAnd(b_.CreateICmpEQ(slot_value, value),
+                                     b_.CreateICmpNE(slot_count, b_.getInt64(0)));
+      match_slot = b_.CreateSelect(is_match, b_.getInt64(slot), match_slot);
+      Value *is_min = b_.CreateICmpULT(slot_count, min_count);
+      min_slot = b_.CreateSelect(is_min, b_.getInt64(slot), min_slot);
+      min_count = b_.CreateSelect(is_min, slot_count, min_count);
+    }
+
+    Value *has_match = b_.CreateICmpNE(match_slot, b_.getInt64(-1));
+    Value *target = b_.CreateSelect(has_match, match_slot, min_slot);
+    BasicBlock *admit = BasicBlock::Create(module_->getContext(), "topk.admit", parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(), "topk.done", parent);
+    b_.CreateCondBr(b_.CreateOr(has_match, b_.CreateICmpUGT(estimate, min_count)), admit, done);
+
+    b_.SetInsertPoint(admit);
+    Value *slot_key = b_.CreateAdd(b_.CreateShl(target, 1), b_.getInt64(table));
+    b_.CreateStore(b_.CreateIntCast(slot_key, b_.getInt32Ty(), false), key);
+    b_.CreateStore(value, newval);
+    b_.CreateMapUpdateElem(map, key, newval);
+    b_.CreateStore(b_.CreateIntCast(b_.CreateAdd(slot_key, b_.getInt64(1)), b_.getInt32Ty(), false), key);
+    b_.CreateStore(estimate, newval);
+    b_.CreateMapUpdateElem(map, key, newval);
+    b_.CreateBr(done);
+
+    b_.SetInsertPoint(done);
+    b_.CreateLifetimeEnd(key);
+    b_.CreateLifetimeEnd(newval);
+    expr_ = nullptr;
+  }
+  else if (call.func == "hll" || call.func == "cardinality")
+  {
+    // hll stores 2^HLL_PRECISION HyperLogLog registers in a hist map, using
+    // the top bits of the hashed value as the register index. Each register
+    // keeps the highest rank (leading zeros + 1) seen in the remaining bits.
+    Map &map = *call.map;
+    Function *parent = b_.GetInsertBlock()->getParent();
+    call.vargs->front()->accept(*this);
+    // promote int to 64-bit
+    Value *value = b_.CreateIntCast(expr_, b_.getInt64Ty(), call.vargs->front()->type.is_signed);
+    Function *hash_func = module_->getFunction("hash");
+    Value *hash = b_.CreateCall(hash_func, value, "hash");
+
+    Value *index = b_.CreateLShr(hash, 64 - HLL_PRECISION);
+    Value *rest = b_.CreateShl(hash, HLL_PRECISION);
+    Value *rank = b_.getInt64(1);
+    for (int shift = 32; shift > 0; shift /= 2)
+    {
+      Value *is_zero = b_.CreateICmpEQ(b_.CreateLShr(rest, 64 - shift), b_.getInt64(0));
+      rank = b_.CreateSelect(is_zero, b_.CreateAdd(rank, b_.getInt64(shift)), rank);
+      rest = b_.CreateSelect(is_zero, b_.CreateShl(rest, shift), rest);
+    }
+    Value *max_rank = b_.getInt64(64 - HLL_PRECISION + 1);
+    rank = b_.CreateSelect(b_.CreateICmpUGT(rank, max_rank), max_rank, rank);
+
+    AllocaInst *key = getHistMapKey(map, index);
+    Value *oldval = b_.CreateMapLookupElem(map, key);
+    AllocaInst *newval = b_.CreateAllocaBPF(map.type, map.ident + "_val");
+    BasicBlock *gt = BasicBlock::Create(module_->getContext(), "hll.gt", parent);
+    BasicBlock *le = BasicBlock::Create(module_->getContext(), "hll.le", parent);
+    b_.CreateCondBr(b_.CreateICmpUGT(rank, oldval), gt, le);
+
+    b_.SetInsertPoint(gt);
+    b_.CreateStore(rank, newval);
+    b_.CreateMapUpdateElem(map, key, newval);
+    b_.CreateBr(le);
+
+    b_.SetInsertPoint(le);
+    b_.CreateLifetimeEnd(key);
+    b_.CreateLifetimeEnd(newval);
+    expr_ = nullptr;
+  }
+  else if (call.func == "quantiles")
+  {
+    Map &map = *call.map;
+    call.vargs->front()->accept(*this);
+    // promote int to 64-bit
+    expr_ = b_.CreateIntCast(expr_, b_.getInt64Ty(), call.vargs->front()->type.is_signed);
+    Function *loglinear_func = module_->getFunction("loglinear");
+    Value *loglinear = b_.CreateCall(loglinear_func, expr_, "loglinear");
+    AllocaInst *key = getHistMapKey(map, loglinear);
+
+    Value *oldval = b_.CreateMapLookupElem(map, key);
+    AllocaInst *newval = b_.CreateAllocaBPF(map.type, map.ident + "_val");
+    b_.CreateStore(b_.CreateAdd(oldval, b_.getInt64(1)), newval);
+    b_.CreateMapUpdateElem(map, key, newval);
+
+    // oldval can only be an integer so won't be in memory and doesn't need lifetime end
+    b_.CreateLifetimeEnd(key);
+    b_.CreateLifetimeEnd(newval);
+    expr_ = nullptr;
+  }
   else if (call.func == "hist")
   {
     Map &map = *call.map;
@@ -409,14 +559,27 @@ void CodegenLLVM::visit(Call &call)
     } else {
       b_.CreateStore(b_.getInt64(bpftrace_.strlen_), strlen);
     }
-    AllocaInst *buf = b_.CreateAllocaBPF(bpftrace_.strlen_, "str");
-    b_.CreateMemSet(buf, b_.getInt8(0), bpftrace_.strlen_, 1);
+    Value *buf;
+    AllocaInst *stack_buf = nullptr;
+    if (bpftrace_.strlen_ > STACK_STRLEN_MAX)
+    {
+      // probe_read_str() terminates the string, so unlike the stack buffer
+      // this isn't zeroed first: anything after the terminator is stale
+      buf = getScratchBuffer();
+    }
+    else
+    {
+      stack_buf = b_.CreateAllocaBPF(bpftrace_.strlen_, "str");
+      b_.CreateMemSet(stack_buf, b_.getInt8(0), bpftrace_.strlen_, 1);
+      buf = stack_buf;
+    }
     call.vargs->front()->accept(*this);
     b_.CreateProbeReadStr(buf, b_.CreateLoad(strlen), expr_);
     b_.CreateLifetimeEnd(strlen);
 
     expr_ = buf;
-    expr_deleter_ = [this,buf]() { b_.CreateLifetimeEnd(buf); };
+    if (stack_buf)
+      expr_deleter_ = [this,stack_buf]() { b_.CreateLifetimeEnd(stack_buf); };
   }
   else if (call.func == "kaddr")
   {
@@ -540,6 +703,64 @@ void CodegenLLVM::visit(Call &call)
 
     expr_ = buf;
   }
+  else if (call.func == "sample")
+  {
+    // true for a random num/den of the events
+    Binop &rate = static_cast<Binop&>(*call.vargs->at(0));
+    Integer &num = static_cast<Integer&>(*rate.left);
+    Integer &den = static_cast<Integer&>(*rate.right);
+    Value *random = b_.CreateAnd(b_.CreateGetRandom(), b_.getInt64(0xffffffff));
+    Value *sampled = b_.CreateICmpULT(b_.CreateURem(random, b_.getInt64(den.n)), b_.getInt64(num.n));
+    expr_ = b_.CreateIntCast(sampled, b_.getInt64Ty(), false);
+  }
+  else if (call.func == "ratelimit")
+  {
+    // Token bucket holding up to n tokens, refilled at n tokens per second.
+    // Returns true if a token was taken. The bucket is per-cpu, so the rate
+    // applies to each CPU.
+    Integer &rate_arg = static_cast<Integer&>(*call.vargs->at(0));
+    uint64_t rate = rate_arg.n;
+    const uint64_t nsecs_per_sec = 1000000000;
+    Function *parent = b_.GetInsertBlock()->getParent();
+
+    AllocaInst *result = b_.CreateAllocaBPF(b_.getInt64Ty(), "ratelimit_result");
+    b_.CreateStore(b_.getInt64(0), result);
+    Value *state = b_.CreateGetRatelimitState(ratelimit_id_);
+    ratelimit_id_++;
+
+    BasicBlock *found = BasicBlock::Create(module_->getContext(), "ratelimit.found", parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(), "ratelimit.done", parent);
+    b_.CreateCondBr(b_.CreateICmpNE(state, ConstantExpr::getCast(Instruction::IntToPtr, b_.getInt64(0), b_.getInt8PtrTy()), "ratelimitcond"), found, done);
+
+    b_.SetInsertPoint(found);
+    Value *tokens_ptr = b_.CreatePointerCast(state, b_.getInt64Ty()->getPointerTo());
+    Value *last_ptr = b_.CreateGEP(tokens_ptr, b_.getInt64(1));
+    Value *tokens = b_.CreateLoad(tokens_ptr);
+    Value *last = b_.CreateLoad(last_ptr);
+    Value *now = b_.CreateGetNs();
+    Value *elapsed = b_.CreateSub(now, last);
+
+    // refill, advancing the last refill time only by the tokens added so
+    // partial tokens aren't lost
+    Value *full = b_.CreateICmpUGE(elapsed, b_.getInt64(nsecs_per_sec));
+    Value *refill = b_.CreateUDiv(b_.CreateMul(elapsed, b_.getInt64(rate)), b_.getInt64(nsecs_per_sec));
+    Value *refilled = b_.CreateAdd(tokens, refill);
+    refilled = b_.CreateSelect(b_.CreateICmpUGT(refilled, b_.getInt64(rate)), b_.getInt64(rate), refilled);
+    tokens = b_.CreateSelect(full, b_.getInt64(rate), refilled);
+    Value *advanced = b_.CreateAdd(last, b_.CreateUDiv(b_.CreateMul(refill, b_.getInt64(nsecs_per_sec)), b_.getInt64(rate)));
+    last = b_.CreateSelect(full, now, advanced);
+
+    Value *allowed = b_.CreateICmpUGT(tokens, b_.getInt64(0));
+    tokens = b_.CreateSelect(allowed, b_.CreateSub(tokens, b_.getInt64(1)), tokens);
+    b_.CreateStore(tokens, tokens_ptr);
+    b_.CreateStore(last, last_ptr);
+    b_.CreateStore(b_.CreateIntCast(allowed, b_.getInt64Ty(), false), result);
+    b_.CreateBr(done);
+
+    b_.SetInsertPoint(done);
+    expr_ = b_.CreateLoad(result);
+    b_.CreateLifetimeEnd(result);
+  }
   else if (call.func == "reg")
   {
     auto &reg_name = static_cast<String&>(*call.vargs->at(0)).str;
@@ -574,7 +795,7 @@ void CodegenLLVM::visit(Call &call)
      * The asyncaction_id informs user-space that this is not a printf(), but is a
      * special asynchronous action. The ID maps to exit().
      */
-    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), sizeof(uint64_t));
+    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), bpftrace_.perf_event_buffer_size(sizeof(uint64_t)));
     AllocaInst *perfdata = b_.CreateAllocaBPF(perfdata_type, "perfdata");
     b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::exit)), perfdata);
     b_.CreatePerfEventOutput(ctx_, perfdata, sizeof(uint64_t));
@@ -599,7 +820,7 @@ void CodegenLLVM::visit(Call &call)
     AllocaInst *str_buf = b_.CreateAllocaBPF(ArrayType::get(b_.getInt8Ty(), map.ident.length() + 1), "str");
     b_.CreateMemSet(str_buf, b_.getInt8(0), map.ident.length() + 1, 1);
     b_.CreateStore(const_str, str_buf);
-    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), sizeof(uint64_t) + 2 * sizeof(uint64_t) + map.ident.length() + 1);
+    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), bpftrace_.perf_event_buffer_size(sizeof(uint64_t) + 2 * sizeof(uint64_t) + map.ident.length() + 1));
     AllocaInst *perfdata = b_.CreateAllocaBPF(perfdata_type, "perfdata");
 
     // store asyncactionid:
@@ -643,7 +864,7 @@ void CodegenLLVM::visit(Call &call)
     AllocaInst *str_buf = b_.CreateAllocaBPF(ArrayType::get(b_.getInt8Ty(), map.ident.length() + 1), "str");
     b_.CreateMemSet(str_buf, b_.getInt8(0), map.ident.length() + 1, 1);
     b_.CreateStore(const_str, str_buf);
-    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), sizeof(uint64_t) + map.ident.length() + 1);
+    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), bpftrace_.perf_event_buffer_size(sizeof(uint64_t) + map.ident.length() + 1));
     AllocaInst *perfdata = b_.CreateAllocaBPF(perfdata_type, "perfdata");
     if (call.func == "clear")
       b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::clear)), perfdata);
@@ -656,7 +877,7 @@ void CodegenLLVM::visit(Call &call)
   }
   else if (call.func == "time")
   {
-    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), sizeof(uint64_t) * 2);
+    ArrayType *perfdata_type = ArrayType::get(b_.getInt8Ty(), bpftrace_.perf_event_buffer_size(sizeof(uint64_t) * 2));
     AllocaInst *perfdata = b_.CreateAllocaBPF(perfdata_type, "perfdata");
     b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::time)), perfdata);
     b_.CreateStore(b_.getInt64(time_id_), b_.CreateGEP(perfdata, {b_.getInt64(0), b_.getInt64(sizeof(uint64_t))}));
@@ -992,7 +1213,15 @@ void CodegenLLVM::visit(FieldAccess &acc)
     // Just read from the correct offset of expr_
     Value *src = b_.CreateGEP(expr_, {b_.getInt64(0), b_.getInt64(field.offset)});
 
-    if (field.type.type == Type::cast)
+    if (field.is_bitfield)
+    {
+      AllocaInst *raw = b_.CreateAllocaBPF(b_.getInt64Ty(), type.cast_type + "." + acc.field);
+      b_.CreateStore(b_.getInt64(0), raw);
+      b_.CREATE_MEMCPY(raw, src, field.bitfield.read_bytes, 1);
+      expr_ = readBitfield(b_.CreateLoad(raw), field);
+      b_.CreateLifetimeEnd(raw);
+    }
+    else if (field.type.type == Type::cast)
     {
       // TODO This should be do-able without allocating more memory here
       AllocaInst *dst = b_.CreateAllocaBPF(field.type, "internal_" + type.cast_type + "." + acc.field);
@@ -1016,7 +1245,15 @@ void CodegenLLVM::visit(FieldAccess &acc)
 
     Value *src = b_.CreateAdd(expr_, b_.getInt64(field.offset));
 
-    if (field.type.type == Type::cast && !field.type.is_pointer)
+    if (field.is_bitfield)
+    {
+      AllocaInst *raw = b_.CreateAllocaBPF(b_.getInt64Ty(), type.cast_type + "." + acc.field);
+      b_.CreateStore(b_.getInt64(0), raw);
+      b_.CreateProbeRead(raw, field.bitfield.read_bytes, src);
+      expr_ = readBitfield(b_.CreateLoad(raw), field);
+      b_.CreateLifetimeEnd(raw);
+    }
+    else if (field.type.type == Type::cast && !field.type.is_pointer)
     {
       // struct X
       // {
@@ -1126,7 +1363,8 @@ void CodegenLLVM::visit(AssignMapStatement &assignment)
   }
   b_.CreateMapUpdateElem(map, key, val);
   b_.CreateLifetimeEnd(key);
-  if (!assignment.expr->is_variable)
+  // Large strings are built in the scratch map, not on the stack
+  if (!assignment.expr->is_variable && isa<AllocaInst>(val))
     b_.CreateLifetimeEnd(val);
 }
 
@@ -1255,8 +1493,26 @@ void CodegenLLVM::visit(Probe &probe)
    * each wildcard match. An exception is the "probe" builtin, where we need
    * to build different BPF programs for each wildcard match that cantains an
    * ID for the match. Those programs will be called "s_kprobe:do_fcntl" etc.
+   * If the kernel supports BPF cookies, kprobes can still use a single
+   * program, which reads the ID from the cookie it was attached with.
    */
-  if (probe.need_expansion == false) {
+  bool single_program = probe.need_expansion == false ||
+                        canUseAttachCookie(probe);
+
+  // The wildcard matches of each attach point, when expanding
+  std::vector<std::set<std::string>> matches;
+  size_t num_matches = 0;
+  if (!single_program) {
+    for (auto attach_point : *probe.attach_points) {
+      if (attach_point->provider == "BEGIN" || attach_point->provider == "END")
+        matches.push_back({ attach_point->provider });
+      else
+        matches.push_back(bpftrace_.find_wildcard_matches(*attach_point));
+      num_matches += matches.back().size();
+    }
+  }
+
+  if (single_program) {
     // build a single BPF program pre-wildcards
     Function *func = Function::Create(func_type, Function::ExternalLinkage, probe.name(), module_.get());
     probe.set_index(getNextIndexForProbe(probe.name()));
@@ -1266,6 +1522,10 @@ void CodegenLLVM::visit(Probe &probe)
 
     ctx_ = func->arg_begin();
 
+    if (probe.need_expansion) {
+      probe.use_attach_cookie = true;
+      probe_id_ = b_.CreateGetAttachCookie(ctx_);
+    }
     if (probe.pred) {
       probe.pred->accept(*this);
     }
@@ -1275,7 +1535,59 @@ void CodegenLLVM::visit(Probe &probe)
     }
 
     b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+    probe_id_ = nullptr;
+
+  } else if (num_matches > 1 && canShareProbeBody(probe)) {
+    /*
+     * Only the "probe" builtin differs between matches. Generate the body
+     * once, taking the probe id as an argument, and give each match a stub
+     * program which calls it with its own id. The body is inlined into the
+     * stubs, as BPF programs can't make calls, so each match is still
+     * optimised and emitted separately: only building the IR is shared.
+     * A single match is built directly, without the extra function.
+     */
+    FunctionType *body_type = FunctionType::get(
+        b_.getInt64Ty(),
+        {b_.getInt8PtrTy(), b_.getInt64Ty()}, // ctx, probe id
+        false);
+    Function *body = Function::Create(body_type, Function::InternalLinkage, probe.name() + "_body", module_.get());
+    body->addFnAttr(Attribute::AlwaysInline);
+    BasicBlock *body_entry = BasicBlock::Create(module_->getContext(), "entry", body);
+    b_.SetInsertPoint(body_entry);
+
+    ctx_ = body->arg_begin();
+    probe_id_ = body->arg_begin() + 1;
+    if (probe.pred) {
+      probe.pred->accept(*this);
+    }
+    variables_.clear();
+    for (Statement *stmt : *probe.stmts) {
+      stmt->accept(*this);
+    }
+    b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+    probe_id_ = nullptr;
+
+    for (size_t i = 0; i < probe.attach_points->size(); i++) {
+      auto attach_point = probe.attach_points->at(i);
+      current_attach_point_ = attach_point;
+
+      for (auto &match_ : matches[i]) {
+        if (attach_point->provider == "BEGIN" || attach_point->provider == "END")
+          probefull_ = attach_point->provider;
+        else
+          probefull_ = attach_point->name(match_);
+
+        int index = getNextIndexForProbe(probe.name());
+        attach_point->set_index(match_, index);
+        Function *func = Function::Create(func_type, Function::ExternalLinkage, probefull_, module_.get());
+        func->setSection(getSectionNameForProbe(probefull_, index));
+        BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", func);
+        b_.SetInsertPoint(entry);
 
+        Value *ret = b_.CreateCall(body, {func->arg_begin(), b_.getInt64(getProbeId())});
+        b_.CreateRet(ret);
+      }
+    }
   } else {
     /*
      * Build a separate BPF program for each wildcard match.
@@ -1285,22 +1597,20 @@ void CodegenLLVM::visit(Probe &probe)
     int starting_printf_id_ = printf_id_;
     int starting_time_id_ = time_id_;
     int starting_join_id_ = join_id_;
+    int starting_ratelimit_id_ = ratelimit_id_;
+    int starting_scratch_id_ = scratch_id_;
 
-    for (auto attach_point : *probe.attach_points) {
+    for (size_t i = 0; i < probe.attach_points->size(); i++) {
+      auto attach_point = probe.attach_points->at(i);
       current_attach_point_ = attach_point;
 
-      std::set<std::string> matches;
-      if (attach_point->provider == "BEGIN" || attach_point->provider == "END") {
-        matches.insert(attach_point->provider);
-      } else {
-        matches = bpftrace_.find_wildcard_matches(*attach_point);
-      }
-
       tracepoint_struct_ = "";
-      for (auto &match_ : matches) {
+      for (auto &match_ : matches[i]) {
         printf_id_ = starting_printf_id_;
         time_id_ = starting_time_id_;
         join_id_ = starting_join_id_;
+        ratelimit_id_ = starting_ratelimit_id_;
+        scratch_id_ = starting_scratch_id_;
 
         std::string full_func_id = match_;
 
@@ -1655,6 +1965,103 @@ void CodegenLLVM::createLinearFunction()
   b_.CreateRet(b_.CreateLoad(result_alloc));
 }
 
+void CodegenLLVM::createLogLinearFunction()
+{
+  // loglinear() returns a quantiles() bucket index for the given value.
+  // Values below 2^(S+1) get a bucket each, above that every power of 2 is
+  // split into 2^S linear buckets, where S is QUANTILES_SUB_BUCKET_BITS.
+  // Negative values are counted as 0. Must stay in sync with
+  // quantiles_bucket_value() in bpftrace.cpp.
+  //
+  // int loglinear(int n)
+  // {
+  //   int v = n, exp = 0, shift;
+  //   if (n < 0) return 0;
+  //   if (n < 1 << (S+1)) return n;
+  //   for (int i = 5; i >= 0; i--)
+  //   {
+  //     shift = (v >= (1<<(1<<i))) << i;
+  //     v >>= shift;
+  //     exp += shift;
+  //   }
+  //   return ((exp - S + 1) << S) + (n >> (exp - S)) - (1 << S);
+  // }
+
+  FunctionType *loglinear_func_type = FunctionType::get(b_.getInt64Ty(), {b_.getInt64Ty()}, false);
+  Function *loglinear_func = Function::Create(loglinear_func_type, Function::InternalLinkage, "loglinear", module_.get());
+  loglinear_func->addFnAttr(Attribute::AlwaysInline);
+  loglinear_func->setSection("helpers");
+  BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", loglinear_func);
+  b_.SetInsertPoint(entry);
+
+  Value *n = loglinear_func->arg_begin();
+  const int sub_bits = QUANTILES_SUB_BUCKET_BITS;
+
+  // test for less than zero
+  BasicBlock *is_less_than_zero = BasicBlock::Create(module_->getContext(), "quantiles.is_less_than_zero", loglinear_func);
+  BasicBlock *is_not_less_than_zero = BasicBlock::Create(module_->getContext(), "quantiles.is_not_less_than_zero", loglinear_func);
+  b_.CreateCondBr(b_.CreateICmpSLT(n, b_.getInt64(0)),
+                  is_less_than_zero,
+                  is_not_less_than_zero);
+  b_.SetInsertPoint(is_less_than_zero);
+  b_.CreateRet(b_.getInt64(0));
+  b_.SetInsertPoint(is_not_less_than_zero);
+
+  // small values are their own bucket
+  BasicBlock *is_small = BasicBlock::Create(module_->getContext(), "quantiles.is_small", loglinear_func);
+  BasicBlock *is_not_small = BasicBlock::Create(module_->getContext(), "quantiles.is_not_small", loglinear_func);
+  b_.CreateCondBr(b_.CreateICmpULT(n, b_.getInt64(1 << (sub_bits + 1))),
+                  is_small,
+                  is_not_small);
+  b_.SetInsertPoint(is_small);
+  b_.CreateRet(n);
+  b_.SetInsertPoint(is_not_small);
+
+  // exponent of the highest set bit
+  Value *v = n;
+  Value *exp = b_.getInt64(0);
+  for (int i = 5; i >= 0; i--)
+  {
+    Value *shift = b_.CreateShl(b_.CreateIntCast(b_.CreateICmpUGE(v, b_.getInt64(1ULL << (1<<i))), b_.getInt64Ty(), false), i);
+    v = b_.CreateLShr(v, shift);
+    exp = b_.CreateAdd(exp, shift);
+  }
+
+  Value *base = b_.CreateShl(b_.CreateSub(exp, b_.getInt64(sub_bits - 1)), sub_bits);
+  Value *sub_bucket = b_.CreateSub(b_.CreateLShr(n, b_.CreateSub(exp, b_.getInt64(sub_bits))),
+                                   b_.getInt64(1 << sub_bits));
+  b_.CreateRet(b_.CreateAdd(base, sub_bucket));
+}
+
+void CodegenLLVM::createHashFunction()
+{
+  // hash() mixes a 64-bit value for indexing topk() and hll() sketches. It
+  // must stay in sync with topk_hash() in bpftrace.cpp.
+  //
+  // uint64_t hash(uint64_t n)
+  // {
+  //   n *= 0x9e3779b97f4a7c15;
+  //   n ^= n >> 32;
+  //   n *= 0xd6e8feb86659fd93;
+  //   n ^= n >> 32;
+  //   return n;
+  // }
+
+  FunctionType *hash_func_type = FunctionType::get(b_.getInt64Ty(), {b_.getInt64Ty()}, false);
+  Function *hash_func = Function::Create(hash_func_type, Function::InternalLinkage, "hash", module_.get());
+  hash_func->addFnAttr(Attribute::AlwaysInline);
+  hash_func->setSection("helpers");
+  BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", hash_func);
+  b_.SetInsertPoint(entry);
+
+  Value *n = hash_func->arg_begin();
+  n = b_.CreateMul(n, b_.getInt64(0x9e3779b97f4a7c15ULL));
+  n = b_.CreateXor(n, b_.CreateLShr(n, 32));
+  n = b_.CreateMul(n, b_.getInt64(0xd6e8feb86659fd93ULL));
+  n = b_.CreateXor(n, b_.CreateLShr(n, 32));
+  b_.CreateRet(n);
+}
+
 void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_args,
                                          const std::string &call_name, AsyncAction async_action)
 {
@@ -1672,18 +2079,35 @@ void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_arg
     llvm::Type *ty = b_.GetType(arg.type);
     elements.push_back(ty);
   }
+  // Leave room for the timestamp of ordered output, see
+  // IRBuilderBPF::CreatePerfEventOutput()
+  if (bpftrace_.ordered_output_)
+    elements.push_back(b_.getInt64Ty());
   StructType *fmt_struct = StructType::create(elements, call_name + "_t", false);
   int struct_size = layout_.getTypeAllocSize(fmt_struct);
 
   auto *struct_layout = layout_.getStructLayout(fmt_struct);
+  if (bpftrace_.ordered_output_)
+    struct_size = struct_layout->getElementOffset(elements.size() - 1);
   for (size_t i=0; i<args.size(); i++)
   {
     Field &arg = args[i];
     arg.offset = struct_layout->getElementOffset(i+1); // +1 for the id field
   }
 
-  AllocaInst *fmt_args = b_.CreateAllocaBPF(fmt_struct, call_name + "_args");
-  b_.CreateMemSet(fmt_args, b_.getInt8(0), struct_size, 1);
+  // With large strings the arguments won't fit on the BPF stack. Every field
+  // is written below, so the scratch buffer doesn't need zeroing.
+  bool use_scratch = bpftrace_.strlen_ > STACK_STRLEN_MAX;
+  Value *fmt_args;
+  if (use_scratch)
+  {
+    fmt_args = b_.CreatePointerCast(getScratchBuffer(), fmt_struct->getPointerTo());
+  }
+  else
+  {
+    fmt_args = b_.CreateAllocaBPF(fmt_struct, call_name + "_args");
+    b_.CreateMemSet(fmt_args, b_.getInt8(0), struct_size, 1);
+  }
 
   Value *id_offset = b_.CreateGEP(fmt_args, {b_.getInt32(0), b_.getInt32(0)});
   b_.CreateStore(b_.getInt64(id + asyncactionint(async_action)), id_offset);
@@ -1693,7 +2117,10 @@ void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_arg
     expr_deleter_ = nullptr;
     arg.accept(*this);
     Value *offset = b_.CreateGEP(fmt_args, {b_.getInt32(0), b_.getInt32(i)});
-    if (arg.type.IsArray())
+    if (arg.type.IsArray() && use_scratch)
+      // LLVM can't inline a memcpy this large for BPF
+      b_.CreateProbeRead(offset, arg.type.size, expr_);
+    else if (arg.type.IsArray())
       b_.CREATE_MEMCPY(offset, expr_, arg.type.size, 1);
     else
       b_.CreateStore(expr_, offset);
@@ -1704,37 +2131,105 @@ void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_arg
 
   id++;
   b_.CreatePerfEventOutput(ctx_, fmt_args, struct_size);
-  b_.CreateLifetimeEnd(fmt_args);
+  if (!use_scratch)
+    b_.CreateLifetimeEnd(fmt_args);
   expr_ = nullptr;
 }
 
-std::unique_ptr<BpfOrc> CodegenLLVM::compile(DebugLevel debug, std::ostream &out)
+bool CodegenLLVM::canShareProbeBody(Probe &probe)
 {
-  createLog2Function();
-  createLinearFunction();
-  root_->accept(*this);
+  // USDT arguments and tracepoint args structs are different for each match
+  if (probe.need_tp_args_structs)
+    return false;
+  for (auto attach_point : *probe.attach_points)
+  {
+    if (probetype(attach_point->provider) == ProbeType::usdt)
+      return false;
+  }
+  return true;
+}
 
-  LLVMInitializeBPFTargetInfo();
-  LLVMInitializeBPFTarget();
-  LLVMInitializeBPFTargetMC();
-  LLVMInitializeBPFAsmPrinter();
+bool CodegenLLVM::canUseAttachCookie(Probe &probe)
+{
+  // Only kprobes are attached through BPF links, see AttachedProbe
+  if (!bpftrace_.attach_cookie_ || !canShareProbeBody(probe))
+    return false;
+  for (auto attach_point : *probe.attach_points)
+  {
+    ProbeType type = probetype(attach_point->provider);
+    if (type != ProbeType::kprobe && type != ProbeType::kretprobe)
+      return false;
+  }
+  return true;
+}
 
-  std::string targetTriple = "bpf-pc-linux";
-  module_->setTargetTriple(targetTriple);
+int CodegenLLVM::getProbeId()
+{
+  return bpftrace_.get_probe_id(probefull_);
+}
 
-  std::string error;
-  const Target *target = TargetRegistry::lookupTarget(targetTriple, error);
-  if (!target)
-    throw new std::runtime_error("Could not create LLVM target " + error);
+Value *CodegenLLVM::readBitfield(Value *raw, const Field &field)
+{
+  // raw holds the bytes covering the bitfield, loaded little-endian
+  Value *value = b_.CreateLShr(raw, field.bitfield.access_rshift);
+  value = b_.CreateAnd(value, b_.getInt64(field.bitfield.mask));
+  return b_.CreateIntCast(value, b_.GetType(field.type), false);
+}
 
-  TargetOptions opt;
-  auto RM = Reloc::Model();
-  TargetMachine *targetMachine = target->createTargetMachine(targetTriple, "generic", "", opt, RM);
+Value *CodegenLLVM::getScratchBuffer()
+{
+  // Each call site gets its own buffer, so several can be live at once. The
+  // lookup can't fail, but the verifier needs to see the NULL check.
+  Value *buf = b_.CreateGetScratchBuffer(scratch_id_);
+  scratch_id_++;
+
+  Function *parent = b_.GetInsertBlock()->getParent();
+  BasicBlock *found = BasicBlock::Create(module_->getContext(), "scratch.found", parent);
+  BasicBlock *missing = BasicBlock::Create(module_->getContext(), "scratch.missing", parent);
+  b_.CreateCondBr(b_.CreateICmpNE(buf, ConstantExpr::getCast(Instruction::IntToPtr, b_.getInt64(0), b_.getInt8PtrTy()), "scratchcond"), found, missing);
+
+  b_.SetInsertPoint(missing);
+  b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+
+  b_.SetInsertPoint(found);
+  return buf;
+}
+
+std::unique_ptr<BpfOrc> CodegenLLVM::compile(DebugLevel debug, std::ostream &out)
+{
+  {
+    Timings::Scope timing(bt_timings, "generate IR");
+    createLog2Function();
+    createLinearFunction();
+    createLogLinearFunction();
+    createHashFunction();
+    root_->accept(*this);
+  }
+
+  TargetMachine *targetMachine = createTargetMachine();
+  module_->setTargetTriple(targetMachine->getTargetTriple().str());
   module_->setDataLayout(targetMachine->createDataLayout());
 
+  // Wildcards can expand into hundreds of probe functions, and running O3
+  // over all of them takes longer than the tracing session is worth. Large
+  // modules get O1, which still does what the verifier needs: promoting
+  // allocas and inlining.
+  size_t num_functions = 0, num_insns = 0;
+  for (auto &fn : *module_)
+  {
+    if (fn.isDeclaration())
+      continue;
+    num_functions++;
+    // Internal functions end up inlined into each of their callers
+    size_t copies = fn.hasInternalLinkage() ? std::max(1U, fn.getNumUses()) : 1;
+    for (auto &bb : fn)
+      num_insns += bb.size() * copies;
+  }
+  unsigned opt_level = num_insns > bpftrace_.opt_full_max_insns_ ? 1 : 3;
+
   legacy::PassManager PM;
   PassManagerBuilder PMB;
-  PMB.OptLevel = 3;
+  PMB.OptLevel = opt_level;
   PM.add(createFunctionInliningPass());
   /*
    * llvm < 4.0 needs
@@ -1753,7 +2248,12 @@ std::unique_ptr<BpfOrc> CodegenLLVM::compile(DebugLevel debug, std::ostream &out
     module_->print(llvm_ostream, nullptr, false, true);
   }
 
-  PM.run(*module_.get());
+  auto opt_start = std::chrono::steady_clock::now();
+  {
+    Timings::Scope timing(bt_timings, "optimize");
+    PM.run(*module_.get());
+  }
+  auto opt_end = std::chrono::steady_clock::now();
 
   if (debug != DebugLevel::kNone)
   {
@@ -1766,9 +2266,44 @@ std::unique_ptr<BpfOrc> CodegenLLVM::compile(DebugLevel debug, std::ostream &out
   }
 
   auto bpforc = std::make_unique<BpfOrc>(targetMachine);
-  bpforc->compileModule(move(module_));
+  {
+    Timings::Scope timing(bt_timings, "emit BPF");
+    bpforc->compileModule(move(module_));
+  }
+  auto codegen_end = std::chrono::steady_clock::now();
+
+  if (bt_verbose)
+  {
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    std::cerr << "Optimized " << num_insns << " LLVM instructions in "
+              << num_functions << " functions at -O" << opt_level << " in "
+              << duration_cast<milliseconds>(opt_end - opt_start).count()
+              << " ms, code generation took "
+              << duration_cast<milliseconds>(codegen_end - opt_end).count()
+              << " ms" << std::endl;
+  }
 
   return bpforc;
 }
+
+TargetMachine *CodegenLLVM::createTargetMachine()
+{
+  LLVMInitializeBPFTargetInfo();
+  LLVMInitializeBPFTarget();
+  LLVMInitializeBPFTargetMC();
+  LLVMInitializeBPFAsmPrinter();
+
+  std::string targetTriple = "bpf-pc-linux";
+
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget(targetTriple, error);
+  if (!target)
+    throw new std::runtime_error("Could not create LLVM target " + error);
+
+  TargetOptions opt;
+  auto RM = Reloc::Model();
+  return target->createTargetMachine(targetTriple, "generic", "", opt, RM);
+}
 } // namespace ast
 } // namespace bpftrace
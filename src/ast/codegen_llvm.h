@@ -55,6 +55,11 @@ public:
   void visit(Program &program) override;
   AllocaInst *getMapKey(Map &map);
   AllocaInst *getHistMapKey(Map &map, Value *log2);
+  Value      *getScratchBuffer();
+  Value      *readBitfield(Value *raw, const Field &field);
+  bool        canShareProbeBody(Probe &probe);
+  bool        canUseAttachCookie(Probe &probe);
+  int         getProbeId();
   int         getNextIndexForProbe(const std::string &probe_name);
   std::string getSectionNameForProbe(const std::string &probe_name, int index);
   Value      *createLogicalAnd(Binop &binop);
@@ -62,9 +67,12 @@ public:
 
   void createLog2Function();
   void createLinearFunction();
+  void createLogLinearFunction();
+  void createHashFunction();
   void createFormatStringCall(Call &call, int &id, CallArgs &call_args,
                               const std::string &call_name, AsyncAction async_action);
   std::unique_ptr<BpfOrc> compile(DebugLevel debug=DebugLevel::kNone, std::ostream &out=std::cout);
+  static TargetMachine *createTargetMachine();
 
 private:
   Node *root_;
@@ -76,6 +84,8 @@ private:
   Value *expr_ = nullptr;
   std::function<void()> expr_deleter_; // intentionally empty
   Value *ctx_;
+  Value *probe_id_ = nullptr; // set while generating a shared probe body
+                              // or a program attached with cookies
   AttachPoint *current_attach_point_ = nullptr;
   BPFtrace &bpftrace_;
   std::string probefull_;
@@ -87,6 +97,8 @@ private:
   int time_id_ = 0;
   int cat_id_ = 0;
   uint64_t join_id_ = 0;
+  int ratelimit_id_ = 0;
+  int scratch_id_ = 0;
   int system_id_ = 0;
 };
 
@@ -171,6 +171,63 @@ CallInst *IRBuilderBPF::CreateGetJoinMap(Value *ctx __attribute__((unused)))
   return call;
 }
 
+CallInst *IRBuilderBPF::CreateGetRatelimitState(int id)
+{
+  Value *map_ptr = CreateBpfPseudoCall(bpftrace_.ratelimit_map_->mapfd_);
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(id), key);
+
+  FunctionType *lookup_func_type = FunctionType::get(
+      getInt8PtrTy(),
+      {getInt8PtrTy(), getInt8PtrTy()},
+      false);
+  PointerType *lookup_func_ptr_type = PointerType::get(lookup_func_type, 0);
+  Constant *lookup_func = ConstantExpr::getCast(
+      Instruction::IntToPtr,
+      getInt64(BPF_FUNC_map_lookup_elem),
+      lookup_func_ptr_type);
+  CallInst *call = CreateCall(lookup_func, {map_ptr, key}, "ratelimit_elem");
+  return call;
+}
+
+CallInst *IRBuilderBPF::CreateGetScratchBuffer(int id)
+{
+  Value *map_ptr = CreateBpfPseudoCall(bpftrace_.scratch_map_->mapfd_);
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(id), key);
+
+  FunctionType *lookup_func_type = FunctionType::get(
+      getInt8PtrTy(),
+      {getInt8PtrTy(), getInt8PtrTy()},
+      false);
+  PointerType *lookup_func_ptr_type = PointerType::get(lookup_func_type, 0);
+  Constant *lookup_func = ConstantExpr::getCast(
+      Instruction::IntToPtr,
+      getInt64(BPF_FUNC_map_lookup_elem),
+      lookup_func_ptr_type);
+  CallInst *call = CreateCall(lookup_func, {map_ptr, key}, "scratch_elem");
+  return call;
+}
+
+CallInst *IRBuilderBPF::CreateGetElapsedStart()
+{
+  Value *map_ptr = CreateBpfPseudoCall(bpftrace_.elapsed_map_->mapfd_);
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(0), key);
+
+  FunctionType *lookup_func_type = FunctionType::get(
+      getInt8PtrTy(),
+      {getInt8PtrTy(), getInt8PtrTy()},
+      false);
+  PointerType *lookup_func_ptr_type = PointerType::get(lookup_func_type, 0);
+  Constant *lookup_func = ConstantExpr::getCast(
+      Instruction::IntToPtr,
+      getInt64(BPF_FUNC_map_lookup_elem),
+      lookup_func_ptr_type);
+  CallInst *call = CreateCall(lookup_func, {map_ptr, key}, "elapsed_elem");
+  return call;
+}
+
 Value *IRBuilderBPF::CreateMapLookupElem(Map &map, AllocaInst *key)
 {
   Value *map_ptr = CreateBpfPseudoCall(map);
@@ -259,7 +316,7 @@ void IRBuilderBPF::CreateMapDeleteElem(Map &map, AllocaInst *key)
   CreateCall(delete_func, {map_ptr, key}, "delete_elem");
 }
 
-void IRBuilderBPF::CreateProbeRead(AllocaInst *dst, size_t size, Value *src)
+void IRBuilderBPF::CreateProbeRead(Value *dst, size_t size, Value *src)
 {
   // int bpf_probe_read(void *dst, int size, void *src)
   // Return: 0 on success or negative error
@@ -280,7 +337,7 @@ CallInst *IRBuilderBPF::CreateProbeReadStr(AllocaInst *dst, size_t size, Value *
   return CreateProbeReadStr(dst, getInt64(size), src);
 }
 
-CallInst *IRBuilderBPF::CreateProbeReadStr(AllocaInst *dst, llvm::Value *size, Value *src)
+CallInst *IRBuilderBPF::CreateProbeReadStr(Value *dst, llvm::Value *size, Value *src)
 {
   // int bpf_probe_read_str(void *dst, int size, const void *unsafe_ptr)
   FunctionType *probereadstr_func_type = FunctionType::get(
@@ -577,6 +634,24 @@ CallInst *IRBuilderBPF::CreateGetRandom()
   return CreateCall(getrandom_func, {}, "get_random");
 }
 
+CallInst *IRBuilderBPF::CreateGetAttachCookie(Value *ctx)
+{
+  #ifndef HAVE_GET_ATTACH_COOKIE
+    std::cerr << "BPF_FUNC_get_attach_cookie is not available for your kernel version" << std::endl;
+    abort();
+  #else
+    // u64 bpf_get_attach_cookie(void *ctx)
+    // Return: cookie the program was attached with
+    FunctionType *getcookie_func_type = FunctionType::get(getInt64Ty(), {getInt8PtrTy()}, false);
+    PointerType *getcookie_func_ptr_type = PointerType::get(getcookie_func_type, 0);
+    Constant *getcookie_func = ConstantExpr::getCast(
+      Instruction::IntToPtr,
+      getInt64(BPF_FUNC_get_attach_cookie),
+      getcookie_func_ptr_type);
+    return CreateCall(getcookie_func, {ctx}, "get_attach_cookie");
+  #endif
+}
+
 CallInst *IRBuilderBPF::CreateGetStackId(Value *ctx, bool ustack, StackType stack_type)
 {
   assert(bpftrace_.stackid_maps_.count(stack_type) == 1);
@@ -619,6 +694,16 @@ void IRBuilderBPF::CreateGetCurrentComm(AllocaInst *buf, size_t size)
 
 void IRBuilderBPF::CreatePerfEventOutput(Value *ctx, Value *data, size_t size)
 {
+  if (bpftrace_.ordered_output_)
+  {
+    // Append the time, for user space to put the records of all CPUs in
+    // order. data has room for it, see BPFtrace::perf_event_buffer_size().
+    size_t stamp_offset = bpftrace_.perf_event_buffer_size(size) - sizeof(uint64_t);
+    Value *stamp = CreateGEP(CreatePointerCast(data, getInt8PtrTy()), getInt64(stamp_offset));
+    CreateStore(CreateGetNs(), CreatePointerCast(stamp, getInt64Ty()->getPointerTo()));
+    size = stamp_offset + sizeof(uint64_t);
+  }
+
   Value *map_ptr = CreateBpfPseudoCall(bpftrace_.perf_event_map_->mapfd_);
 
   Value *flags_val = CreateGetCpuId();
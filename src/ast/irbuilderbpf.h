@@ -41,8 +41,8 @@ public:
   Value      *CreateMapLookupElem(Map &map, AllocaInst *key);
   void        CreateMapUpdateElem(Map &map, AllocaInst *key, Value *val);
   void        CreateMapDeleteElem(Map &map, AllocaInst *key);
-  void        CreateProbeRead(AllocaInst *dst, size_t size, Value *src);
-  CallInst   *CreateProbeReadStr(AllocaInst *dst, llvm::Value *size, Value *src);
+  void        CreateProbeRead(Value *dst, size_t size, Value *src);
+  CallInst   *CreateProbeReadStr(Value *dst, llvm::Value *size, Value *src);
   CallInst   *CreateProbeReadStr(AllocaInst *dst, size_t size, Value *src);
   CallInst   *CreateProbeReadStr(Value *dst, size_t size, Value *src);
   Value      *CreateUSDTReadArgument(Value *ctx, AttachPoint *attach_point, int arg_name, Builtin &builtin, int pid);
@@ -55,8 +55,12 @@ public:
   CallInst   *CreateGetCpuId();
   CallInst   *CreateGetCurrentTask();
   CallInst   *CreateGetRandom();
+  CallInst   *CreateGetAttachCookie(Value *ctx);
   CallInst   *CreateGetStackId(Value *ctx, bool ustack, StackType stack_type);
   CallInst   *CreateGetJoinMap(Value *ctx);
+  CallInst   *CreateGetRatelimitState(int id);
+  CallInst   *CreateGetScratchBuffer(int id);
+  CallInst   *CreateGetElapsedStart();
   void        CreateGetCurrentComm(AllocaInst *buf, size_t size);
   void        CreatePerfEventOutput(Value *ctx, Value *data, size_t size);
 
@@ -104,7 +104,10 @@ void SemanticAnalyser::visit(Builtin &builtin)
       builtin.ident == "rand" ||
       builtin.ident == "ctx") {
     builtin.type = SizedType(Type::integer, 8, false);
-    if (builtin.ident == "cgroup") {
+    if (builtin.ident == "elapsed") {
+      needs_elapsed_map_ = true;
+    }
+    else if (builtin.ident == "cgroup") {
       #ifndef HAVE_GET_CURRENT_CGROUP_ID
       buf << "BPF_FUNC_get_current_cgroup_id is not available for your kernel version";
       #endif
@@ -234,7 +237,11 @@ void SemanticAnalyser::visit(Call &call)
 
   if (call.vargs) {
     for (Expression *expr : *call.vargs) {
+      if (expr->is_map && (call.func == "delete" || call.func == "print" ||
+                           call.func == "clear" || call.func == "zero"))
+        map_target_ = static_cast<Map*>(expr);
       expr->accept(*this);
+      map_target_ = nullptr;
     }
   }
 
@@ -323,6 +330,49 @@ void SemanticAnalyser::visit(Call &call)
     check_nargs(call, 1);
     call.type = SizedType(Type::stats, 8, true);
   }
+  else if (call.func == "topk") {
+    check_assignment(call, true, false);
+    if (check_nargs(call, 1)) {
+      auto &arg = *call.vargs->at(0);
+      if (arg.type.type != Type::integer && arg.type.type != Type::kstack &&
+          arg.type.type != Type::ustack && arg.type.type != Type::ksym &&
+          arg.type.type != Type::username && arg.type.type != Type::probe &&
+          arg.type.type != Type::none)
+        buf << "topk() only supports integer, stack, ksym, username and probe values ("
+            << arg.type.type << " provided)";
+
+      if (call.map && call.map->vargs)
+        buf << "topk() maps cannot have keys";
+
+      // store args for later passing to bpftrace::Map
+      if (is_final_pass() && call.map) {
+        auto search = map_args_.find(call.map->ident);
+        if (search == map_args_.end())
+          map_args_.insert({call.map->ident, *call.vargs});
+      }
+    }
+    call.type = SizedType(Type::topk, 8);
+  }
+  else if (call.func == "hll" || call.func == "cardinality") {
+    check_assignment(call, true, false);
+    if (check_nargs(call, 1)) {
+      auto &arg = *call.vargs->at(0);
+      if (arg.type.type != Type::integer && arg.type.type != Type::kstack &&
+          arg.type.type != Type::ustack && arg.type.type != Type::ksym &&
+          arg.type.type != Type::username && arg.type.type != Type::probe &&
+          arg.type.type != Type::none)
+        buf << call.func << "() only supports integer, stack, ksym, username and probe values ("
+            << arg.type.type << " provided)";
+    }
+    call.type = SizedType(Type::hll, 8);
+  }
+  else if (call.func == "quantiles") {
+    check_assignment(call, true, false);
+    check_nargs(call, 1);
+    check_arg(call, Type::integer, 0);
+
+    call.type = SizedType(Type::quantiles, 8);
+  }
   else if (call.func == "delete") {
     check_assignment(call, false, false);
     if (check_nargs(call, 1)) {
@@ -340,6 +390,10 @@ void SemanticAnalyser::visit(Call &call)
       if (is_final_pass() && call.vargs->size() > 1) {
         check_arg(call, Type::integer, 1, false);
       }
+      if (is_final_pass() && bpftrace_.strlen_ > STACK_STRLEN_MAX) {
+        scratch_count_++;
+        scratch_size_ = std::max(scratch_size_, (size_t)bpftrace_.strlen_);
+      }
       if (auto *param = dynamic_cast<PositionalParameter*>(call.vargs->at(0))) {
         param->is_in_str = true;
       }
@@ -408,6 +462,42 @@ void SemanticAnalyser::visit(Call &call)
       }
     }
   }
+  else if (call.func == "sample") {
+    if (check_nargs(call, 1)) {
+      // the rate must be a fraction of integer literals, e.g. 1/100
+      auto &arg = *call.vargs->at(0);
+      Binop *rate = dynamic_cast<Binop*>(&arg);
+      if (!rate || rate->op != bpftrace::Parser::token::DIV ||
+          !rate->left->is_literal || rate->left->type.type != Type::integer ||
+          !rate->right->is_literal || rate->right->type.type != Type::integer)
+      {
+        buf << "sample() expects a rate of the form 1/N";
+      }
+      else
+      {
+        Integer &num = static_cast<Integer&>(*rate->left);
+        Integer &den = static_cast<Integer&>(*rate->right);
+        if (num.n <= 0 || den.n <= 0 || num.n > den.n)
+          buf << "sample() rate must be between 0 and 1 ("
+              << num.n << "/" << den.n << " provided)";
+        else if (den.n > UINT32_MAX)
+          buf << "sample() denominator must be <= " << UINT32_MAX;
+      }
+    }
+    call.type = SizedType(Type::integer, 8);
+  }
+  else if (call.func == "ratelimit") {
+    if (check_nargs(call, 1)) {
+      if (check_arg(call, Type::integer, 0, true)) {
+        auto &rate = static_cast<Integer&>(*call.vargs->at(0));
+        if (rate.n <= 0)
+          buf << "ratelimit() rate must be >= 1 (" << rate.n << " provided)";
+      }
+    }
+    if (is_final_pass())
+      ratelimit_count_++;
+    call.type = SizedType(Type::integer, 8);
+  }
   else if (call.func == "reg") {
     if (check_nargs(call, 1)) {
       for (auto &attach_point : *probe_->attach_points) {
@@ -469,6 +559,17 @@ void SemanticAnalyser::visit(Call &call)
         }
         buf << verify_format_string(fmt.str, args);
 
+        if (bpftrace_.strlen_ > STACK_STRLEN_MAX) {
+          // upper bound of the argument struct built by codegen, allowing
+          // for each field to be padded to 8 bytes
+          size_t args_size = 8;
+          for (auto &arg : args)
+            args_size += (arg.type.size + 7) & ~7UL;
+          args_size = bpftrace_.perf_event_buffer_size(args_size);
+          scratch_count_++;
+          scratch_size_ = std::max(scratch_size_, args_size);
+        }
+
         if (call.func == "printf")
           bpftrace_.printf_args_.emplace_back(fmt.str, args);
         else if (call.func == "system")
@@ -611,6 +712,9 @@ void SemanticAnalyser::check_stack_call(Call &call, Type type) {
 
 void SemanticAnalyser::visit(Map &map)
 {
+  // visiting the keys may change map_target_
+  bool is_target = &map == map_target_;
+
   if (is_final_pass()) {
     MapKey key;
     if (map.vargs) {
@@ -620,6 +724,12 @@ void SemanticAnalyser::visit(Map &map)
         if (!expr->type.IsArray())
           expr->type.size = 8;
 
+        // keys are built on the BPF stack
+        if (expr->type.type == Type::string && expr->type.size > STACK_STRLEN_MAX) {
+          err_ << "Strings used as map keys are limited to " << STACK_STRLEN_MAX;
+          err_ << " bytes (BPFTRACE_STRLEN is " << expr->type.size << ")" << std::endl;
+        }
+
         // Skip is_signed when comparing keys to not break existing scripts
         // which use maps as a lookup table
         // TODO (fbs): This needs a better solution
@@ -657,6 +767,14 @@ void SemanticAnalyser::visit(Map &map)
     }
     map.type = SizedType(Type::none, 0);
   }
+
+  // values read back in a probe are copied to the BPF stack
+  if (is_final_pass() && !is_target &&
+      map.type.type == Type::string && map.type.size > STACK_STRLEN_MAX) {
+    err_ << "Strings stored in maps can only be read in a probe up to ";
+    err_ << STACK_STRLEN_MAX << " bytes (BPFTRACE_STRLEN is ";
+    err_ << map.type.size << ")" << std::endl;
+  }
 }
 
 void SemanticAnalyser::visit(Variable &var)
@@ -1004,7 +1122,9 @@ void SemanticAnalyser::visit(ExprStatement &expr)
 
 void SemanticAnalyser::visit(AssignMapStatement &assignment)
 {
+  map_target_ = assignment.map;
   assignment.map->accept(*this);
+  map_target_ = nullptr;
   assignment.expr->accept(*this);
 
   assign_map_type(*assignment.map, assignment.expr->type);
@@ -1033,6 +1153,13 @@ void SemanticAnalyser::visit(AssignVarStatement &assignment)
   std::string var_ident = assignment.var->ident;
   auto search = variable_val_.find(var_ident);
   assignment.var->type = assignment.expr->type;
+
+  // variables live on the BPF stack
+  if (is_final_pass() && assignment.expr->type.type == Type::string &&
+      assignment.expr->type.size > STACK_STRLEN_MAX) {
+    err_ << "Strings stored in variables are limited to " << STACK_STRLEN_MAX;
+    err_ << " bytes (BPFTRACE_STRLEN is " << assignment.expr->type.size << ")" << std::endl;
+  }
   if (search != variable_val_.end()) {
     if (search->second.type == Type::none) {
       if (is_final_pass()) {
@@ -1279,7 +1406,28 @@ int SemanticAnalyser::create_maps(bool debug)
       abort();
     }
 
-    auto &key = search_args->second;
+    auto key = search_args->second;
+
+    if (type.type == Type::topk)
+    {
+      // topk maps are indexed by sketch cell, the tracked value is only
+      // needed as a key type when printing
+      auto map_args = map_args_.find(map_name);
+      if (map_args == map_args_.end())
+      {
+        out_ << "map arg \"" << map_name << "\" not found" << std::endl;
+        abort();
+      }
+
+      SizedType value_type = map_args->second.at(0)->type;
+      if (value_type.type == Type::integer)
+      {
+        // values are promoted to 64-bit
+        value_type.size = 8;
+        value_type.is_signed = true;
+      }
+      key.args_ = { value_type };
+    }
 
     if (debug)
       bpftrace_.maps_[map_name] = std::make_unique<bpftrace::FakeMap>(map_name, type, key);
@@ -1329,10 +1477,34 @@ int SemanticAnalyser::create_maps(bool debug)
     {
       // join uses map storage as we'd like to process data larger than can fit on the BPF stack.
       std::string map_ident = "join";
-      SizedType type = SizedType(Type::join, 8 + 8 + bpftrace_.join_argnum_ * bpftrace_.join_argsize_);
+      SizedType type = SizedType(Type::join, bpftrace_.perf_event_buffer_size(8 + 8 + bpftrace_.join_argnum_ * bpftrace_.join_argsize_));
       MapKey key;
       bpftrace_.join_map_ = std::make_unique<bpftrace::FakeMap>(map_ident, type, key);
     }
+    if (ratelimit_count_ > 0)
+    {
+      // ratelimit() keeps its token bucket (tokens, last refill) per call site
+      std::string map_ident = "ratelimit";
+      SizedType type = SizedType(Type::ratelimit, 8 + 8);
+      MapKey key;
+      bpftrace_.ratelimit_map_ = std::make_unique<bpftrace::FakeMap>(map_ident, type, key);
+    }
+    if (scratch_count_ > 0)
+    {
+      // strings too large for the BPF stack are built in map storage
+      std::string map_ident = "scratch";
+      SizedType type = SizedType(Type::scratch, scratch_size_);
+      MapKey key;
+      bpftrace_.scratch_map_ = std::make_unique<bpftrace::FakeMap>(map_ident, type, key);
+    }
+    if (needs_elapsed_map_)
+    {
+      // the start time for elapsed, set when the program is run
+      std::string map_ident = "elapsed";
+      SizedType type = SizedType(Type::elapsed, 8);
+      MapKey key;
+      bpftrace_.elapsed_map_ = std::make_unique<bpftrace::FakeMap>(map_ident, type, key);
+    }
     bpftrace_.perf_event_map_ = std::make_unique<bpftrace::FakeMap>(BPF_MAP_TYPE_PERF_EVENT_ARRAY);
   }
   else
@@ -1341,11 +1513,38 @@ int SemanticAnalyser::create_maps(bool debug)
     {
       // join uses map storage as we'd like to process data larger than can fit on the BPF stack.
       std::string map_ident = "join";
-      SizedType type = SizedType(Type::join, 8 + 8 + bpftrace_.join_argnum_ * bpftrace_.join_argsize_);
+      SizedType type = SizedType(Type::join, bpftrace_.perf_event_buffer_size(8 + 8 + bpftrace_.join_argnum_ * bpftrace_.join_argsize_));
       MapKey key;
       bpftrace_.join_map_ = std::make_unique<bpftrace::Map>(map_ident, type, key, 1);
       failed_maps += is_invalid_map(bpftrace_.join_map_->mapfd_);
     }
+    if (ratelimit_count_ > 0)
+    {
+      // ratelimit() keeps its token bucket (tokens, last refill) per call site
+      std::string map_ident = "ratelimit";
+      SizedType type = SizedType(Type::ratelimit, 8 + 8);
+      MapKey key;
+      bpftrace_.ratelimit_map_ = std::make_unique<bpftrace::Map>(map_ident, type, key, ratelimit_count_);
+      failed_maps += is_invalid_map(bpftrace_.ratelimit_map_->mapfd_);
+    }
+    if (scratch_count_ > 0)
+    {
+      // strings too large for the BPF stack are built in map storage
+      std::string map_ident = "scratch";
+      SizedType type = SizedType(Type::scratch, scratch_size_);
+      MapKey key;
+      bpftrace_.scratch_map_ = std::make_unique<bpftrace::Map>(map_ident, type, key, scratch_count_);
+      failed_maps += is_invalid_map(bpftrace_.scratch_map_->mapfd_);
+    }
+    if (needs_elapsed_map_)
+    {
+      // the start time for elapsed, set when the program is run
+      std::string map_ident = "elapsed";
+      SizedType type = SizedType(Type::elapsed, 8);
+      MapKey key;
+      bpftrace_.elapsed_map_ = std::make_unique<bpftrace::Map>(map_ident, type, key, 1);
+      failed_maps += is_invalid_map(bpftrace_.elapsed_map_->mapfd_);
+    }
     bpftrace_.perf_event_map_ = std::make_unique<bpftrace::Map>(BPF_MAP_TYPE_PERF_EVENT_ARRAY);
     failed_maps += is_invalid_map(bpftrace_.perf_event_map_->mapfd_);
   }
@@ -75,6 +75,12 @@ private:
   std::map<std::string, ExpressionList> map_args_;
   std::unordered_set<StackType> needs_stackid_maps_;
   bool needs_join_map_ = false;
+  int ratelimit_count_ = 0;
+  int scratch_count_ = 0;
+  size_t scratch_size_ = 0;
+  bool needs_elapsed_map_ = false;
+  // The map being written, or passed to a function which doesn't read it
+  const Map *map_target_ = nullptr;
   bool has_begin_probe_ = false;
   bool has_end_probe_ = false;
 };
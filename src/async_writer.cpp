@@ -0,0 +1,349 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "async_writer.h"
+
+namespace bpftrace {
+
+const std::chrono::seconds AsyncWriter::FLUSH_INTERVAL(1);
+
+AsyncWriter::AsyncWriter(size_t buffer_size,
+                         uint64_t rotate_size,
+                         bool datasync,
+                         bool compress)
+  : buffer_size_(buffer_size),
+    rotate_size_(rotate_size),
+    datasync_(datasync),
+    compress_(compress)
+{
+}
+
+AsyncWriter::~AsyncWriter()
+{
+  close();
+}
+
+bool AsyncWriter::compression_supported()
+{
+#ifdef HAVE_LIBZSTD
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool AsyncWriter::open(const std::string &path)
+{
+  if (compress_)
+  {
+#ifdef HAVE_LIBZSTD
+    cctx_ = ZSTD_createCCtx();
+    if (!cctx_)
+    {
+      errno = ENOMEM;
+      return false;
+    }
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    compressed_.resize(ZSTD_CStreamOutSize());
+    last_flush_ = std::chrono::steady_clock::now();
+#else
+    errno = ENOTSUP;
+    return false;
+#endif
+  }
+
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd_ < 0)
+    return false;
+
+  path_ = path;
+  opened_ = true;
+  queued_.reserve(buffer_size_);
+  writer_ = std::thread(&AsyncWriter::writer_loop, this);
+  return true;
+}
+
+void AsyncWriter::close()
+{
+  if (!opened_)
+    return;
+
+  set_blocking(true);
+  commit();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_one();
+  writer_.join();
+
+  finish_file();
+  ::close(fd_);
+  fd_ = -1;
+  opened_ = false;
+#ifdef HAVE_LIBZSTD
+  ZSTD_freeCCtx(cctx_);
+  cctx_ = nullptr;
+#endif
+
+  if (dropped_records_ > 0)
+  {
+    std::cerr << "Lost " << dropped_records_ << " records (" << dropped_bytes_
+              << " bytes) of output to " << path_
+              << ", try a larger BPFTRACE_OUTPUT_BUFFER_SIZE" << std::endl;
+  }
+}
+
+void AsyncWriter::set_blocking(bool blocking)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  blocking_ = blocking;
+}
+
+uint64_t AsyncWriter::dropped_records() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_records_;
+}
+
+uint64_t AsyncWriter::dropped_bytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_bytes_;
+}
+
+AsyncWriter::int_type AsyncWriter::overflow(int_type c)
+{
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+
+  pending_ += traits_type::to_char_type(c);
+  return c;
+}
+
+std::streamsize AsyncWriter::xsputn(const char *s, std::streamsize n)
+{
+  pending_.append(s, n);
+  return n;
+}
+
+int AsyncWriter::sync()
+{
+  commit();
+  return 0;
+}
+
+void AsyncWriter::commit()
+{
+  if (pending_.empty() || !opened_)
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto fits = [this]() {
+      return queued_.size() + pending_.size() <= buffer_size_;
+    };
+    if (blocking_)
+    {
+      // A record bigger than the whole buffer goes once the queue is empty
+      space_cond_.wait(lock, [&]() { return fits() || queued_.empty(); });
+      queued_ += pending_;
+    }
+    else if (!fits())
+    {
+      dropped_records_++;
+      dropped_bytes_ += pending_.size();
+    }
+    else
+    {
+      queued_ += pending_;
+    }
+  }
+  pending_.clear();
+  cond_.notify_one();
+}
+
+void AsyncWriter::writer_loop()
+{
+  std::string writing;
+  writing.reserve(buffer_size_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true)
+  {
+    bool ready = cond_.wait_for(lock, FLUSH_INTERVAL, [this]() {
+      return !queued_.empty() || stopping_;
+    });
+    if (!ready)
+    {
+      // Nothing new: make sure compressed output isn't left behind in the
+      // compressor while we're idle
+      if (unflushed_)
+      {
+        lock.unlock();
+        write_out("");
+        lock.lock();
+      }
+      continue;
+    }
+    if (queued_.empty())
+      break;
+
+    writing.swap(queued_);
+    space_cond_.notify_all();
+    lock.unlock();
+    write_out(writing);
+    writing.clear();
+    lock.lock();
+  }
+}
+
+void AsyncWriter::write_out(const std::string &data)
+{
+  if (write_failed_)
+    return;
+
+  // Compressed output is rotated once the file reaches rotate_size, as its
+  // compressed size isn't known up front
+  uint64_t new_size = file_size_ + (cctx_ ? 0 : data.size());
+  if (rotate_size_ && file_size_ > 0 && new_size > rotate_size_)
+  {
+    if (!rotate())
+      return;
+  }
+
+  if (cctx_)
+  {
+#ifdef HAVE_LIBZSTD
+    if (!compress(data, ZSTD_e_continue))
+      return;
+    unflushed_ = true;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_flush_ < FLUSH_INTERVAL && !data.empty())
+      return;
+    if (!compress("", ZSTD_e_flush))
+      return;
+    unflushed_ = false;
+    last_flush_ = now;
+#endif
+  }
+  else if (!write_fd(data.data(), data.size()))
+  {
+    return;
+  }
+
+  if (datasync_)
+    fdatasync(fd_);
+}
+
+bool AsyncWriter::write_fd(const char *data, size_t size)
+{
+  size_t written = 0;
+  while (written < size)
+  {
+    ssize_t ret = ::write(fd_, data + written, size - written);
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "Failed to write output to " << path_ << ": "
+                << strerror(errno) << std::endl;
+      write_failed_ = true;
+      return false;
+    }
+    written += ret;
+  }
+  file_size_ += written;
+  return true;
+}
+
+// Feeds data to the compressor, writing out whatever it produces. mode is
+// a ZSTD_EndDirective: with ZSTD_e_flush or ZSTD_e_end, everything given to
+// the compressor so far is written.
+bool AsyncWriter::compress(const std::string &data __attribute__((unused)),
+                           int mode __attribute__((unused)))
+{
+#ifdef HAVE_LIBZSTD
+  auto directive = static_cast<ZSTD_EndDirective>(mode);
+  ZSTD_inBuffer in = { data.data(), data.size(), 0 };
+  bool done;
+  do
+  {
+    ZSTD_outBuffer out = { compressed_.data(), compressed_.size(), 0 };
+    size_t remaining = ZSTD_compressStream2(cctx_, &out, &in, directive);
+    if (ZSTD_isError(remaining))
+    {
+      std::cerr << "Failed to compress output to " << path_ << ": "
+                << ZSTD_getErrorName(remaining) << std::endl;
+      write_failed_ = true;
+      return false;
+    }
+    if (!write_fd(compressed_.data(), out.pos))
+      return false;
+    if (directive == ZSTD_e_continue)
+      done = in.pos == in.size;
+    else
+      done = remaining == 0;
+  } while (!done);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Ends the zstd frame, so the file can be decompressed in full
+void AsyncWriter::finish_file()
+{
+#ifdef HAVE_LIBZSTD
+  if (cctx_ && !write_failed_)
+    compress("", ZSTD_e_end);
+  unflushed_ = false;
+#endif
+}
+
+bool AsyncWriter::rotate()
+{
+  // Compressed files keep their extension, e.g. out.1.zst
+  std::string suffix = "." + std::to_string(++rotations_);
+  std::string rotated = path_ + suffix;
+  size_t ext = path_.rfind('.');
+  if (cctx_ && ext != std::string::npos && ext > path_.rfind('/') + 1)
+    rotated = path_.substr(0, ext) + suffix + path_.substr(ext);
+
+  finish_file();
+  if (write_failed_)
+    return false;
+
+  if (::rename(path_.c_str(), rotated.c_str()) != 0)
+  {
+    std::cerr << "Failed to rotate output file " << path_ << ": "
+              << strerror(errno) << std::endl;
+    // Keep writing to the current file
+    return true;
+  }
+
+  int fd = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0)
+  {
+    std::cerr << "Failed to open output file " << path_ << ": "
+              << strerror(errno) << std::endl;
+    write_failed_ = true;
+    return false;
+  }
+
+  ::close(fd_);
+  fd_ = fd;
+  file_size_ = 0;
+  return true;
+}
+
+} // namespace bpftrace
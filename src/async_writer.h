@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+
+namespace bpftrace {
+
+// A streambuf for -o which writes the file from a background thread, so a
+// slow disk can't stall the perf buffer consumer into kernel drops.
+//
+// Output is handed to the writer a record at a time, whenever the stream is
+// flushed (e.g. by std::endl), so each flush must end a whole record. The
+// writer swaps out everything queued so far and writes it while new records
+// are queued, so up to twice buffer_size bytes are held. Records which don't
+// fit in the queue are dropped whole and counted, rather than blocking the
+// caller, unless set_blocking() was called.
+//
+// With compress, the file is a zstd stream, compressed by the writer thread.
+// The compressor is flushed at least every FLUSH_INTERVAL, so everything up
+// to then can be decompressed from a partial file.
+class AsyncWriter : public std::streambuf
+{
+public:
+  // rotate_size: start a new file once the current one would grow past this
+  // many bytes, renaming the old one to path.1, path.2, ... (0 to disable)
+  // datasync: fdatasync() after each write
+  AsyncWriter(size_t buffer_size,
+              uint64_t rotate_size,
+              bool datasync,
+              bool compress = false);
+  ~AsyncWriter() override;
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter& operator=(const AsyncWriter &) = delete;
+
+  // bpftrace was built with zstd
+  static bool compression_supported();
+  static const std::chrono::seconds FLUSH_INTERVAL;
+
+  // Returns false, with errno set, if path can't be opened
+  bool open(const std::string &path);
+  // Writes out everything queued and stops the writer thread
+  void close();
+  // Wait for the writer to make room instead of dropping records. For
+  // output which isn't racing the kernel's perf buffers, e.g. END and the
+  // maps printed on exit.
+  void set_blocking(bool blocking);
+
+  uint64_t dropped_records() const;
+  uint64_t dropped_bytes() const;
+
+protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+  int sync() override;
+
+private:
+  size_t buffer_size_;
+  uint64_t rotate_size_;
+  bool datasync_;
+  bool compress_;
+
+  std::string path_;
+  bool opened_ = false;
+  // Only used by the writer thread while it runs
+  int fd_ = -1;
+  uint64_t file_size_ = 0;
+  int rotations_ = 0;
+  bool write_failed_ = false;
+  ZSTD_CCtx_s *cctx_ = nullptr;
+  std::vector<char> compressed_;
+  bool unflushed_ = false;
+  std::chrono::steady_clock::time_point last_flush_;
+
+  // The record being written, only touched by the caller's thread
+  std::string pending_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  // Signalled when the writer takes the queued records
+  std::condition_variable space_cond_;
+  std::string queued_;
+  bool blocking_ = false;
+  bool stopping_ = false;
+  uint64_t dropped_records_ = 0;
+  uint64_t dropped_bytes_ = 0;
+  std::thread writer_;
+
+  void commit();
+  void writer_loop();
+  void write_out(const std::string &data);
+  bool write_fd(const char *data, size_t size);
+  bool compress(const std::string &data, int mode);
+  void finish_file();
+  bool rotate();
+};
+
+} // namespace bpftrace
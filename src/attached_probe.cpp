@@ -8,12 +8,14 @@
 #include <linux/hw_breakpoint.h>
 #include <regex>
 #include <sys/auxv.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
 #include <tuple>
 #include <unistd.h>
 
 #include "attached_probe.h"
 #include "bpftrace.h"
+#include "timings.h"
 #include "utils.h"
 #include "bcc_syms.h"
 #include "bcc_usdt.h"
@@ -84,6 +86,7 @@ AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func
   load_prog();
   if (bt_verbose)
     std::cerr << "Attaching " << probe_.name << std::endl;
+  Timings::Scope timing(bt_timings, "attach");
   switch (probe_.type)
   {
     case ProbeType::kprobe:
@@ -122,6 +125,7 @@ AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func
   : probe_(probe), func_(func)
 {
   load_prog();
+  Timings::Scope timing(bt_timings, "attach");
   switch (probe_.type)
   {
     case ProbeType::usdt:
@@ -136,8 +140,36 @@ AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func
   }
 }
 
+AttachedProbe::AttachedProbe(Probe &probe, const AttachedProbe &loaded)
+  : probe_(probe), func_(loaded.func_)
+{
+  // Another match has already loaded the program, only the cookie differs
+  progfd_ = dup(loaded.progfd_);
+  if (progfd_ < 0)
+    throw std::runtime_error("Error loading program: " + probe_.name);
+  if (bt_verbose)
+    std::cerr << "Attaching " << probe_.name << std::endl;
+  Timings::Scope timing(bt_timings, "attach");
+  switch (probe_.type)
+  {
+    case ProbeType::kprobe:
+      attach_kprobe();
+      break;
+    case ProbeType::kretprobe:
+      check_banned_kretprobes(probe_.attach_point);
+      attach_kprobe();
+      break;
+    default:
+      std::cerr << "invalid shared probe type \"" << probetypeName(probe_.type) << "\"" << std::endl;
+      abort();
+  }
+}
+
 AttachedProbe::~AttachedProbe()
 {
+  for (int link_fd : link_fds_)
+    close(link_fd);
+
   if (progfd_ >= 0)
     close(progfd_);
 
@@ -154,7 +186,9 @@ AttachedProbe::~AttachedProbe()
   {
     case ProbeType::kprobe:
     case ProbeType::kretprobe:
-      err = bpf_detach_kprobe(eventname().c_str());
+      // kprobes attached with a cookie don't create a kprobe_events entry
+      if (!probe_.use_cookie)
+        err = bpf_detach_kprobe(eventname().c_str());
       break;
     case ProbeType::uprobe:
     case ProbeType::uretprobe:
@@ -325,8 +359,66 @@ static unsigned kernel_version(int attempt)
   abort();
 }
 
+#ifdef HAVE_GET_ATTACH_COOKIE
+/*
+ * Reads a value like "6" or "config:0" from the perf PMU description in
+ * sysfs, returning -1 if it isn't there.
+ */
+static int read_pmu_value(const std::string &path)
+{
+  std::ifstream file(path);
+  std::string value;
+  if (!std::getline(file, value))
+    return -1;
+  auto colon = value.find(':');
+  if (colon != std::string::npos)
+    value = value.substr(colon + 1);
+  try
+  {
+    return std::stoi(value);
+  }
+  catch (const std::exception &)
+  {
+    return -1;
+  }
+}
+#endif
+
+/*
+ * BPF cookies let a single program be attached to many kprobes, each passing
+ * its probe id. bpf_get_attach_cookie() and BPF_LINK_CREATE for perf events
+ * arrived in the same kernel release, so checking that the verifier accepts
+ * the helper is enough.
+ */
+bool attach_cookie_supported()
+{
+#ifdef HAVE_GET_ATTACH_COOKIE
+  // r0 = bpf_get_attach_cookie(ctx); return r0
+  struct bpf_insn insns[2] = {};
+  insns[0].code = BPF_JMP | BPF_CALL;
+  insns[0].imm = BPF_FUNC_get_attach_cookie;
+  insns[1].code = BPF_JMP | BPF_EXIT;
+  char log_buf[256];
+
+#ifdef HAVE_BCC_PROG_LOAD
+  int progfd = bcc_prog_load(BPF_PROG_TYPE_KPROBE, "cookie_test",
+#else
+  int progfd = bpf_prog_load(BPF_PROG_TYPE_KPROBE, "cookie_test",
+#endif
+      insns, sizeof(insns), "GPL", kernel_version(0), 0,
+      log_buf, sizeof(log_buf));
+  if (progfd < 0)
+    return false;
+  close(progfd);
+  return true;
+#else
+  return false;
+#endif
+}
+
 void AttachedProbe::load_prog()
 {
+  Timings::Scope timing(bt_timings, "load");
   uint8_t *insns = std::get<0>(func_);
   int prog_len = std::get<1>(func_);
   const char *license = "GPL";
@@ -422,6 +514,12 @@ typedef int (*attach_probe_wrapper_signature)(int, enum bpf_probe_attach_type, c
 
 void AttachedProbe::attach_kprobe()
 {
+  if (probe_.use_cookie)
+  {
+    attach_kprobe_cookie();
+    return;
+  }
+
   int perf_event_fd = cast_signature<attach_probe_wrapper_signature>(&bpf_attach_kprobe)(progfd_, attachtype(probe_.type),
       eventname().c_str(), probe_.attach_point.c_str(), 0, 0);
 
@@ -439,6 +537,60 @@ void AttachedProbe::attach_kprobe()
   perf_event_fds_.push_back(perf_event_fd);
 }
 
+/*
+ * Older versions of bcc can't pass a cookie, so create the kprobe through the
+ * perf PMU and attach the program to it with a BPF link.
+ */
+void AttachedProbe::attach_kprobe_cookie()
+{
+#ifdef HAVE_GET_ATTACH_COOKIE
+  int perf_event_fd = -1;
+  int pmu_type = read_pmu_value("/sys/bus/event_source/devices/kprobe/type");
+  int retprobe_bit = read_pmu_value("/sys/bus/event_source/devices/kprobe/format/retprobe");
+  if (pmu_type >= 0 && retprobe_bit >= 0)
+  {
+    struct perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = pmu_type;
+    attr.config1 = reinterpret_cast<uint64_t>(probe_.attach_point.c_str());
+    attr.config2 = 0; // offset
+    if (probe_.type == ProbeType::kretprobe)
+      attr.config |= 1ULL << retprobe_bit;
+    perf_event_fd = syscall(__NR_perf_event_open, &attr, -1, 0, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+
+  int link_fd = -1;
+  if (perf_event_fd >= 0)
+  {
+    union bpf_attr attr = {};
+    attr.link_create.prog_fd = progfd_;
+    attr.link_create.target_fd = perf_event_fd;
+    attr.link_create.attach_type = BPF_PERF_EVENT;
+    attr.link_create.perf_event.bpf_cookie = probe_.cookie;
+    link_fd = syscall(__NR_bpf, BPF_LINK_CREATE, &attr, sizeof(attr));
+    if (link_fd < 0)
+    {
+      close(perf_event_fd);
+      perf_event_fd = -1;
+    }
+  }
+
+  if (link_fd < 0) {
+    if (probe_.orig_name != probe_.name) {
+      std::cerr << "Warning: could not attach probe " << probe_.name << ", skipping." << std::endl;
+      return;
+    }
+    throw std::runtime_error("Error attaching probe: '" + probe_.name + "'");
+  }
+
+  perf_event_fds_.push_back(perf_event_fd);
+  link_fds_.push_back(link_fd);
+#else
+  throw std::runtime_error("Error attaching probe: '" + probe_.name +
+                           "', BPF cookies are not supported by this build");
+#endif
+}
+
 void AttachedProbe::attach_uprobe()
 {
   int perf_event_fd = bpf_attach_uprobe(progfd_,
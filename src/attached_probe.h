@@ -1,5 +1,7 @@
 #pragma once
 
+#include <tuple>
+
 #include "types.h"
 
 #include "libbpf.h"
@@ -8,12 +10,14 @@ namespace bpftrace {
 
 bpf_probe_attach_type attachtype(ProbeType t);
 bpf_prog_type progtype(ProbeType t);
+bool attach_cookie_supported();
 
 class AttachedProbe
 {
 public:
   AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func);
   AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func, int pid);
+  AttachedProbe(Probe &probe, const AttachedProbe &loaded);
   ~AttachedProbe();
   AttachedProbe(const AttachedProbe &) = delete;
   AttachedProbe& operator=(const AttachedProbe &) = delete;
@@ -25,6 +29,7 @@ private:
   uint64_t offset() const;
   void load_prog();
   void attach_kprobe();
+  void attach_kprobe_cookie();
   void attach_uprobe();
   void attach_usdt(int pid);
   void attach_tracepoint();
@@ -37,6 +42,7 @@ private:
   Probe &probe_;
   std::tuple<uint8_t *, uintptr_t> func_;
   std::vector<int> perf_event_fds_;
+  std::vector<int> link_fds_;
   int progfd_ = -1;
 };
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <list>
+
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
@@ -46,6 +48,8 @@ private:
   RTDyldObjectLinkingLayer ObjectLayer;
   IRCompileLayer<decltype(ObjectLayer), SimpleCompiler> CompileLayer;
 
+  std::list<std::vector<uint8_t>> loaded_sections_;
+
 public:
   std::map<std::string, std::tuple<uint8_t *, uintptr_t>> sections_;
 
@@ -64,6 +68,14 @@ public:
     CompileLayer.emitAndFinalize(mod);
   }
 
+  // Adds a section compiled by an earlier run, e.g. from the program cache
+  void addSection(const std::string &name, std::vector<uint8_t> data)
+  {
+    loaded_sections_.push_back(std::move(data));
+    auto &section = loaded_sections_.back();
+    sections_[name] = std::make_tuple(section.data(), section.size());
+  }
+
   ModuleHandle addModule(std::unique_ptr<Module> M) {
     // We don't actually care about resolving symbols from other modules
     auto Resolver = createLambdaResolver(
@@ -88,6 +100,8 @@ private:
   IRCompileLayer<decltype(ObjectLayer), SimpleCompiler> CompileLayer;
 #endif
 
+  std::list<std::vector<uint8_t>> loaded_sections_;
+
 public:
   std::map<std::string, std::tuple<uint8_t *, uintptr_t>> sections_;
 
@@ -108,6 +122,13 @@ public:
     cantFail(CompileLayer.emitAndFinalize(K));
   }
 
+  // Adds a section compiled by an earlier run, e.g. from the program cache
+  void addSection(const std::string &name, std::vector<uint8_t> data) {
+    loaded_sections_.push_back(std::move(data));
+    auto &section = loaded_sections_.back();
+    sections_[name] = std::make_tuple(section.data(), section.size());
+  }
+
   VModuleKey addModule(std::unique_ptr<Module> M) {
     auto K = ES.allocateVModule();
     cantFail(CompileLayer.addModule(K, std::move(M)));
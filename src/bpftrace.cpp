@@ -1,15 +1,22 @@
 #include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <sys/epoll.h>
+#include <thread>
 #include <time.h>
 #include <arpa/inet.h>
 
 #include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -25,10 +32,12 @@
 
 #include "bpforc.h"
 #include "bpftrace.h"
+#include "async_writer.h"
 #include "attached_probe.h"
 #include "printf.h"
 #include "triggers.h"
 #include "resolve_cgroupid.h"
+#include "timings.h"
 #include "utils.h"
 
 extern char** environ;
@@ -40,6 +49,13 @@ bool bt_verbose = false;
 volatile sig_atomic_t BPFtrace::exitsig_recv = false;
 constexpr char CHILD_EXIT_QUIETLY = '\0';
 constexpr char CHILD_GO = 'g';
+// Reading more maps at once stops helping well before this
+constexpr unsigned MAX_MAP_READ_THREADS = 8;
+// With --ordered, records beyond this many are printed without waiting for
+// the reorder window, to bound memory
+constexpr size_t MAX_REORDER_EVENTS = 1 << 20;
+// An idle poll doubles the epoll_wait() timeout, up to this
+constexpr uint64_t MAX_IDLE_POLL_TIMEOUT_MS = 1000;
 
 int format(char * s, size_t n, const char * fmt, std::vector<std::unique_ptr<IPrintable>> &args) {
   int ret = -1;
@@ -97,6 +113,8 @@ BPFtrace::~BPFtrace()
 
   if (ksyms_)
     bcc_free_symcache(ksyms_, -1);
+
+  free_perf_readers();
 }
 
 int BPFtrace::add_probe(ast::Probe &p)
@@ -176,6 +194,11 @@ int BPFtrace::add_probe(ast::Probe &p)
       probe.addr = attach_point->addr;
       probe.len = attach_point->len;
       probe.mode = attach_point->mode;
+      if (p.use_attach_cookie)
+      {
+        probe.use_cookie = true;
+        probe.cookie = get_probe_id(probe.name);
+      }
       probes_.push_back(probe);
     }
   }
@@ -338,6 +361,8 @@ void perf_event_printer(void *cb_cookie, void *data, int size __attribute__((unu
   auto arg_data = static_cast<uint8_t*>(data);
   int err;
 
+  bpftrace->perf_records_++;
+
   // Ignore the remaining events if perf_event_printer is called during finalization
   // stage (exit() builtin has been called)
   if (bpftrace->finalize_)
@@ -617,9 +642,18 @@ size_t BPFtrace::num_params() const
   return params_.size();
 }
 
+// With --ordered, records are printed by release_ordered_events()
+void perf_event_reorder(void *cb_cookie, void *data, int size)
+{
+  auto bpftrace = static_cast<BPFtrace*>(cb_cookie);
+  bpftrace->perf_records_++;
+  bpftrace->event_reorder_->push(data, size);
+}
+
 void perf_event_lost(void *cb_cookie, uint64_t lost)
 {
   auto bpftrace = static_cast<BPFtrace*>(cb_cookie);
+  bpftrace->perf_records_++;
   bpftrace->out_->lost_events(lost);
 }
 
@@ -643,6 +677,16 @@ std::unique_ptr<AttachedProbe> BPFtrace::attach_probe(Probe &probe, const BpfOrc
   }
   try
   {
+    if (probe.use_cookie)
+    {
+      // Load the program once and attach it to every match
+      auto shared = shared_progs_.find(func->first);
+      if (shared != shared_progs_.end())
+        return std::make_unique<AttachedProbe>(probe, *shared->second);
+      auto attached_probe = std::make_unique<AttachedProbe>(probe, func->second);
+      shared_progs_[func->first] = attached_probe.get();
+      return attached_probe;
+    }
     if (probe.type == ProbeType::usdt || probe.type == ProbeType::watchpoint)
       return std::make_unique<AttachedProbe>(probe, func->second, pid_);
     else
@@ -681,18 +725,42 @@ int BPFtrace::run(std::unique_ptr<BpfOrc> bpforc)
 {
   int wait_for_tracing_pipe;
 
-  auto r_special_probes = special_probes_.rbegin();
-  for (; r_special_probes != special_probes_.rend(); ++r_special_probes)
+  // elapsed counts from here, whether the program was just compiled or
+  // loaded from the cache or an object file
+  if (elapsed_map_)
   {
-    auto attached_probe = attach_probe(*r_special_probes, *bpforc.get());
-    if (attached_probe == nullptr)
+    // bpf_ktime_get_ns() is CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint32_t key = 0;
+    uint64_t start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (bpf_update_elem(elapsed_map_->mapfd_, &key, &start, BPF_ANY) != 0)
+    {
+      std::cerr << "Failed to set the start time for elapsed: "
+                << strerror(errno) << std::endl;
       return -1;
-    special_attached_probes_.push_back(std::move(attached_probe));
+    }
+  }
+
+  {
+    Timings::Scope timing(bt_timings, "attach BEGIN/END");
+    auto r_special_probes = special_probes_.rbegin();
+    for (; r_special_probes != special_probes_.rend(); ++r_special_probes)
+    {
+      auto attached_probe = attach_probe(*r_special_probes, *bpforc.get());
+      if (attached_probe == nullptr)
+        return -1;
+      special_attached_probes_.push_back(std::move(attached_probe));
+    }
   }
 
-  int epollfd = setup_perf_events();
-  if (epollfd < 0)
-    return epollfd;
+  int epollfd;
+  {
+    Timings::Scope timing(bt_timings, "perf buffers");
+    epollfd = setup_perf_events();
+    if (epollfd < 0)
+      return epollfd;
+  }
 
   // Spawn a child process if we've been passed a command to run
   if (cmd_.size())
@@ -718,6 +786,7 @@ int BPFtrace::run(std::unique_ptr<BpfOrc> bpforc)
   // twice: in the first pass iterate forward and attach the probes that will
   // be fired in the same order they were attached, and in the second pass
   // iterate in reverse and attach the rest.
+  auto attach_timing = std::make_unique<Timings::Scope>(bt_timings, "attach probes");
   for (auto probes = probes_.begin(); probes != probes_.end(); ++probes)
   {
     if (!attach_reverse(*probes)) {
@@ -743,6 +812,8 @@ int BPFtrace::run(std::unique_ptr<BpfOrc> bpforc)
       attached_probes_.push_back(std::move(attached_probe));
     }
   }
+  shared_progs_.clear();
+  attach_timing.reset();
 
   // Kick the child to execute the command.
   if (cmd_.size())
@@ -761,20 +832,30 @@ int BPFtrace::run(std::unique_ptr<BpfOrc> bpforc)
     std::cerr << "Running..." << std::endl;
 
   poll_perf_events(epollfd);
+  // In case the program exited before the first poll finished
+  bt_timings.report(*out_);
   attached_probes_.clear();
   // finalize_ should be false from now on otherwise perf_event_printer() can
   // ignore the END_trigger() events.
   finalize_ = false;
 
+  // Nothing is left to race the kernel for: wait for the output file rather
+  // than drop END's output and the maps printed after it
+  if (output_writer_)
+    output_writer_->set_blocking(true);
   END_trigger();
   poll_perf_events(epollfd, true);
   special_attached_probes_.clear();
+  close(epollfd);
 
   return 0;
 }
 
 int BPFtrace::setup_perf_events()
 {
+  // Readers left over from an earlier run
+  free_perf_readers();
+
   int epollfd = epoll_create1(EPOLL_CLOEXEC);
   if (epollfd == -1)
   {
@@ -782,17 +863,32 @@ int BPFtrace::setup_perf_events()
     return -1;
   }
 
+  perf_reader_raw_cb printer = &perf_event_printer;
+  if (ordered_output_)
+  {
+    event_reorder_ = std::make_unique<EventReorder>(
+        reorder_window_ms_ * 1000000, MAX_REORDER_EVENTS);
+    printer = &perf_event_reorder;
+  }
+
   std::vector<int> cpus = get_online_cpus();
   online_cpus_ = cpus.size();
   for (int cpu : cpus)
   {
     int page_cnt = 64;
-    void *reader = bpf_open_perf_buffer(&perf_event_printer, &perf_event_lost, this, -1, cpu, page_cnt);
+    void *reader;
+    if (perf_wakeup_events_ > 1 || perf_wakeup_watermark_ > 0)
+      reader = open_perf_buffer(printer, cpu, page_cnt);
+    else
+      reader = bpf_open_perf_buffer(printer, &perf_event_lost, this, -1, cpu, page_cnt);
     if (reader == nullptr)
     {
       std::cerr << "Failed to open perf buffer" << std::endl;
+      free_perf_readers();
+      close(epollfd);
       return -1;
     }
+    perf_readers_.push_back(reader);
 
     struct epoll_event ev = {};
     ev.events = EPOLLIN;
@@ -803,71 +899,314 @@ int BPFtrace::setup_perf_events()
     if (epoll_ctl(epollfd, EPOLL_CTL_ADD, reader_fd, &ev) == -1)
     {
       std::cerr << "Failed to add perf reader to epoll" << std::endl;
+      free_perf_readers();
+      close(epollfd);
       return -1;
     }
   }
   return epollfd;
 }
 
+// bpf_open_perf_buffer() wakes us for every record. This opens the buffer
+// the same way, but with the wakeup_events or watermark we were given.
+void *BPFtrace::open_perf_buffer(perf_reader_raw_cb raw_cb, int cpu, int page_cnt)
+{
+  struct perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_BPF_OUTPUT;
+  attr.sample_type = PERF_SAMPLE_RAW;
+  attr.sample_period = 1;
+  if (perf_wakeup_watermark_ > 0)
+  {
+    attr.watermark = 1;
+    attr.wakeup_watermark = perf_wakeup_watermark_;
+  }
+  else
+  {
+    attr.wakeup_events = perf_wakeup_events_;
+  }
+
+  auto reader = perf_reader_new(raw_cb, &perf_event_lost, this, page_cnt);
+  if (reader == nullptr)
+    return nullptr;
+
+  int fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0)
+  {
+    perror("perf_event_open");
+    perf_reader_free(reader);
+    return nullptr;
+  }
+  perf_reader_set_fd(reader, fd);
+
+  if (perf_reader_mmap(reader) < 0 || ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0)
+  {
+    perf_reader_free(reader);
+    return nullptr;
+  }
+  return reader;
+}
+
+// Reads every CPU's perf buffer, including those which haven't reached their
+// wakeup point yet
+void BPFtrace::read_perf_buffers()
+{
+  for (void *reader : perf_readers_)
+    perf_reader_event_read(static_cast<perf_reader*>(reader));
+}
+
+void BPFtrace::free_perf_readers()
+{
+  for (void *reader : perf_readers_)
+    perf_reader_free(reader);
+  perf_readers_.clear();
+}
+
 void BPFtrace::poll_perf_events(int epollfd, bool drain)
 {
   auto events = std::vector<struct epoll_event>(online_cpus_);
+  // --timings covers startup up to the end of the first poll
+  auto first_poll = std::make_unique<Timings::Scope>(bt_timings, "first poll");
+  uint64_t timeout_ms = poll_timeout_ms_;
+  auto last_pid_check = std::chrono::steady_clock::now();
   while (true)
   {
-    int ready = epoll_wait(epollfd, events.data(), online_cpus_, 100);
-    if (ready < 0 && errno == EINTR && !BPFtrace::exitsig_recv) {
-      // We received an interrupt not caused by SIGINT, skip and run again
-      continue;
+    uint64_t records = perf_records_;
+    if (busy_poll_)
+    {
+      if (BPFtrace::exitsig_recv && !drain)
+        break;
+      read_perf_buffers();
     }
-
-    // Return if either
-    //   * epoll_wait has encountered an error (eg signal delivery)
-    //   * There's no events left and we've been instructed to drain or
-    //     finalization has been requested through exit() builtin.
-    if (ready < 0 || (ready == 0 && (drain || finalize_)))
+    else
     {
-      return;
+      // Once draining, or after exit(), we only need whatever is left in the
+      // buffers, so don't wait for more
+      int timeout = drain || finalize_ ? 0 : timeout_ms;
+      int ready = epoll_wait(epollfd, events.data(), online_cpus_, timeout);
+      if (ready < 0 && errno == EINTR && !BPFtrace::exitsig_recv) {
+        // We received an interrupt not caused by SIGINT, skip and run again
+        continue;
+      }
+
+      // epoll_wait has encountered an error (eg signal delivery)
+      if (ready < 0)
+        break;
+
+      for (int i=0; i<ready; i++)
+      {
+        perf_reader_event_read((perf_reader*)events[i].data.ptr);
+      }
+      // Timed out: pick up records which didn't reach the wakeup point
+      if (ready == 0)
+        read_perf_buffers();
     }
+    bool idle = perf_records_ == records;
+    release_ordered_events(false);
+
+    // There's no events left and we've been instructed to drain or
+    // finalization has been requested through exit() builtin.
+    if (idle && (drain || finalize_))
+      break;
 
-    for (int i=0; i<ready; i++)
+    if (first_poll)
     {
-      perf_reader_event_read((perf_reader*)events[i].data.ptr);
+      first_poll.reset();
+      bt_timings.report(*out_);
     }
 
+    // Back off while nothing is happening, so idle tracers wake up less
+    // often. Not when that would delay output: records waiting for a batched
+    // wakeup or for the reorder window, or noticing that pid_ exited.
+    bool batched = perf_wakeup_events_ > 1 || perf_wakeup_watermark_ > 0;
+    bool holding = event_reorder_ && event_reorder_->size() > 0;
+    if (idle && !batched && !holding && pid_ == 0)
+      timeout_ms = std::min(timeout_ms * 2,
+                            std::max(poll_timeout_ms_, MAX_IDLE_POLL_TIMEOUT_MS));
+    else
+      timeout_ms = poll_timeout_ms_;
+
     // If we are tracing a specific pid and it has exited, we should exit
     // as well b/c otherwise we'd be tracing nothing.
     //
     // Note that there technically is a race with a new process using the
-    // same pid, but we're polling at 100ms and it would be unlikely that
-    // the pids wrap around that fast.
-    if (pid_ > 0 && !is_pid_alive(pid_))
+    // same pid, but we're checking every poll_timeout_ms_ and it would be
+    // unlikely that the pids wrap around that fast.
+    if (pid_ > 0)
     {
-      return;
+      auto now = std::chrono::steady_clock::now();
+      if (busy_poll_ &&
+          now - last_pid_check < std::chrono::milliseconds(poll_timeout_ms_))
+        continue;
+      last_pid_check = now;
+      if (!is_pid_alive(pid_))
+        break;
     }
   }
-  return;
+  release_ordered_events(true);
+}
+
+void BPFtrace::release_ordered_events(bool all)
+{
+  if (!event_reorder_)
+    return;
+
+  auto handler = [this](void *data, int size) {
+    perf_event_printer(this, data, size);
+  };
+  if (all)
+  {
+    event_reorder_->release_all(handler);
+    return;
+  }
+
+  // bpf_ktime_get_ns() is CLOCK_MONOTONIC
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  event_reorder_->release(now.tv_sec * 1000000000ULL + now.tv_nsec, handler);
+}
+
+size_t BPFtrace::perf_event_buffer_size(size_t size) const
+{
+  if (!ordered_output_)
+    return size;
+  return ((size + 7) & ~7UL) + sizeof(uint64_t);
 }
 
 int BPFtrace::print_maps()
 {
+  // Reading a large map out of the kernel is most of the work of printing
+  // it, so every map is read up front, several at a time. They are then
+  // printed one by one, in order.
+  std::vector<IMap *> maps;
+  for (auto &mapmap : maps_)
+  {
+    // topk() maps are a small, fixed size array
+    if (mapmap.second->type_.type != Type::topk)
+      maps.push_back(mapmap.second.get());
+  }
+
+  std::vector<MapElems> read(maps.size());
+  std::atomic<size_t> next(0);
+  auto worker = [this, &maps, &read, &next]()
+  {
+    for (size_t i = next++; i < maps.size(); i = next++)
+      read[i].err = read_map(*maps[i], read[i].elems);
+  };
+
+  size_t num_threads = std::min<size_t>(
+      { maps.size(), std::max(std::thread::hardware_concurrency(), 1U), MAX_MAP_READ_THREADS });
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+
+  for (size_t i = 0; i < maps.size(); i++)
+    read_maps_[maps[i]] = std::move(read[i]);
+
+  int err = 0;
   for(auto &mapmap : maps_)
   {
     IMap &map = *mapmap.second.get();
-    int err;
     if (map.type_.type == Type::hist || map.type_.type == Type::lhist)
       err = print_map_hist(map, 0, 0);
     else if (map.type_.type == Type::avg || map.type_.type == Type::stats)
-      err = print_map_stats(map);
+      err = print_map_stats(map, 0, 0);
+    else if (map.type_.type == Type::topk)
+      err = print_map_topk(map, 0, 0);
+    else if (map.type_.type == Type::hll)
+      err = print_map_hll(map, 0, 0);
+    else if (map.type_.type == Type::quantiles)
+      err = print_map_quantiles(map, 0, 0);
     else
       err = print_map(map, 0, 0);
 
     if (err)
-      return err;
+      break;
   }
 
+  read_maps_.clear();
+  usym_cache_.clear();
+  return err;
+}
+
+// Reads every element of a map from the kernel. Doesn't touch any state,
+// so maps can be read on several threads at once.
+int BPFtrace::read_map(IMap &map,
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &elems) const
+{
+  // hist(), lhist(), stats(), avg(), hll() and quantiles() maps add an
+  // extra 8 bytes onto the end of their key for storing the bucket number
+  size_t key_size = map.key_.size();
+  size_t value_size = map.type_.size;
+  if (map.type_.type == Type::hist || map.type_.type == Type::lhist ||
+      map.type_.type == Type::avg || map.type_.type == Type::stats ||
+      map.type_.type == Type::hll || map.type_.type == Type::quantiles)
+  {
+    key_size += 8;
+    value_size *= ncpus_;
+  }
+  else if (map.type_.type == Type::count || map.type_.type == Type::sum ||
+           map.type_.type == Type::min || map.type_.type == Type::max ||
+           map.type_.type == Type::integer)
+  {
+    value_size *= ncpus_;
+  }
+
+  std::vector<uint8_t> old_key;
+  try
+  {
+    old_key = find_empty_key(map, key_size);
+  }
+  catch (std::runtime_error &e)
+  {
+    std::cerr << "Error getting key for map '" << map.name_ << "': "
+              << e.what() << std::endl;
+    return -2;
+  }
+  auto key(old_key);
+
+  while (bpf_get_next_key(map.mapfd_, old_key.data(), key.data()) == 0)
+  {
+    auto value = std::vector<uint8_t>(value_size);
+    int err = bpf_lookup_elem(map.mapfd_, key.data(), value.data());
+    if (err == -1)
+    {
+      // key was removed by the eBPF program during bpf_get_next_key() and bpf_lookup_elem(),
+      // let's skip this key
+      continue;
+    }
+    else if (err)
+    {
+      std::cerr << "Error looking up elem: " << err << std::endl;
+      return -1;
+    }
+
+    elems.push_back({key, std::move(value)});
+
+    old_key = key;
+  }
   return 0;
 }
 
+// The elements of a map to print: those read by print_maps(), or else
+// read now
+int BPFtrace::read_map_elems(IMap &map,
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &elems)
+{
+  auto found = read_maps_.find(&map);
+  if (found == read_maps_.end())
+    return read_map(map, elems);
+
+  int err = found->second.err;
+  elems = std::move(found->second.elems);
+  read_maps_.erase(found);
+  return err;
+}
+
 // print a map given an ident string
 int BPFtrace::print_map_ident(const std::string &ident, uint32_t top, uint32_t div)
 {
@@ -879,9 +1218,16 @@ int BPFtrace::print_map_ident(const std::string &ident, uint32_t top, uint32_t d
       if (map.type_.type == Type::hist || map.type_.type == Type::lhist)
         err = print_map_hist(map, top, div);
       else if (map.type_.type == Type::avg || map.type_.type == Type::stats)
-          err = print_map_stats(map);
+        err = print_map_stats(map, top, div);
+      else if (map.type_.type == Type::topk)
+        err = print_map_topk(map, top, div);
+      else if (map.type_.type == Type::hll)
+        err = print_map_hll(map, top, div);
+      else if (map.type_.type == Type::quantiles)
+        err = print_map_quantiles(map, top, div);
       else
-        err = print_map(map, top, div);
+        err = print_map(map, top, div, delta_full_interval_ > 0);
+      usym_cache_.clear();
       return err;
     }
   }
@@ -924,11 +1270,16 @@ int BPFtrace::zero_map_ident(const std::string &ident)
 // clear a map
 int BPFtrace::clear_map(IMap &map)
 {
+  // array maps can't have their elements deleted
+  if (map.type_.type == Type::topk)
+    return zero_topk_map(map);
+
   std::vector<uint8_t> old_key;
   try
   {
     if (map.type_.type == Type::hist || map.type_.type == Type::lhist ||
-        map.type_.type == Type::stats || map.type_.type == Type::avg)
+        map.type_.type == Type::stats || map.type_.type == Type::avg ||
+        map.type_.type == Type::hll || map.type_.type == Type::quantiles)
       // hist maps have 8 extra bytes for the bucket number
       old_key = find_empty_key(map, map.key_.size() + 8);
     else
@@ -966,11 +1317,15 @@ int BPFtrace::clear_map(IMap &map)
 // zero a map
 int BPFtrace::zero_map(IMap &map)
 {
+  if (map.type_.type == Type::topk)
+    return zero_topk_map(map);
+
   std::vector<uint8_t> old_key;
   try
   {
     if (map.type_.type == Type::hist || map.type_.type == Type::lhist ||
-        map.type_.type == Type::stats || map.type_.type == Type::avg)
+        map.type_.type == Type::stats || map.type_.type == Type::avg ||
+        map.type_.type == Type::hll || map.type_.type == Type::quantiles)
       // hist maps have 8 extra bytes for the bucket number
       old_key = find_empty_key(map, map.key_.size() + 8);
     else
@@ -996,7 +1351,8 @@ int BPFtrace::zero_map(IMap &map)
   if (map.type_.type == Type::count || map.type_.type == Type::sum ||
       map.type_.type == Type::min || map.type_.type == Type::max ||
       map.type_.type == Type::avg || map.type_.type == Type::hist ||
-      map.type_.type == Type::lhist || map.type_.type == Type::stats )
+      map.type_.type == Type::lhist || map.type_.type == Type::stats ||
+      map.type_.type == Type::hll || map.type_.type == Type::quantiles)
     value_size *= ncpus_;
   std::vector<uint8_t> zero(value_size, 0);
   for (auto &key : keys)
@@ -1013,81 +1369,94 @@ int BPFtrace::zero_map(IMap &map)
   return 0;
 }
 
-std::string BPFtrace::map_value_to_str(IMap &map, std::vector<uint8_t> value, uint32_t div)
+// zero a topk map: the sketch counters and the heavy hitter table
+int BPFtrace::zero_topk_map(IMap &map)
+{
+  std::vector<uint8_t> zero(map.type_.size * ncpus_, 0);
+  for (uint32_t i = 0; i < TOPK_SKETCH_DEPTH * TOPK_SKETCH_WIDTH + 2 * TOPK_SIZE; i++)
+  {
+    int err = bpf_update_elem(map.mapfd_, &i, zero.data(), BPF_ANY);
+    if (err)
+    {
+      std::cerr << "Error updating elem: " << err << std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+std::string BPFtrace::map_value_to_str(IMap &map, const std::vector<uint8_t> &value, uint32_t div)
+{
+  std::string str;
+  map_value_append(str, map, value, div);
+  return str;
+}
+
+void BPFtrace::map_value_append(std::string &str, IMap &map, const std::vector<uint8_t> &value, uint32_t div)
 {
   if (map.type_.type == Type::kstack)
-    return get_stack(*(uint64_t*)value.data(), false, map.type_.stack_type, 8);
+    str += get_stack(*(uint64_t*)value.data(), false, map.type_.stack_type, 8);
   else if (map.type_.type == Type::ustack)
-    return get_stack(*(uint64_t*)value.data(), true, map.type_.stack_type, 8);
+    str += get_stack(*(uint64_t*)value.data(), true, map.type_.stack_type, 8);
   else if (map.type_.type == Type::ksym)
-    return resolve_ksym(*(uintptr_t*)value.data());
+    str += resolve_ksym_cached(*(uintptr_t*)value.data());
   else if (map.type_.type == Type::usym)
-    return resolve_usym(*(uintptr_t*)value.data(), *(uint64_t*)(value.data() + 8));
+    str += resolve_usym_cached(*(uintptr_t*)value.data(), *(uint64_t*)(value.data() + 8));
   else if (map.type_.type == Type::inet)
-    return resolve_inet(*(int32_t*)value.data(), (uint8_t*)(value.data() + 8));
+    str += resolve_inet(*(int32_t*)value.data(), (uint8_t*)(value.data() + 8));
   else if (map.type_.type == Type::username)
-    return resolve_uid(*(uint64_t*)(value.data()));
+    str += resolve_uid(*(uint64_t*)(value.data()));
   else if (map.type_.type == Type::string)
-    return std::string(reinterpret_cast<const char*>(value.data()));
+    str += reinterpret_cast<const char*>(value.data());
   else if (map.type_.type == Type::count)
-    return std::to_string(reduce_value<uint64_t>(value, ncpus_) / div);
+    str_append_uint(str, reduce_value<uint64_t>(value, ncpus_) / div);
   else if (map.type_.type == Type::sum || map.type_.type == Type::integer) {
     if (map.type_.is_signed)
-      return std::to_string(reduce_value<int64_t>(value, ncpus_) / div);
-
-    return std::to_string(reduce_value<uint64_t>(value, ncpus_) / div);
+      str_append_int(str, reduce_value<int64_t>(value, ncpus_) / div);
+    else
+      str_append_uint(str, reduce_value<uint64_t>(value, ncpus_) / div);
   }
   else if (map.type_.type == Type::min)
-    return std::to_string(min_value(value, ncpus_) / div);
+    str_append_int(str, min_value(value, ncpus_) / div);
   else if (map.type_.type == Type::max)
-    return std::to_string(max_value(value, ncpus_) / div);
+    str_append_uint(str, max_value(value, ncpus_) / div);
   else if (map.type_.type == Type::probe)
-    return resolve_probe(*(uint64_t*)value.data());
+    str += resolve_probe(*(uint64_t*)value.data());
+  else if (map.type_.type == Type::topk || map.type_.type == Type::hll)
+    str_append_uint(str, *(uint64_t*)value.data() / div);
   else
-    return std::to_string(*(int64_t*)value.data() / div);
+    str_append_int(str, *(int64_t*)value.data() / div);
 }
 
-int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div)
+// The value of a numeric map, as map_value_to_str() would print it. Unsigned
+// values are returned as their bit pattern.
+int64_t BPFtrace::map_value_to_int(IMap &map, const std::vector<uint8_t> &value, uint32_t div)
 {
-  std::vector<uint8_t> old_key;
-  try
-  {
-    old_key = find_empty_key(map, map.key_.size());
-  }
-  catch (std::runtime_error &e)
-  {
-    std::cerr << "Error getting key for map '" << map.name_ << "': "
-              << e.what() << std::endl;
-    return -2;
+  if (map.type_.type == Type::count)
+    return reduce_value<uint64_t>(value, ncpus_) / div;
+  else if (map.type_.type == Type::sum || map.type_.type == Type::integer) {
+    if (map.type_.is_signed)
+      return reduce_value<int64_t>(value, ncpus_) / div;
+
+    return reduce_value<uint64_t>(value, ncpus_) / div;
   }
-  auto key(old_key);
+  else if (map.type_.type == Type::min)
+    return min_value(value, ncpus_) / div;
+  else if (map.type_.type == Type::max)
+    return max_value(value, ncpus_) / div;
+  else if (map.type_.type == Type::topk || map.type_.type == Type::hll)
+    return *(const uint64_t*)value.data() / div;
+  else
+    return *(const int64_t*)value.data() / div;
+}
 
+int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div, bool delta)
+{
   std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key;
-
-  while (bpf_get_next_key(map.mapfd_, old_key.data(), key.data()) == 0)
-  {
-    int value_size = map.type_.size;
-    if (map.type_.type == Type::count || map.type_.type == Type::sum ||
-        map.type_.type == Type::min || map.type_.type == Type::max || map.type_.type == Type::integer)
-      value_size *= ncpus_;
-    auto value = std::vector<uint8_t>(value_size);
-    int err = bpf_lookup_elem(map.mapfd_, key.data(), value.data());
-    if (err == -1)
-    {
-      // key was removed by the eBPF program during bpf_get_next_key() and bpf_lookup_elem(),
-      // let's skip this key
-      continue;
-    }
-    else if (err)
-    {
-      std::cerr << "Error looking up elem: " << err << std::endl;
-      return -1;
-    }
-
-    values_by_key.push_back({key, value});
-
-    old_key = key;
-  }
+  int err = read_map_elems(map, values_by_key);
+  if (err)
+    return err;
 
   if (map.type_.type == Type::count || map.type_.type == Type::sum || map.type_.type == Type::integer)
   {
@@ -1120,10 +1489,88 @@ int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div)
 
   if (div == 0)
     div = 1;
-  out_->map(*this, map, top, div, values_by_key);
+  // Only the highest values are printed with top, so a delta against them
+  // would not keep the consumer's copy of the map in sync
+  if (delta && top == 0)
+    print_map_delta(map, div, values_by_key);
+  else
+    out_->map(*this, map, top, div, values_by_key);
   return 0;
 }
 
+void BPFtrace::print_map_delta(IMap &map, uint32_t div,
+    const std::vector<std::pair<std::vector<uint8_t>,
+    std::vector<uint8_t>>> &values_by_key)
+{
+  MapSnapshot &snapshot = map_snapshots_[map.name_];
+  std::map<std::vector<uint8_t>, std::vector<uint8_t>> values(
+      values_by_key.begin(), values_by_key.end());
+
+  if (snapshot.prints++ % delta_full_interval_ == 0)
+  {
+    out_->map(*this, map, 0, div, values_by_key);
+  }
+  else
+  {
+    std::vector<MapValueChange> changed;
+    std::vector<std::vector<uint8_t>> removed;
+
+    for (auto &pair : values_by_key)
+    {
+      auto old = snapshot.values.find(pair.first);
+      const std::vector<uint8_t> *old_value = nullptr;
+      if (old != snapshot.values.end())
+        old_value = &old->second;
+
+      int64_t diff = 0;
+      if (map_value_delta(map, old_value, pair.second, div, diff))
+        changed.push_back({pair.first, pair.second, diff});
+    }
+    for (auto &pair : snapshot.values)
+    {
+      if (values.find(pair.first) == values.end())
+        removed.push_back(pair.first);
+    }
+
+    if (!changed.empty() || !removed.empty())
+      out_->map_delta(*this, map, div, changed, removed);
+  }
+
+  snapshot.values = std::move(values);
+}
+
+// Checks whether the printed value of a map entry changed since it was last
+// printed, and for count() and sum() maps sets diff to the difference.
+bool BPFtrace::map_value_delta(IMap &map,
+                               const std::vector<uint8_t> *old_value,
+                               const std::vector<uint8_t> &value,
+                               uint32_t div,
+                               int64_t &diff)
+{
+  if (old_value && *old_value == value)
+    return false;
+
+  if (map.type_.type == Type::count || map.type_.type == Type::sum)
+  {
+    if (map.type_.type == Type::sum && map.type_.is_signed)
+    {
+      diff = reduce_value<int64_t>(value, ncpus_) / div;
+      if (old_value)
+        diff -= reduce_value<int64_t>(*old_value, ncpus_) / div;
+    }
+    else
+    {
+      diff = reduce_value<uint64_t>(value, ncpus_) / div;
+      if (old_value)
+        diff -= reduce_value<uint64_t>(*old_value, ncpus_) / div;
+    }
+    return !old_value || diff != 0;
+  }
+
+  return !old_value ||
+         map_value_to_str(map, value, div) != map_value_to_str(map, *old_value, div);
+}
+
 int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
 {
   // A hist-map adds an extra 8 bytes onto the end of its key for storing
@@ -1131,44 +1578,24 @@ int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
   // e.g. A map defined as: @x[1, 2] = @hist(3);
   // would actually be stored with the key: [1, 2, 3]
 
-  std::vector<uint8_t> old_key;
-  try
-  {
-    old_key = find_empty_key(map, map.key_.size() + 8);
-  }
-  catch (std::runtime_error &e)
-  {
-    std::cerr << "Error getting key for map '" << map.name_ << "': "
-              << e.what() << std::endl;
-    return -2;
-  }
-  auto key(old_key);
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> elems;
+  int err = read_map_elems(map, elems);
+  if (err)
+    return err;
 
   std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key;
 
-  while (bpf_get_next_key(map.mapfd_, old_key.data(), key.data()) == 0)
+  for (auto &elem : elems)
   {
+    auto &key = elem.first;
+    auto &value = elem.second;
+
     auto key_prefix = std::vector<uint8_t>(map.key_.size());
     int bucket = key.at(map.key_.size());
 
     for (size_t i=0; i<map.key_.size(); i++)
       key_prefix.at(i) = key.at(i);
 
-    int value_size = map.type_.size * ncpus_;
-    auto value = std::vector<uint8_t>(value_size);
-    int err = bpf_lookup_elem(map.mapfd_, key.data(), value.data());
-    if (err == -1)
-    {
-      // key was removed by the eBPF program during bpf_get_next_key() and bpf_lookup_elem(),
-      // let's skip this key
-      continue;
-    }
-    else if (err)
-    {
-      std::cerr << "Error looking up elem: " << err << std::endl;
-      return -1;
-    }
-
     if (values_by_key.find(key_prefix) == values_by_key.end())
     {
       // New key - create a list of buckets for it
@@ -1178,8 +1605,6 @@ int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
         values_by_key[key_prefix] = std::vector<uint64_t>(1002);
     }
     values_by_key[key_prefix].at(bucket) = reduce_value<uint64_t>(value, ncpus_);
-
-    old_key = key;
   }
 
   // Sort based on sum of counts in all buckets
@@ -1204,57 +1629,35 @@ int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
   return 0;
 }
 
-int BPFtrace::print_map_stats(IMap &map)
+int BPFtrace::print_map_stats(IMap &map, uint32_t top, uint32_t div)
 {
   // stats() and avg() maps add an extra 8 bytes onto the end of their key for
   // storing the bucket number.
 
-  std::vector<uint8_t> old_key;
-  try
-  {
-    old_key = find_empty_key(map, map.key_.size() + 8);
-  }
-  catch (std::runtime_error &e)
-  {
-    std::cerr << "Error getting key for map '" << map.name_ << "': "
-              << e.what() << std::endl;
-    return -2;
-  }
-  auto key(old_key);
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> elems;
+  int err = read_map_elems(map, elems);
+  if (err)
+    return err;
 
   std::map<std::vector<uint8_t>, std::vector<int64_t>> values_by_key;
 
-  while (bpf_get_next_key(map.mapfd_, old_key.data(), key.data()) == 0)
+  for (auto &elem : elems)
   {
+    auto &key = elem.first;
+    auto &value = elem.second;
+
     auto key_prefix = std::vector<uint8_t>(map.key_.size());
     int bucket = key.at(map.key_.size());
 
     for (size_t i=0; i<map.key_.size(); i++)
       key_prefix.at(i) = key.at(i);
 
-    int value_size = map.type_.size * ncpus_;
-    auto value = std::vector<uint8_t>(value_size);
-    int err = bpf_lookup_elem(map.mapfd_, key.data(), value.data());
-    if (err == -1)
-    {
-      // key was removed by the eBPF program during bpf_get_next_key() and bpf_lookup_elem(),
-      // let's skip this key
-      continue;
-    }
-    else if (err)
-    {
-      std::cerr << "Error looking up elem: " << err << std::endl;
-      return -1;
-    }
-
     if (values_by_key.find(key_prefix) == values_by_key.end())
     {
       // New key - create a list of buckets for it
       values_by_key[key_prefix] = std::vector<int64_t>(2);
     }
     values_by_key[key_prefix].at(bucket) = reduce_value<int64_t>(value, ncpus_);
-
-    old_key = key;
   }
 
   // Sort based on sum of counts in all buckets
@@ -1276,7 +1679,238 @@ int BPFtrace::print_map_stats(IMap &map)
     return a.second < b.second;
   });
 
-  out_->map_stats(*this, map, values_by_key, total_counts_by_key);
+  if (div == 0)
+    div = 1;
+  out_->map_stats(*this, map, top, div, values_by_key, total_counts_by_key);
+  return 0;
+}
+
+// Must match CodegenLLVM::createHashFunction()
+static uint64_t topk_hash(uint64_t n)
+{
+  n *= 0x9e3779b97f4a7c15ULL;
+  n ^= n >> 32;
+  n *= 0xd6e8feb86659fd93ULL;
+  n ^= n >> 32;
+  return n;
+}
+
+int BPFtrace::print_map_topk(IMap &map, uint32_t top, uint32_t div)
+{
+  // A topk-map is a per-cpu array holding a count-min sketch followed by a
+  // table of (value, count) pairs. Sum the sketch over all CPUs, then
+  // re-estimate every value found in any CPU's table against it.
+  const uint32_t sketch_cells = TOPK_SKETCH_DEPTH * TOPK_SKETCH_WIDTH;
+  const uint32_t cells = sketch_cells + 2 * TOPK_SIZE;
+
+  std::vector<uint64_t> sketch(sketch_cells);
+  std::set<uint64_t> candidates;
+  auto value = std::vector<uint8_t>(map.type_.size * ncpus_);
+  std::vector<uint64_t> slot_values(ncpus_);
+  for (uint32_t i = 0; i < cells; i++)
+  {
+    int err = bpf_lookup_elem(map.mapfd_, &i, value.data());
+    if (err)
+    {
+      std::cerr << "Error looking up elem: " << err << std::endl;
+      return -1;
+    }
+
+    if (i < sketch_cells)
+      sketch[i] = reduce_value<uint64_t>(value, ncpus_);
+    else if ((i - sketch_cells) % 2 == 0)
+    {
+      for (int cpu = 0; cpu < ncpus_; cpu++)
+        slot_values[cpu] = *(const uint64_t*)(value.data() + cpu * sizeof(uint64_t));
+    }
+    else
+    {
+      for (int cpu = 0; cpu < ncpus_; cpu++)
+      {
+        if (*(const uint64_t*)(value.data() + cpu * sizeof(uint64_t)) != 0)
+          candidates.insert(slot_values[cpu]);
+      }
+    }
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> estimates;
+  for (uint64_t candidate : candidates)
+  {
+    uint64_t hash = topk_hash(candidate);
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < TOPK_SKETCH_DEPTH; row++)
+    {
+      uint64_t column = (hash >> (16 * row)) & (TOPK_SKETCH_WIDTH - 1);
+      estimate = std::min(estimate, sketch[row * TOPK_SKETCH_WIDTH + column]);
+    }
+    estimates.push_back({candidate, estimate});
+  }
+  std::sort(estimates.begin(), estimates.end(), [&](auto &a, auto &b)
+  {
+    return a.second < b.second;
+  });
+  if (estimates.size() > TOPK_SIZE)
+    estimates.erase(estimates.begin(), estimates.end() - TOPK_SIZE);
+
+  // Print as a map of value -> count
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key;
+  for (auto &estimate : estimates)
+  {
+    auto key = std::vector<uint8_t>(sizeof(uint64_t));
+    auto count = std::vector<uint8_t>(sizeof(uint64_t));
+    *(uint64_t*)key.data() = estimate.first;
+    *(uint64_t*)count.data() = estimate.second;
+    values_by_key.push_back({key, count});
+  }
+
+  if (div == 0)
+    div = 1;
+  out_->map(*this, map, top, div, values_by_key);
+  return 0;
+}
+
+int BPFtrace::print_map_hll(IMap &map, uint32_t top, uint32_t div)
+{
+  // hll() maps add an extra 8 bytes onto the end of their key for storing
+  // the register index. Registers are merged across CPUs by taking the max.
+  const int num_registers = 1 << HLL_PRECISION;
+
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> elems;
+  int err = read_map_elems(map, elems);
+  if (err)
+    return err;
+
+  std::map<std::vector<uint8_t>, std::vector<uint8_t>> registers_by_key;
+
+  for (auto &elem : elems)
+  {
+    auto &key = elem.first;
+    auto &value = elem.second;
+
+    auto key_prefix = std::vector<uint8_t>(map.key_.size());
+    uint64_t index = *(const uint64_t*)(key.data() + map.key_.size());
+
+    for (size_t i=0; i<map.key_.size(); i++)
+      key_prefix.at(i) = key.at(i);
+
+    if (registers_by_key.find(key_prefix) == registers_by_key.end())
+    {
+      // New key - create a list of registers for it
+      registers_by_key[key_prefix] = std::vector<uint8_t>(num_registers);
+    }
+    if (index < static_cast<uint64_t>(num_registers))
+      registers_by_key[key_prefix].at(index) = max_value(value, ncpus_);
+  }
+
+  // HyperLogLog estimate, with linear counting for small cardinalities
+  double alpha = 0.7213 / (1.0 + 1.079 / num_registers);
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key;
+  for (auto &map_elem : registers_by_key)
+  {
+    double sum = 0;
+    int zeros = 0;
+    for (uint8_t reg : map_elem.second)
+    {
+      sum += std::ldexp(1.0, -reg);
+      if (reg == 0)
+        zeros++;
+    }
+
+    double estimate = alpha * num_registers * num_registers / sum;
+    if (estimate <= 2.5 * num_registers && zeros > 0)
+      estimate = num_registers * std::log(static_cast<double>(num_registers) / zeros);
+
+    auto value = std::vector<uint8_t>(sizeof(uint64_t));
+    *(uint64_t*)value.data() = static_cast<uint64_t>(std::llround(estimate));
+    values_by_key.push_back({map_elem.first, value});
+  }
+  std::sort(values_by_key.begin(), values_by_key.end(), [&](auto &a, auto &b)
+  {
+    return *(const uint64_t*)a.second.data() < *(const uint64_t*)b.second.data();
+  });
+
+  if (div == 0)
+    div = 1;
+  out_->map(*this, map, top, div, values_by_key);
+  return 0;
+}
+
+// Midpoint of a quantiles() bucket. Must match CodegenLLVM::createLogLinearFunction()
+static uint64_t quantiles_bucket_value(uint64_t bucket)
+{
+  const uint64_t sub_buckets = 1 << QUANTILES_SUB_BUCKET_BITS;
+  if (bucket < 2 * sub_buckets)
+    return bucket;
+
+  uint64_t shift = (bucket >> QUANTILES_SUB_BUCKET_BITS) - 1;
+  uint64_t low = (sub_buckets + (bucket & (sub_buckets - 1))) << shift;
+  uint64_t high = low + (1ULL << shift) - 1;
+  return low + (high - low) / 2;
+}
+
+int BPFtrace::print_map_quantiles(IMap &map, uint32_t top, uint32_t div)
+{
+  // quantiles() maps add an extra 8 bytes onto the end of their key for
+  // storing the bucket number, the same as hist() maps.
+
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> elems;
+  int err = read_map_elems(map, elems);
+  if (err)
+    return err;
+
+  std::map<std::vector<uint8_t>, std::map<uint64_t, uint64_t>> buckets_by_key;
+
+  for (auto &elem : elems)
+  {
+    auto &key = elem.first;
+    auto &value = elem.second;
+
+    auto key_prefix = std::vector<uint8_t>(map.key_.size());
+    uint64_t bucket = *(const uint64_t*)(key.data() + map.key_.size());
+
+    for (size_t i=0; i<map.key_.size(); i++)
+      key_prefix.at(i) = key.at(i);
+
+    buckets_by_key[key_prefix][bucket] = reduce_value<uint64_t>(value, ncpus_);
+  }
+
+  // Walk the buckets in order to find the count and each quantile
+  std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key;
+  std::vector<std::pair<std::vector<uint8_t>, uint64_t>> total_counts_by_key;
+  for (auto &map_elem : buckets_by_key)
+  {
+    uint64_t count = 0;
+    for (auto &bucket : map_elem.second)
+      count += bucket.second;
+
+    std::vector<uint64_t> values = { count };
+    auto bucket = map_elem.second.begin();
+    uint64_t seen = 0;
+    for (auto &quantile : QUANTILES)
+    {
+      uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile.second * count));
+      while (bucket != map_elem.second.end() && seen + bucket->second < rank)
+      {
+        seen += bucket->second;
+        bucket++;
+      }
+      if (bucket == map_elem.second.end())
+        values.push_back(0);
+      else
+        values.push_back(quantiles_bucket_value(bucket->first));
+    }
+
+    values_by_key[map_elem.first] = values;
+    total_counts_by_key.push_back({map_elem.first, count});
+  }
+  std::sort(total_counts_by_key.begin(), total_counts_by_key.end(), [&](auto &a, auto &b)
+  {
+    return a.second < b.second;
+  });
+
+  if (div == 0)
+    div = 1;
+  out_->map_quantiles(*this, map, top, div, values_by_key, total_counts_by_key);
   return 0;
 }
 
@@ -1416,7 +2050,8 @@ std::vector<uint8_t> BPFtrace::find_empty_key(IMap &map, size_t size) const
   if (map.type_.type == Type::count || map.type_.type == Type::hist ||
       map.type_.type == Type::sum || map.type_.type == Type::min ||
       map.type_.type == Type::max || map.type_.type == Type::avg ||
-      map.type_.type == Type::stats || map.type_.type == Type::lhist)
+      map.type_.type == Type::stats || map.type_.type == Type::lhist ||
+      map.type_.type == Type::hll || map.type_.type == Type::quantiles)
     value_size *= ncpus_;
   auto value = std::vector<uint8_t>(value_size);
 
@@ -1532,6 +2167,14 @@ std::string BPFtrace::resolve_ksym(uintptr_t addr, bool show_offset)
   return symbol.str();
 }
 
+const std::string &BPFtrace::resolve_ksym_cached(uintptr_t addr)
+{
+  auto found = ksym_cache_.find(addr);
+  if (found != ksym_cache_.end())
+    return found->second;
+  return ksym_cache_.emplace(addr, resolve_ksym(addr)).first->second;
+}
+
 uint64_t BPFtrace::resolve_kname(const std::string &name) const
 {
   uint64_t addr = 0;
@@ -1722,6 +2365,26 @@ std::string BPFtrace::resolve_usym(uintptr_t addr, int pid, bool show_offset, bo
   return symbol.str();
 }
 
+const std::string &BPFtrace::resolve_usym_cached(uintptr_t addr, int pid)
+{
+  auto key = std::make_pair(pid, addr);
+  auto found = usym_cache_.find(key);
+  if (found != usym_cache_.end())
+    return found->second;
+  return usym_cache_.emplace(key, resolve_usym(addr, pid)).first->second;
+}
+
+int BPFtrace::get_probe_id(const std::string &probe_name)
+{
+  auto found = std::find(probe_ids_.begin(), probe_ids_.end(), probe_name);
+  if (found == probe_ids_.end())
+  {
+    probe_ids_.push_back(probe_name);
+    return next_probe_id();
+  }
+  return std::distance(probe_ids_.begin(), found);
+}
+
 std::string BPFtrace::resolve_probe(uint64_t probe_id) const
 {
   assert(probe_id < probe_ids_.size());
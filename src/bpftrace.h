@@ -10,6 +10,7 @@
 
 #include "ast.h"
 #include "attached_probe.h"
+#include "event_reorder.h"
 #include "imap.h"
 #include "printf.h"
 #include "struct.h"
@@ -19,6 +20,7 @@
 
 namespace bpftrace {
 
+class AsyncWriter;
 class BpfOrc;
 enum class DebugLevel;
 
@@ -80,6 +82,7 @@ public:
   inline int next_probe_id() {
     return next_probe_id_++;
   };
+  int get_probe_id(const std::string &probe_name);
   inline void source(std::string filename, std::string source) {
     src_ = source;
     filename_ = filename;
@@ -88,11 +91,20 @@ public:
   std::string get_stack(uint64_t stackidpid, bool ustack, StackType stack_type, int indent=0);
   std::string resolve_ksym(uintptr_t addr, bool show_offset=false);
   std::string resolve_usym(uintptr_t addr, int pid, bool show_offset=false, bool show_module=false);
+  // resolve_ksym(addr) and resolve_usym(addr, pid), remembering the result.
+  // Printing a map looks up the same few symbols over and over. User
+  // symbols are only remembered until the map is printed, as pids get
+  // reused and processes exec other binaries.
+  const std::string &resolve_ksym_cached(uintptr_t addr);
+  const std::string &resolve_usym_cached(uintptr_t addr, int pid);
   std::string resolve_inet(int af, const uint8_t* inet) const;
   std::string resolve_uid(uintptr_t addr) const;
   uint64_t resolve_kname(const std::string &name) const;
   uint64_t resolve_uname(const std::string &name, const std::string &path) const;
-  std::string map_value_to_str(IMap &map, std::vector<uint8_t> value, uint32_t div);
+  std::string map_value_to_str(IMap &map, const std::vector<uint8_t> &value, uint32_t div);
+  // map_value_to_str(), appended to str
+  void map_value_append(std::string &str, IMap &map, const std::vector<uint8_t> &value, uint32_t div);
+  int64_t map_value_to_int(IMap &map, const std::vector<uint8_t> &value, uint32_t div);
   virtual std::string extract_func_symbols_from_path(const std::string &path) const;
   std::string resolve_probe(uint64_t probe_id) const;
   uint64_t resolve_cgroupid(const std::string &path) const;
@@ -109,6 +121,8 @@ public:
   std::string cmd_;
   int pid_{0};
   bool finalize_ = false;
+  // Records read from the perf buffers, to tell when polling is idle
+  uint64_t perf_records_ = 0;
   // Global variable checking if an exit signal was received
   static volatile sig_atomic_t exitsig_recv;
 
@@ -123,11 +137,18 @@ public:
   std::vector<std::tuple<std::string, std::vector<Field>>> cat_args_;
   std::unordered_map<StackType, std::unique_ptr<IMap>> stackid_maps_;
   std::unique_ptr<IMap> join_map_;
+  std::unique_ptr<IMap> ratelimit_map_;
+  std::unique_ptr<IMap> scratch_map_;
+  std::unique_ptr<IMap> elapsed_map_;
   std::unique_ptr<IMap> perf_event_map_;
   std::vector<std::string> probe_ids_;
   unsigned int join_argnum_;
   unsigned int join_argsize_;
   std::unique_ptr<Output> out_;
+  // The background writer of out_, if -o uses one
+  AsyncWriter *output_writer_ = nullptr;
+  // Only set with ordered_output_
+  std::unique_ptr<EventReorder> event_reorder_;
 
   uint64_t strlen_ = 64;
   uint64_t mapmax_ = 4096;
@@ -138,6 +159,35 @@ public:
   bool resolve_user_symbols_ = true;
   bool safe_mode_ = true;
   bool force_btf_ = false;
+  // Kernel supports BPF cookies, so wildcard matches can share a program
+  bool attach_cookie_ = false;
+  // Modules with more LLVM instructions than this are optimized at O1
+  // instead of O3, see CodegenLLVM::compile()
+  size_t opt_full_max_insns_ = 50000;
+  // BPFTRACE_CACHE_DIR, empty when caching is disabled
+  std::string cache_dir_;
+  // Header files clang read while parsing the C definitions
+  std::vector<std::string> c_headers_;
+  // --delta: print() only outputs the keys which changed since the map was
+  // last printed, and the whole map every delta_full_interval_ prints
+  uint64_t delta_full_interval_ = 0;
+  // --ordered: every perf event record ends with the time it was output,
+  // and records are printed in that order across CPUs, held for up to
+  // reorder_window_ms_ to wait for slower CPUs
+  bool ordered_output_ = false;
+  uint64_t reorder_window_ms_ = 100;
+  // The kernel wakes us once perf_wakeup_events_ records, or with a
+  // watermark that many bytes, are waiting in a CPU's perf buffer
+  uint64_t perf_wakeup_events_ = 1;
+  uint64_t perf_wakeup_watermark_ = 0;
+  // How long to wait for perf events before reading the buffers anyway
+  uint64_t poll_timeout_ms_ = 100;
+  // Spin reading the perf buffers instead of waiting in epoll_wait()
+  bool busy_poll_ = false;
+
+  // The buffer needed for a perf event record of size bytes. With
+  // ordered_output_ the record is padded to 8 bytes, for its timestamp.
+  size_t perf_event_buffer_size(size_t size) const;
 
   static void sort_by_key(
       std::vector<SizedType> key_args,
@@ -156,16 +206,22 @@ public:
   const std::string get_source_line(unsigned int);
 
 protected:
+  friend class ProgramCache;
   std::vector<Probe> probes_;
   std::vector<Probe> special_probes_;
 
 private:
   std::vector<std::unique_ptr<AttachedProbe>> attached_probes_;
   std::vector<std::unique_ptr<AttachedProbe>> special_attached_probes_;
+  // Loaded programs which are shared between probes, by section name
+  std::map<std::string, const AttachedProbe *> shared_progs_;
   void* ksyms_{nullptr};
   std::map<std::string, std::pair<int, void *>> exe_sym_; // exe -> (pid, cache)
+  std::unordered_map<uintptr_t, std::string> ksym_cache_;
+  std::map<std::pair<int, uintptr_t>, std::string> usym_cache_; // (pid, addr)
   int ncpus_;
   int online_cpus_;
+  std::vector<void *> perf_readers_;
   std::vector<int> child_pids_;
   std::vector<std::string> params_;
   int next_probe_id_ = 0;
@@ -174,15 +230,51 @@ private:
   std::string filename_;
   std::vector<std::string> srclines_;
 
+  // The values of a map when it was last printed, for --delta
+  struct MapSnapshot
+  {
+    std::map<std::vector<uint8_t>, std::vector<uint8_t>> values;
+    uint64_t prints = 0;
+  };
+  std::map<std::string, MapSnapshot> map_snapshots_;
+
+  // Maps read by print_maps(), before printing them
+  struct MapElems
+  {
+    int err = 0;
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> elems;
+  };
+  std::map<const IMap *, MapElems> read_maps_;
+
   std::unique_ptr<AttachedProbe> attach_probe(Probe &probe, const BpfOrc &bpforc);
   int setup_perf_events();
+  void *open_perf_buffer(perf_reader_raw_cb raw_cb, int cpu, int page_cnt);
+  void read_perf_buffers();
+  void free_perf_readers();
   void poll_perf_events(int epollfd, bool drain=false);
+  void release_ordered_events(bool all);
   int clear_map(IMap &map);
   int zero_map(IMap &map);
-  int print_map(IMap &map, uint32_t top, uint32_t div);
+  int zero_topk_map(IMap &map);
+  int read_map(IMap &map,
+      std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &elems) const;
+  int read_map_elems(IMap &map,
+      std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &elems);
+  int print_map(IMap &map, uint32_t top, uint32_t div, bool delta=false);
+  void print_map_delta(IMap &map, uint32_t div,
+      const std::vector<std::pair<std::vector<uint8_t>,
+      std::vector<uint8_t>>> &values_by_key);
+  bool map_value_delta(IMap &map,
+                       const std::vector<uint8_t> *old_value,
+                       const std::vector<uint8_t> &value,
+                       uint32_t div,
+                       int64_t &diff);
   int print_map_hist(IMap &map, uint32_t top, uint32_t div);
   int print_map_lhist(IMap &map);
-  int print_map_stats(IMap &map);
+  int print_map_stats(IMap &map, uint32_t top, uint32_t div);
+  int print_map_topk(IMap &map, uint32_t top, uint32_t div);
+  int print_map_hll(IMap &map, uint32_t top, uint32_t div);
+  int print_map_quantiles(IMap &map, uint32_t top, uint32_t div);
   int print_hist(const std::vector<uint64_t> &values, uint32_t div) const;
   int print_lhist(const std::vector<uint64_t> &values, int min, int max, int step) const;
   template <typename T> static T reduce_value(const std::vector<uint8_t> &value, int ncpus);
@@ -6,6 +6,8 @@
 #include <sys/utsname.h>
 #include <string.h>
 #include <linux/limits.h>
+#include <unordered_map>
+#include <vector>
 #include "btf.h"
 #include "types.h"
 #include "bpftrace.h"
@@ -183,104 +185,298 @@ BTF::~BTF()
   btf__free(btf);
 }
 
-static void dump_printf(void *ctx, const char *fmt, va_list args)
+static const char *btf_str(const struct btf *btf, __u32 off)
 {
-  std::string *ret = static_cast<std::string*>(ctx);
-  char *str;
+  if (!off)
+    return "(anon)";
 
-  if (vasprintf(&str, fmt, args) < 0)
-    return;
+  return btf__name_by_offset(btf, off) ? : "(invalid)";
+}
 
-  *ret += str;
-  free(str);
+static bool is_modifier(__u32 kind)
+{
+  return kind == BTF_KIND_TYPEDEF || kind == BTF_KIND_CONST ||
+         kind == BTF_KIND_VOLATILE || kind == BTF_KIND_RESTRICT;
 }
 
-static const char *btf_str(const struct btf *btf, __u32 off)
+static bool is_record(__u32 kind)
 {
-  if (!off)
-    return "(anon)";
+  return kind == BTF_KIND_STRUCT || kind == BTF_KIND_UNION;
+}
 
-  return btf__name_by_offset(btf, off) ? : "(invalid)";
+// Collects the ids of the types which need importing: the requested types,
+// everything they embed, and the targets of any pointer members the program
+// actually accesses
+class TypeClosure
+{
+public:
+  TypeClosure(const struct btf *btf, const std::unordered_set<std::string> &fields)
+    : btf_(btf), fields_(fields) { }
+
+  void add(__s32 id)
+  {
+    if (ids_.insert(id).second)
+      queue_.push_back(id);
+  }
+
+  const std::vector<__s32> &resolve()
+  {
+    for (size_t i = 0; i < queue_.size(); i++)
+    {
+      const struct btf_type *t = btf__type_by_id(btf_, queue_[i]);
+      __u32 kind = BTF_INFO_KIND(t->info);
+
+      if (kind == BTF_KIND_TYPEDEF)
+        follow(queue_[i], true);
+      else if (is_record(kind))
+        add_members(t);
+    }
+    return queue_;
+  }
+
+  // Names for anonymous structs and unions which were reached through a
+  // typedef, e.g. "typedef struct { ... } foo_t;"
+  const std::unordered_map<__u32, std::string> &aliases() const
+  {
+    return aliases_;
+  }
+
+private:
+  const struct btf *btf_;
+  const std::unordered_set<std::string> &fields_;
+  std::unordered_set<__s32> ids_;
+  std::vector<__s32> queue_;
+  std::unordered_map<__u32, std::string> aliases_;
+
+  void add_members(const struct btf_type *t)
+  {
+    auto m = reinterpret_cast<const struct btf_member *>(t + 1);
+    for (__u16 i = 0; i < BTF_INFO_VLEN(t->info); i++, m++)
+    {
+      // Members of anonymous structs and unions are accessed by their own
+      // names, so look inside them straight away
+      const struct btf_type *mt = btf__type_by_id(btf_, m->type);
+      if (!m->name_off && is_record(BTF_INFO_KIND(mt->info)))
+        add_members(mt);
+      else
+        follow(m->type, fields_.count(btf__name_by_offset(btf_, m->name_off)));
+    }
+  }
+
+  // Pointers are only followed when deref is set, so that reading e.g.
+  // task_struct doesn't pull in most of the kernel's types
+  void follow(__u32 id, bool deref)
+  {
+    const char *alias = nullptr;
+    while (id)
+    {
+      const struct btf_type *t = btf__type_by_id(btf_, id);
+      __u32 kind = BTF_INFO_KIND(t->info);
+
+      if (is_record(kind))
+      {
+        if (!t->name_off && alias)
+          aliases_.emplace(id, alias);
+        add(id);
+        return;
+      }
+      else if (kind == BTF_KIND_ARRAY)
+        id = reinterpret_cast<const struct btf_array *>(t + 1)->type;
+      else if (is_modifier(kind) || (kind == BTF_KIND_PTR && deref))
+      {
+        if (kind == BTF_KIND_TYPEDEF)
+          alias = btf__name_by_offset(btf_, t->name_off);
+        id = t->type;
+      }
+      else
+        return;
+    }
+  }
+};
+
+__u32 BTF::resolve_modifiers(__u32 id)
+{
+  while (id)
+  {
+    const struct btf_type *t = btf__type_by_id(btf, id);
+    if (!is_modifier(BTF_INFO_KIND(t->info)))
+      break;
+    id = t->type;
+  }
+  return id;
+}
+
+std::string BTF::type_name(__u32 id)
+{
+  const struct btf_type *t = btf__type_by_id(btf, id);
+  if (t->name_off)
+    return btf_str(btf, t->name_off);
+
+  auto alias = aliases_.find(id);
+  if (alias != aliases_.end())
+    return alias->second;
+  return "(anonymous " + std::to_string(id) + ")";
+}
+
+// Mirrors get_sized_type() in clang_parser.cpp. Type id 0 is void.
+SizedType BTF::get_sized_type(__u32 id)
+{
+  auto cached = sized_types_.find(id);
+  if (cached != sized_types_.end())
+    return cached->second;
+
+  SizedType stype(Type::none, 0);
+  __u32 type_id = resolve_modifiers(id);
+  const struct btf_type *t = btf__type_by_id(btf, type_id);
+
+  switch (BTF_INFO_KIND(t->info))
+  {
+    case BTF_KIND_INT:
+    {
+      __u32 encoding = BTF_INT_ENCODING(*reinterpret_cast<const __u32 *>(t + 1));
+      stype = SizedType(Type::integer, t->size, encoding & BTF_INT_SIGNED);
+      break;
+    }
+    case BTF_KIND_ENUM:
+      stype = SizedType(Type::integer, t->size);
+      break;
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+      stype = SizedType(Type::cast, t->size, type_name(type_id));
+      break;
+    case BTF_KIND_PTR:
+    {
+      __u32 pointee_id = resolve_modifiers(t->type);
+      const struct btf_type *pointee = btf__type_by_id(btf, pointee_id);
+      if (is_record(BTF_INFO_KIND(pointee->info)))
+        stype = SizedType(Type::cast, sizeof(uintptr_t), type_name(pointee_id));
+      else
+        stype = SizedType(Type::integer, sizeof(uintptr_t));
+      __s64 pointee_size = btf__resolve_size(btf, pointee_id);
+      stype.is_pointer = true;
+      stype.pointee_size = pointee_size > 0 ? pointee_size : 0;
+      break;
+    }
+    case BTF_KIND_ARRAY:
+    {
+      auto array = reinterpret_cast<const struct btf_array *>(t + 1);
+      __u32 elem_id = resolve_modifiers(array->type);
+      const struct btf_type *elem = btf__type_by_id(btf, elem_id);
+      __u32 elem_kind = BTF_INFO_KIND(elem->info);
+
+      if (elem_kind == BTF_KIND_INT && elem->size == 1 &&
+          std::string(btf_str(btf, elem->name_off)) == "char")
+      {
+        stype = SizedType(Type::string, array->nelems);
+      }
+      // Only support one-dimensional arrays for now
+      else if (elem_kind != BTF_KIND_ARRAY)
+      {
+        auto elem_type = get_sized_type(elem_id);
+        stype = SizedType(Type::array, array->nelems);
+        stype.pointee_size = elem_type.size;
+        stype.elem_type = elem_type.type;
+      }
+      break;
+    }
+  }
+
+  sized_types_.emplace(id, stype);
+  return stype;
 }
 
-std::string BTF::c_def(std::unordered_set<std::string>& set)
+void BTF::add_fields(const struct btf_type *t, __u32 bit_offset, Struct &record)
 {
-  std::string ret = std::string("");
-  struct btf_dump_opts opts = { .ctx = &ret, };
-  struct btf_dump *dump;
-  char err_buf[256];
-  int err;
-
-  dump = btf_dump__new(btf, nullptr, &opts, dump_printf);
-  err = libbpf_get_error(dump);
-  if (err)
+  bool kflag = BTF_INFO_KFLAG(t->info);
+  auto m = reinterpret_cast<const struct btf_member *>(t + 1);
+  for (__u16 i = 0; i < BTF_INFO_VLEN(t->info); i++, m++)
   {
-      libbpf_strerror(err, err_buf, sizeof(err_buf));
-      std::cerr << "BTF: failed to initialize dump (" << err_buf << ")" << std::endl;
-      return std::string("");
+    __u32 member_offset = bit_offset +
+                          (kflag ? BTF_MEMBER_BIT_OFFSET(m->offset) : m->offset);
+    __u32 bitfield_size = kflag ? BTF_MEMBER_BITFIELD_SIZE(m->offset) : 0;
+
+    const struct btf_type *mt = btf__type_by_id(btf, m->type);
+    if (!m->name_off && is_record(BTF_INFO_KIND(mt->info)))
+    {
+      // Fields of anonymous structs and unions belong to the parent
+      add_fields(mt, member_offset, record);
+      continue;
+    }
+    // Unnamed padding bitfields
+    if (!m->name_off)
+      continue;
+
+    // Without kflag, bitfields are described by the int type itself
+    __u32 type_id = resolve_modifiers(m->type);
+    const struct btf_type *rt = btf__type_by_id(btf, type_id);
+    if (!kflag && BTF_INFO_KIND(rt->info) == BTF_KIND_INT)
+    {
+      __u32 int_data = *reinterpret_cast<const __u32 *>(rt + 1);
+      if (BTF_INT_OFFSET(int_data) || BTF_INT_BITS(int_data) != rt->size * 8)
+      {
+        member_offset += BTF_INT_OFFSET(int_data);
+        bitfield_size = BTF_INT_BITS(int_data);
+      }
+    }
+
+    Field &field = record.fields[btf_str(btf, m->name_off)];
+    field.type = get_sized_type(m->type);
+    if (bitfield_size)
+    {
+      field.type.is_signed = false;
+      if (!set_bitfield(field, member_offset, bitfield_size))
+        field.type = SizedType(Type::none, 0);
+    }
+    else
+    {
+      field.offset = member_offset / 8;
+      field.is_bitfield = false;
+    }
   }
+}
 
-  std::unordered_set<std::string> myset(set);
+void BTF::add_types(std::unordered_set<std::string>& set,
+                    std::unordered_set<std::string>& fields,
+                    BPFtrace &bpftrace)
+{
+  TypeClosure closure(btf, fields);
   __s32 id, max = (__s32) btf__get_nr_types(btf);
 
-  for (id = 1; id <= max && myset.size(); id++)
+  // Enum constants can be used anywhere in a program, so keep them all.
+  // They're small compared to the structs.
+  for (id = 1; id <= max; id++)
+  {
+    const struct btf_type *t = btf__type_by_id(btf, id);
+    __u32 kind = BTF_INFO_KIND(t->info);
+
+    if (kind == BTF_KIND_ENUM)
+      closure.add(id);
+    else if ((is_record(kind) || kind == BTF_KIND_TYPEDEF) &&
+             set.count(btf_str(btf, t->name_off)))
+      closure.add(id);
+  }
+
+  const std::vector<__s32> &ids = closure.resolve();
+  aliases_ = closure.aliases();
+
+  for (auto id : ids)
   {
     const struct btf_type *t = btf__type_by_id(btf, id);
-    const char *str = btf_str(btf, t->name_off);
-
-    /*
-     * TODO(danobi): Only resolve necessary types. This can be
-     * accomlished by doing something like:
-     *
-     *    for (...) {
-     *      const struct btf_type *t = ...
-     *      const char *str = ...
-     *
-     *      if (myset.find(str) != myset.end()) {
-     *        btf_dump__dump_type(...);
-     *        myset.erase(str);
-     *
-     *        <dump required forward declared types>
-     *      }
-     *    }
-     *
-     * Care are must be taken to fully resolve any accesses
-     * via a pointer. libbpf currently does not fully resolve types
-     * that are used as a pointer. For example, if in the kernel there
-     * was:
-     *
-     *    struct Bar {
-     *      int x;
-     *    };
-     *
-     *    struct Foo {
-     *      struct Bar *b;
-     *    };
-     *
-     * b would not be fully resolved. Instead, libbpf will dump a
-     * forward declaration. So the libbpf output would look like:
-     *
-     *    struct Bar;
-     *    struct Foo {
-     *      struct Bar *b;
-     *    }
-     *
-     * So for now, we read in every type BTF exposes. It's slower
-     * and less memory efficient, but it's more ergonomic for the
-     * user to not have to do an explicit cast every time they
-     * access a pointer.
-     */
-
-    for (id = 1; id <= max; id++)
+    __u32 kind = BTF_INFO_KIND(t->info);
+
+    if (is_record(kind))
     {
-      const struct btf_type *t = btf__type_by_id(btf, id);
-      const char *str = btf_str(btf, t->name_off);
-      btf_dump__dump_type(dump, id);
+      Struct &record = bpftrace.structs_[type_name(id)];
+      record.size = t->size;
+      add_fields(t, 0, record);
+    }
+    else if (kind == BTF_KIND_ENUM)
+    {
+      auto e = reinterpret_cast<const struct btf_enum *>(t + 1);
+      for (__u16 i = 0; i < BTF_INFO_VLEN(t->info); i++, e++)
+        bpftrace.enums_[btf_str(btf, e->name_off)] = e->val;
     }
   }
-
-  btf_dump__free(dump);
-  return ret;
 }
 
 } // namespace bpftrace
@@ -293,7 +489,9 @@ BTF::BTF() { }
 
 BTF::~BTF() { }
 
-std::string BTF::c_def(std::unordered_set<std::string>& set __attribute__((__unused__))) { return std::string(""); }
+void BTF::add_types(std::unordered_set<std::string>& set __attribute__((__unused__)),
+                    std::unordered_set<std::string>& fields __attribute__((__unused__)),
+                    BPFtrace &bpftrace __attribute__((__unused__))) { }
 
 } // namespace bpftrace
 
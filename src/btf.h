@@ -2,12 +2,19 @@
 
 #include <linux/types.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
+#include "struct.h"
+#include "types.h"
+
 struct btf;
+struct btf_type;
 
 namespace bpftrace {
 
+class BPFtrace;
+
 class BTF
 {
   enum state {
@@ -20,11 +27,25 @@ public:
   ~BTF();
 
   bool has_data(void);
-  std::string c_def(std::unordered_set<std::string>& set);
+
+  // Adds the named types, plus the types reachable through the given field
+  // names, to bpftrace.structs_, along with all enum constants
+  void add_types(std::unordered_set<std::string>& set,
+                 std::unordered_set<std::string>& fields,
+                 BPFtrace &bpftrace);
 
 private:
   struct btf *btf;
   enum state state = NODATA;
+
+  // Memoized per type id, as the same types recur throughout big structs
+  std::unordered_map<__u32, SizedType> sized_types_;
+  std::unordered_map<__u32, std::string> aliases_;
+
+  __u32 resolve_modifiers(__u32 id);
+  std::string type_name(__u32 id);
+  SizedType get_sized_type(__u32 id);
+  void add_fields(const struct btf_type *t, __u32 bit_offset, Struct &record);
 };
 
 inline bool BTF::has_data(void)
@@ -1,5 +1,11 @@
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "llvm/Config/llvm-config.h"
 
@@ -9,6 +15,7 @@
 #include "utils.h"
 #include "headers.h"
 #include "btf.h"
+#include "timings.h"
 
 namespace bpftrace {
 
@@ -245,6 +252,7 @@ static SizedType get_sized_type(CXType clang_type)
 }
 
 ClangParser::ClangParserHandler::ClangParserHandler()
+  : translation_unit(nullptr)
 {
   index = clang_createIndex(1, 1);
 }
@@ -290,6 +298,99 @@ bool ClangParser::ClangParserHandler::check_diagnostics(const std::string& input
   return true;
 }
 
+// A saved translation unit is stored alongside a list of the headers it
+// included, with their modification times and sizes. It is only reused
+// while all of those are unchanged.
+bool ClangParser::ClangParserHandler::load_translation_unit(
+    const std::string &path,
+    const std::string &key)
+{
+  std::ifstream deps(path + ".deps");
+  size_t key_size = 0;
+  if (!(deps >> key_size) || key_size != key.size())
+    return false;
+  deps.get();
+  std::string stored_key(key_size, '\0');
+  deps.read(&stored_key[0], key_size);
+  if (!deps || stored_key != key)
+    return false;
+
+  long mtime, size;
+  std::string file;
+  while (deps >> mtime >> size && std::getline(deps >> std::ws, file))
+  {
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0 || st.st_mtime != mtime || st.st_size != size)
+      return false;
+  }
+  if (!deps.eof())
+    return false;
+
+  if (clang_createTranslationUnit2(index, path.c_str(), &translation_unit) !=
+      CXError_Success)
+    return false;
+
+  if (bt_verbose)
+    std::cerr << "Loaded C definitions from cache " << path << std::endl;
+  return true;
+}
+
+std::vector<std::string> ClangParser::ClangParserHandler::get_included_files()
+{
+  std::vector<std::string> files;
+  clang_getInclusions(
+      translation_unit,
+      [](CXFile file, CXSourceLocation *, unsigned, CXClientData client_data)
+      {
+        auto files = static_cast<std::vector<std::string>*>(client_data);
+        files->push_back(get_clang_string(clang_getFileName(file)));
+      },
+      &files);
+  return files;
+}
+
+void ClangParser::ClangParserHandler::save_translation_unit(
+    const std::string &path,
+    const std::string &key)
+{
+  std::vector<std::string> files = get_included_files();
+
+  // Write to temporary files first so concurrent runs never see a partial
+  // entry. Headers built into bpftrace don't exist on disk and are covered
+  // by the key instead.
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  if (clang_saveTranslationUnit(translation_unit, tmp_path.c_str(),
+                                clang_defaultSaveOptions(translation_unit)) !=
+      CXSaveError_None)
+  {
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  std::string tmp_deps = path + ".deps.tmp." + std::to_string(getpid());
+  std::ofstream deps(tmp_deps, std::ios::trunc);
+  deps << key.size() << std::endl << key;
+  for (auto &file : files)
+  {
+    struct stat st;
+    if (stat(file.c_str(), &st) == 0)
+      deps << st.st_mtime << " " << st.st_size << " " << file << std::endl;
+  }
+  deps.close();
+
+  if (deps.fail() ||
+      rename(tmp_path.c_str(), path.c_str()) != 0 ||
+      rename(tmp_deps.c_str(), (path + ".deps").c_str()) != 0)
+  {
+    unlink(tmp_path.c_str());
+    unlink(tmp_deps.c_str());
+    return;
+  }
+
+  if (bt_verbose)
+    std::cerr << "Saved C definitions to cache " << path << std::endl;
+}
+
 CXCursor ClangParser::ClangParserHandler::get_translation_unit_cursor() {
   return clang_getTranslationUnitCursor(translation_unit);
 }
@@ -353,8 +454,17 @@ bool ClangParser::visit_children(CXCursor &cursor, BPFtrace &bpftrace)
           }
           else
           {
-            structs[struct_name].fields[ident].offset = offset;
-            structs[struct_name].fields[ident].type = get_sized_type(type);
+            auto &field = structs[struct_name].fields[ident];
+            field.offset = offset;
+            field.type = get_sized_type(type);
+            field.is_bitfield = false;
+            if (clang_Cursor_isBitField(c))
+            {
+              field.type.is_signed = false;
+              if (!set_bitfield(field, clang_Type_getOffsetOf(ptype, ident.c_str()),
+                                clang_getFieldDeclBitWidth(c)))
+                field.type = SizedType(Type::none, 0);
+            }
             structs[struct_name].size = ptypesize;
           }
         }
@@ -373,38 +483,17 @@ bool ClangParser::parse_btf_definitions(BPFtrace &bpftrace)
   if (ast::Expression::getResolve().size() == 0)
     return true;
 
-  BTF btf = BTF();
+  Timings::Scope timing(bt_timings, "btf");
+  BTF btf;
 
   if (!btf.has_data())
     return true;
 
-  std::string input = btf.c_def(ast::Expression::getResolve());
-
-  CXUnsavedFile unsaved_files =
-  {
-    .Filename = "btf.h",
-    .Contents = input.c_str(),
-    .Length   = input.size(),
-  };
-
-  ClangParserHandler handler;
-  CXErrorCode error = handler.parse_translation_unit(
-    "btf.h", NULL, 0, &unsaved_files, 1,
-    CXTranslationUnit_DetailedPreprocessingRecord);
-  if (error)
-  {
-    if (bt_debug == DebugLevel::kFullDebug) {
-      std::cerr << "Clang error while parsing BTF C definitions: " << error << std::endl;
-      std::cerr << "Input (" << input.size() << "): " << input << std::endl;
-    }
-    return false;
-  }
-
-  if (!handler.check_diagnostics(input))
-    return false;
-
-  CXCursor cursor = handler.get_translation_unit_cursor();
-  return visit_children(cursor, bpftrace);
+  // BTF types are imported directly rather than going through clang
+  btf.add_types(ast::Expression::getResolve(),
+                ast::Expression::getResolveFields(),
+                bpftrace);
+  return true;
 }
 
 bool ClangParser::parse(ast::Program *program, BPFtrace &bpftrace, std::vector<std::string> extra_flags)
@@ -475,23 +564,57 @@ bool ClangParser::parse(ast::Program *program, BPFtrace &bpftrace, std::vector<s
     args.push_back(flag.c_str());
   }
 
+  unsigned num_unsaved_files = sizeof(unsaved_files)/sizeof(CXUnsavedFile);
+
+  // Parsing kernel headers can take seconds, so reuse the translation unit
+  // from an earlier run with the same definitions and flags
+  std::string cache_path, cache_key;
+  if (!bpftrace.cache_dir_.empty() && create_private_dir(bpftrace.cache_dir_))
+  {
+    std::stringstream key;
+    key << "clang " << get_clang_string(clang_getClangVersion()) << std::endl;
+    for (auto arg : args)
+      key << "arg " << arg << std::endl;
+    for (unsigned i = 0; i < num_unsaved_files; i++)
+    {
+      key << "file " << unsaved_files[i].Filename << " "
+          << unsaved_files[i].Length << std::endl;
+      key.write(unsaved_files[i].Contents, unsaved_files[i].Length);
+    }
+    cache_key = key.str();
+
+    std::stringstream path;
+    path << bpftrace.cache_dir_ << "/" << std::hex << std::setw(16)
+         << std::setfill('0') << std::hash<std::string>()(cache_key) << ".ast";
+    cache_path = path.str();
+  }
+
   ClangParserHandler handler;
-  CXErrorCode error = handler.parse_translation_unit(
-      "definitions.h",
-      &args[0], args.size(),
-      unsaved_files, sizeof(unsaved_files)/sizeof(CXUnsavedFile),
-      CXTranslationUnit_DetailedPreprocessingRecord);
-  if (error)
+  if (cache_path.empty() || !handler.load_translation_unit(cache_path, cache_key))
   {
-    if (bt_debug == DebugLevel::kFullDebug) {
-      std::cerr << "Clang error while parsing C definitions: " << error << std::endl;
-      std::cerr << "Input (" << input.size() << "): " << input << std::endl;
+    CXErrorCode error = handler.parse_translation_unit(
+        "definitions.h",
+        &args[0], args.size(),
+        unsaved_files, num_unsaved_files,
+        CXTranslationUnit_DetailedPreprocessingRecord);
+    if (error)
+    {
+      if (bt_debug == DebugLevel::kFullDebug) {
+        std::cerr << "Clang error while parsing C definitions: " << error << std::endl;
+        std::cerr << "Input (" << input.size() << "): " << input << std::endl;
+      }
+      return false;
     }
-    return false;
+
+    if (!handler.check_diagnostics(input))
+      return false;
+
+    if (!cache_path.empty())
+      handler.save_translation_unit(cache_path, cache_key);
   }
 
-  if (!handler.check_diagnostics(input))
-    return false;
+  // Recorded so the program cache can tell when any of them change
+  bpftrace.c_headers_ = handler.get_included_files();
 
   CXCursor cursor = handler.get_translation_unit_cursor();
   return visit_children(cursor, bpftrace);
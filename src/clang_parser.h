@@ -35,6 +35,11 @@ private:
 
     bool check_diagnostics(const std::string& input);
 
+    bool load_translation_unit(const std::string &path, const std::string &key);
+    void save_translation_unit(const std::string &path, const std::string &key);
+
+    std::vector<std::string> get_included_files();
+
     CXCursor get_translation_unit_cursor();
 
   private:
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstring>
+
+#include "event_reorder.h"
+
+namespace bpftrace {
+
+namespace {
+
+// Most records are a few hundred bytes, so keeping this many buffers
+// around costs little
+const size_t MAX_SPARE_BUFFERS = 1024;
+
+bool later(uint64_t timestamp_a, uint64_t seq_a,
+           uint64_t timestamp_b, uint64_t seq_b)
+{
+  if (timestamp_a != timestamp_b)
+    return timestamp_a > timestamp_b;
+  return seq_a > seq_b;
+}
+
+} // namespace
+
+EventReorder::EventReorder(uint64_t window_ns, size_t max_events)
+  : window_ns_(window_ns),
+    max_events_(max_events)
+{
+}
+
+void EventReorder::push(const void *data, int size)
+{
+  if (size < static_cast<int>(sizeof(uint64_t)))
+    return;
+
+  Event event;
+  size -= sizeof(uint64_t);
+  memcpy(&event.timestamp, static_cast<const uint8_t*>(data) + size,
+         sizeof(uint64_t));
+  event.seq = next_seq_++;
+  if (!spare_.empty())
+  {
+    event.data = std::move(spare_.back());
+    spare_.pop_back();
+  }
+  event.data.assign(static_cast<const uint8_t*>(data),
+                    static_cast<const uint8_t*>(data) + size);
+
+  events_.push_back(std::move(event));
+  std::push_heap(events_.begin(), events_.end(), [](auto &a, auto &b) {
+    return later(a.timestamp, a.seq, b.timestamp, b.seq);
+  });
+}
+
+void EventReorder::release(uint64_t now_ns, const Handler &handler)
+{
+  uint64_t cutoff = now_ns > window_ns_ ? now_ns - window_ns_ : 0;
+  while (!events_.empty() &&
+         (events_.front().timestamp < cutoff || events_.size() > max_events_))
+    pop(handler);
+}
+
+void EventReorder::release_all(const Handler &handler)
+{
+  while (!events_.empty())
+    pop(handler);
+}
+
+void EventReorder::pop(const Handler &handler)
+{
+  std::pop_heap(events_.begin(), events_.end(), [](auto &a, auto &b) {
+    return later(a.timestamp, a.seq, b.timestamp, b.seq);
+  });
+  Event event = std::move(events_.back());
+  events_.pop_back();
+
+  handler(event.data.data(), event.data.size());
+
+  if (spare_.size() < MAX_SPARE_BUFFERS)
+    spare_.push_back(std::move(event.data));
+}
+
+} // namespace bpftrace
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace bpftrace {
+
+// Puts the perf event records of all CPUs back into the order they were
+// output in, for --ordered. Each record ends with the bpf_ktime_get_ns()
+// time it was output at.
+//
+// A record is held until it is older than the reorder window, so that
+// records of the same age which are read late, from another CPU's buffer,
+// can still go before it. At most max_events records are held; beyond
+// that the oldest are handed back early.
+class EventReorder
+{
+public:
+  // Called with each record, minus its timestamp
+  typedef std::function<void(void *data, int size)> Handler;
+
+  EventReorder(uint64_t window_ns, size_t max_events);
+
+  // Takes a copy of the record
+  void push(const void *data, int size);
+  // Hands back, oldest first, every record output before now_ns - window
+  void release(uint64_t now_ns, const Handler &handler);
+  void release_all(const Handler &handler);
+
+  size_t size() const { return events_.size(); }
+
+private:
+  struct Event
+  {
+    uint64_t timestamp;
+    // Keeps records with the same timestamp in the order they were read
+    uint64_t seq;
+    std::vector<uint8_t> data;
+  };
+
+  uint64_t window_ns_;
+  size_t max_events_;
+  uint64_t next_seq_ = 0;
+  // A min-heap on (timestamp, seq)
+  std::vector<Event> events_;
+  // Buffers of released records, to reuse for new ones
+  std::vector<std::vector<uint8_t>> spare_;
+
+  void pop(const Handler &handler);
+};
+
+} // namespace bpftrace
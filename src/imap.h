@@ -20,6 +20,7 @@ public:
   std::string name_;
   SizedType type_;
   MapKey key_;
+  int max_entries_ = 0;
 
   // used by lhist(). TODO: move to separate Map object.
   int lqmin;
@@ -1,14 +1,18 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <signal.h>
 #include <sys/resource.h>
 #include <sys/utsname.h>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <unistd.h>
 #include <string.h>
 #include <getopt.h>
 
+#include "async_writer.h"
+#include "attached_probe.h"
 #include "bpforc.h"
 #include "bpftrace.h"
 #include "clang_parser.h"
@@ -16,7 +20,9 @@
 #include "driver.h"
 #include "list.h"
 #include "printer.h"
+#include "program_cache.h"
 #include "semantic_analyser.h"
+#include "timings.h"
 #include "tracepoint_format_parser.h"
 #include "output.h"
 
@@ -35,13 +41,16 @@ void usage()
 {
   std::cerr << "USAGE:" << std::endl;
   std::cerr << "    bpftrace [options] filename" << std::endl;
-  std::cerr << "    bpftrace [options] -e 'program'" << std::endl << std::endl;
+  std::cerr << "    bpftrace [options] -e 'program'" << std::endl;
+  std::cerr << "    bpftrace [options] --load-object FILE" << std::endl << std::endl;
   std::cerr << "OPTIONS:" << std::endl;
   std::cerr << "    -B MODE        output buffering mode ('full', 'none')" << std::endl;
-  std::cerr << "    -f FORMAT      output format ('text', 'json')" << std::endl;
+  std::cerr << "    -f FORMAT      output format ('text', 'json', 'binary')" << std::endl;
   std::cerr << "    -d             debug info dry run" << std::endl;
   std::cerr << "    -o file        redirect bpftrace output to file" << std::endl;
   std::cerr << "    -dd            verbose debug info dry run" << std::endl;
+  std::cerr << "    --emit-object FILE  compile the program to FILE without running it" << std::endl;
+  std::cerr << "    --load-object FILE  run a program compiled with --emit-object" << std::endl;
   std::cerr << "    -b             force BTF (BPF type format) processing" << std::endl;
   std::cerr << "    -e 'program'   execute this program" << std::endl;
   std::cerr << "    -h, --help     show this help message" << std::endl;
@@ -51,16 +60,20 @@ void usage()
   std::cerr << "    -p PID         enable USDT probes on PID" << std::endl;
   std::cerr << "    -c 'CMD'       run CMD and enable USDT probes on resulting process" << std::endl;
   std::cerr << "    --unsafe       allow unsafe builtin functions" << std::endl;
+  std::cerr << "    --timings      report the time and memory taken by each startup phase" << std::endl;
+  std::cerr << "    --delta N      print() only changed map keys, and the whole map every N prints" << std::endl;
+  std::cerr << "    --ordered      print events from all CPUs in the order they happened" << std::endl;
   std::cerr << "    -v             verbose messages" << std::endl;
   std::cerr << "    -V, --version  bpftrace version" << std::endl << std::endl;
   std::cerr << "ENVIRONMENT:" << std::endl;
-  std::cerr << "    BPFTRACE_STRLEN           [default: 64] bytes on BPF stack per str()" << std::endl;
+  std::cerr << "    BPFTRACE_STRLEN           [default: 64] bytes per str()" << std::endl;
   std::cerr << "    BPFTRACE_NO_CPP_DEMANGLE  [default: 0] disable C++ symbol demangling" << std::endl;
   std::cerr << "    BPFTRACE_MAP_KEYS_MAX     [default: 4096] max keys in a map" << std::endl;
   std::cerr << "    BPFTRACE_CAT_BYTES_MAX    [default: 10k] maximum bytes read by cat builtin" << std::endl;
   std::cerr << "    BPFTRACE_MAX_PROBES       [default: 512] max number of probes" << std::endl;
   std::cerr << "    BPFTRACE_LOG_SIZE         [default: 409600] log size in bytes" << std::endl;
   std::cerr << "    BPFTRACE_NO_USER_SYMBOLS  [default: 0] disable user symbol resolution" << std::endl;
+  std::cerr << "    BPFTRACE_CACHE_DIR        [default: none] directory for caching compiled programs" << std::endl;
   std::cerr << std::endl;
   std::cerr << "EXAMPLES:" << std::endl;
   std::cerr << "bpftrace -l '*sleep*'" << std::endl;
@@ -132,7 +145,10 @@ int main(int argc, char *argv[])
   bool safe_mode = true;
   bool force_btf = false;
   std::string script, search, file_name, output_file, output_format;
+  std::string emit_object, load_object;
   OutputBufferConfig obc = OutputBufferConfig::UNSET;
+  uint64_t delta_full_interval = 0;
+  bool ordered_output = false;
   int c;
 
   const char* const short_options = "dbB:f:e:hlp:vc:Vo:I:";
@@ -142,6 +158,11 @@ int main(int argc, char *argv[])
     option{"unsafe", no_argument, nullptr, 'u'},
     option{"btf", no_argument, nullptr, 'b'},
     option{"include", required_argument, nullptr, '#'},
+    option{"emit-object", required_argument, nullptr, 'O'},
+    option{"load-object", required_argument, nullptr, 'L'},
+    option{"timings", no_argument, nullptr, 'T'},
+    option{"delta", required_argument, nullptr, 'D'},
+    option{"ordered", no_argument, nullptr, 'r'},
     option{nullptr, 0, nullptr, 0},  // Must be last
   };
   std::vector<std::string> include_dirs;
@@ -191,6 +212,27 @@ int main(int argc, char *argv[])
       case '#':
         include_files.push_back(optarg);
         break;
+      case 'O':
+        emit_object = optarg;
+        break;
+      case 'L':
+        load_object = optarg;
+        break;
+      case 'T':
+        bt_timings.enable();
+        break;
+      case 'D':
+      {
+        std::istringstream interval(optarg);
+        if (!(interval >> delta_full_interval) || delta_full_interval == 0) {
+          std::cerr << "USAGE: --delta must be a positive number of prints." << std::endl;
+          return 1;
+        }
+        break;
+      }
+      case 'r':
+        ordered_output = true;
+        break;
       case 'l':
         listing = true;
         break;
@@ -227,6 +269,18 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  if (!emit_object.empty() && !load_object.empty())
+  {
+    std::cerr << "USAGE: Cannot use both --emit-object and --load-object." << std::endl;
+    return 1;
+  }
+
+  if (!load_object.empty() && (!script.empty() || bt_debug != DebugLevel::kNone))
+  {
+    std::cerr << "USAGE: --load-object cannot be used with -e or -d." << std::endl;
+    return 1;
+  }
+
   if (cmd_str && pid_str)
   {
     std::cerr << "USAGE: Cannot use both -c and -p." << std::endl;
@@ -236,26 +290,68 @@ int main(int argc, char *argv[])
 
   std::ostream * os = &std::cout;
   std::ofstream outputstream;
+  std::unique_ptr<AsyncWriter> outputwriter;
+  std::unique_ptr<std::ostream> asyncstream;
   if (!output_file.empty()) {
-    outputstream.open(output_file);
-    if (outputstream.fail()) {
+    // The background writer is opt-in, except for compressed files
+    const uint64_t default_buffer_size = 4 * 1024 * 1024;
+    uint64_t buffer_size = 0;
+    uint64_t rotate_size = 0;
+    uint64_t datasync = 0;
+    if (!get_uint64_env_var("BPFTRACE_OUTPUT_BUFFER_SIZE", buffer_size) ||
+        !get_uint64_env_var("BPFTRACE_OUTPUT_ROTATE_SIZE", rotate_size) ||
+        !get_uint64_env_var("BPFTRACE_OUTPUT_DATASYNC", datasync))
+      return 1;
+
+    // Compression is done by the writer thread, so it's always used for .zst
+    bool compress = output_file.size() > 4 &&
+        output_file.compare(output_file.size() - 4, 4, ".zst") == 0;
+    if (compress && !AsyncWriter::compression_supported()) {
+      std::cerr << "Cannot write \"" << output_file << "\": bpftrace was "
+                << "built without zstd support" << std::endl;
+      return 1;
+    }
+
+    bool opened;
+    if (buffer_size > 0 || compress) {
+      if (buffer_size == 0)
+        buffer_size = default_buffer_size;
+      outputwriter = std::make_unique<AsyncWriter>(
+          buffer_size, rotate_size, datasync != 0, compress);
+      opened = outputwriter->open(output_file);
+    }
+    else {
+      outputstream.open(output_file);
+      opened = !outputstream.fail();
+      os = &outputstream;
+    }
+    if (!opened) {
       std::cerr << "Failed to open output file: \"" << output_file;
       std::cerr << "\": " << strerror(errno) <<  std::endl;
       return 1;
     }
-    os = &outputstream;
+    if (outputwriter) {
+      asyncstream = std::make_unique<std::ostream>(outputwriter.get());
+      os = asyncstream.get();
+    }
   }
 
+  // The background writer batches writes itself, and takes a record at a
+  // time from each flush
+  bool batch = obc == OutputBufferConfig::FULL && !outputwriter;
   std::unique_ptr<Output> output;
   if (output_format.empty() || output_format == "text") {
     output = std::make_unique<TextOutput>(*os);
   }
   else if (output_format == "json") {
-    output = std::make_unique<JsonOutput>(*os);
+    output = std::make_unique<JsonOutput>(*os, std::cerr, batch);
+  }
+  else if (output_format == "binary") {
+    output = std::make_unique<BinaryOutput>(*os, std::cerr, batch);
   }
   else {
     std::cerr << "Invalid output format \"" << output_format << "\"" << std::endl;
-    std::cerr << "Valid formats: 'text', 'json'" << std::endl;
+    std::cerr << "Valid formats: 'text', 'json', 'binary'" << std::endl;
     return 1;
   }
 
@@ -276,6 +372,9 @@ int main(int argc, char *argv[])
   }
 
   BPFtrace bpftrace(std::move(output));
+  bpftrace.output_writer_ = outputwriter.get();
+  bpftrace.delta_full_interval_ = delta_full_interval;
+  bpftrace.ordered_output_ = ordered_output;
   Driver driver(bpftrace);
 
   bpftrace.safe_mode_ = safe_mode;
@@ -312,7 +411,16 @@ int main(int argc, char *argv[])
     return 0;
   }
 
-  if (script.empty())
+  if (!load_object.empty())
+  {
+    // Positional parameters are resolved when the object is compiled
+    if (optind != argc)
+    {
+      std::cerr << "USAGE: --load-object does not take a program or positional parameters." << std::endl;
+      return 1;
+    }
+  }
+  else if (script.empty())
   {
     // Script file
     if (argv[optind] == nullptr)
@@ -330,6 +438,7 @@ int main(int argc, char *argv[])
     std::stringstream buf;
     buf << file.rdbuf();
     driver.source(filename, buf.str());
+    Timings::Scope timing(bt_timings, "parse");
     err = driver.parse();
     optind++;
   }
@@ -337,6 +446,7 @@ int main(int argc, char *argv[])
   {
     // Script is provided as a command line argument
     driver.source("stdin", script);
+    Timings::Scope timing(bt_timings, "parse");
     err = driver.parse();
   }
 
@@ -365,16 +475,11 @@ int main(int argc, char *argv[])
   if (!get_uint64_env_var("BPFTRACE_STRLEN", bpftrace.strlen_))
     return 1;
 
-  // in practice, the largest buffer I've seen fit into the BPF stack was 240 bytes.
-  // I've set the bar lower, in case your program has a deeper stack than the one from my tests,
-  // in the hope that you'll get this instructive error instead of getting the BPF verifier's error.
-  if (bpftrace.strlen_ > 200) {
-    // the verifier errors you would encounter when attempting larger allocations would be:
-    // >240=  <Looks like the BPF stack limit of 512 bytes is exceeded. Please move large on stack variables into BPF per-cpu array map.>
-    // ~1024= <A call to built-in function 'memset' is not supported.>
-    std::cerr << "'BPFTRACE_STRLEN' " << bpftrace.strlen_ << " exceeds the current maximum of 200 bytes." << std::endl
-    << "This limitation is because strings are currently stored on the 512 byte BPF stack." << std::endl
-    << "Long strings will be pursued in: https://github.com/iovisor/bpftrace/issues/305" << std::endl;
+  // strings longer than STACK_STRLEN_MAX are built in a per-cpu scratch map
+  // rather than on the 512 byte BPF stack. The upper bound keeps printf()
+  // arguments, which may hold several strings, within a single map value.
+  if (bpftrace.strlen_ > STRLEN_MAX) {
+    std::cerr << "'BPFTRACE_STRLEN' " << bpftrace.strlen_ << " exceeds the current maximum of " << STRLEN_MAX << " bytes." << std::endl;
     return 1;
   }
 
@@ -400,6 +505,32 @@ int main(int argc, char *argv[])
   if (!get_uint64_env_var("BPFTRACE_LOG_SIZE", bpftrace.log_size_))
     return 1;
 
+  if (!get_uint64_env_var("BPFTRACE_REORDER_WINDOW_MS", bpftrace.reorder_window_ms_))
+    return 1;
+
+  uint64_t busy_poll = 0;
+  if (!get_uint64_env_var("BPFTRACE_PERF_WAKEUP_EVENTS", bpftrace.perf_wakeup_events_) ||
+      !get_uint64_env_var("BPFTRACE_PERF_WAKEUP_WATERMARK", bpftrace.perf_wakeup_watermark_) ||
+      !get_uint64_env_var("BPFTRACE_POLL_TIMEOUT_MS", bpftrace.poll_timeout_ms_) ||
+      !get_uint64_env_var("BPFTRACE_BUSY_POLL", busy_poll))
+    return 1;
+  bpftrace.busy_poll_ = busy_poll != 0;
+  if (bpftrace.perf_wakeup_events_ == 0 || bpftrace.perf_wakeup_events_ > UINT32_MAX)
+  {
+    std::cerr << "Env var 'BPFTRACE_PERF_WAKEUP_EVENTS' must be between 1 and " << UINT32_MAX << "." << std::endl;
+    return 1;
+  }
+  if (bpftrace.perf_wakeup_watermark_ > UINT32_MAX)
+  {
+    std::cerr << "Env var 'BPFTRACE_PERF_WAKEUP_WATERMARK' must be at most " << UINT32_MAX << "." << std::endl;
+    return 1;
+  }
+  if (bpftrace.poll_timeout_ms_ == 0 || bpftrace.poll_timeout_ms_ > INT_MAX)
+  {
+    std::cerr << "Env var 'BPFTRACE_POLL_TIMEOUT_MS' must be between 1 and " << INT_MAX << "." << std::endl;
+    return 1;
+  }
+
   if (const char* env_p = std::getenv("BPFTRACE_CAT_BYTES_MAX"))
   {
     uint64_t proposed;
@@ -428,17 +559,6 @@ int main(int argc, char *argv[])
   if (cmd_str)
     bpftrace.cmd_ = cmd_str;
 
-  if (TracepointFormatParser::parse(driver.root_) == false)
-    return 1;
-
-  if (bt_debug != DebugLevel::kNone)
-  {
-    ast::Printer p(std::cout);
-    driver.root_->accept(p);
-    std::cout << std::endl;
-  }
-
-  ClangParser clang;
   std::vector<std::string> extra_flags;
   {
     struct utsname utsname;
@@ -465,35 +585,111 @@ int main(int argc, char *argv[])
     extra_flags.push_back(file);
   }
 
-  // NOTE(mmarchini): if there are no C definitions, clang parser won't run to
-  // avoid issues in some versions. Since we're including files in the command
-  // line, we want to force parsing, so we make sure C definitions are not
-  // empty before going to clang parser stage.
-  if (!include_files.empty() && driver.root_->c_definitions.empty())
-    driver.root_->c_definitions = "#define __BPFTRACE_DUMMY__";
+  if (const char* env_p = std::getenv("BPFTRACE_CACHE_DIR"))
+    bpftrace.cache_dir_ = env_p;
 
-  if (!clang.parse(driver.root_, bpftrace, extra_flags))
-    return 1;
+  // Debug output needs the whole pipeline to run, so bypass the cache
+  std::unique_ptr<ProgramCache> cache;
+  if (!bpftrace.cache_dir_.empty() && bt_debug == DebugLevel::kNone && load_object.empty())
+  {
+    std::string key = ProgramCache::make_key(bpftrace, *driver.root_, extra_flags, include_files);
+    cache = std::make_unique<ProgramCache>(bpftrace.cache_dir_, key);
+  }
 
-  driver.parse();
+  // The generated code refers to the LLVM context owned by CodegenLLVM, so
+  // it must outlive bpforc
+  std::unique_ptr<ast::CodegenLLVM> llvm;
+  std::unique_ptr<BpfOrc> bpforc;
+  if (!load_object.empty())
+  {
+    bpforc = ProgramCache::load_object(bpftrace, load_object);
+    if (!bpforc)
+      return 1;
+  }
+  else if (cache)
+  {
+    Timings::Scope timing(bt_timings, "load program cache");
+    bpforc = cache->load(bpftrace);
+  }
 
-  if (err)
-    return err;
+  if (!bpforc)
+  {
+    {
+      Timings::Scope timing(bt_timings, "tracepoint formats");
+      if (TracepointFormatParser::parse(driver.root_, bpftrace) == false)
+        return 1;
+    }
 
-  ast::SemanticAnalyser semantics(driver.root_, bpftrace);
-  err = semantics.analyse();
-  if (err)
-    return err;
+    if (bt_debug != DebugLevel::kNone)
+    {
+      ast::Printer p(std::cout);
+      driver.root_->accept(p);
+      std::cout << std::endl;
+    }
 
-  err = semantics.create_maps(bt_debug != DebugLevel::kNone);
-  if (err)
-    return err;
+    // NOTE(mmarchini): if there are no C definitions, clang parser won't run to
+    // avoid issues in some versions. Since we're including files in the command
+    // line, we want to force parsing, so we make sure C definitions are not
+    // empty before going to clang parser stage.
+    if (!include_files.empty() && driver.root_->c_definitions.empty())
+      driver.root_->c_definitions = "#define __BPFTRACE_DUMMY__";
+
+    ClangParser clang;
+    {
+      Timings::Scope timing(bt_timings, "clang");
+      if (!clang.parse(driver.root_, bpftrace, extra_flags))
+        return 1;
+    }
+
+    {
+      Timings::Scope timing(bt_timings, "parse");
+      driver.parse();
+    }
 
-  ast::CodegenLLVM llvm(driver.root_, bpftrace);
-  auto bpforc = llvm.compile(bt_debug);
+    if (err)
+      return err;
 
-  if (bt_debug != DebugLevel::kNone)
-    return 0;
+    ast::SemanticAnalyser semantics(driver.root_, bpftrace);
+    {
+      Timings::Scope timing(bt_timings, "semantic analysis");
+      err = semantics.analyse();
+      if (err)
+        return err;
+    }
+
+    {
+      Timings::Scope timing(bt_timings, "create maps");
+      err = semantics.create_maps(bt_debug != DebugLevel::kNone);
+      if (err)
+        return err;
+    }
+
+    {
+      Timings::Scope timing(bt_timings, "codegen");
+      bpftrace.attach_cookie_ = attach_cookie_supported();
+      llvm = std::make_unique<ast::CodegenLLVM>(driver.root_, bpftrace);
+      bpforc = llvm->compile(bt_debug);
+    }
+
+    if (bt_debug != DebugLevel::kNone)
+    {
+      bt_timings.report(*bpftrace.out_);
+      return 0;
+    }
+
+    if (cache)
+    {
+      Timings::Scope timing(bt_timings, "save program cache");
+      cache->save(bpftrace, *bpforc);
+    }
+  }
+
+  if (!emit_object.empty())
+  {
+    bool emitted = ProgramCache::emit_object(bpftrace, *driver.root_, *bpforc, emit_object);
+    bt_timings.report(*bpftrace.out_);
+    return emitted ? 0 : 1;
+  }
 
   // Signal handler that lets us know an exit signal was received.
   struct sigaction act = {};
@@ -528,7 +724,11 @@ int main(int argc, char *argv[])
   act.sa_handler = SIG_DFL;
   sigaction(SIGINT, &act, NULL);
 
-  std::cout << "\n\n";
+  // Separates the maps from the per-event output. Not for JSON, whose
+  // batched records would be written after it, nor binary output, which it
+  // would corrupt.
+  if (output_format.empty() || output_format == "text")
+    bpftrace.out_->outputstream() << "\n\n";
 
   err = bpftrace.print_maps();
   if (err)
@@ -31,7 +31,8 @@ Map::Map(const std::string &name, const SizedType &type, const MapKey &key, int
 
   int key_size = key.size();
   if (type.type == Type::hist || type.type == Type::lhist ||
-      type.type == Type::avg || type.type == Type::stats)
+      type.type == Type::avg || type.type == Type::stats ||
+      type.type == Type::hll || type.type == Type::quantiles)
     key_size += 8;
   if (key_size == 0)
     key_size = 8;
@@ -39,7 +40,8 @@ Map::Map(const std::string &name, const SizedType &type, const MapKey &key, int
   enum bpf_map_type map_type;
   if ((type.type == Type::hist || type.type == Type::lhist || type.type == Type::count ||
       type.type == Type::sum || type.type == Type::min || type.type == Type::max ||
-      type.type == Type::avg || type.type == Type::stats) &&
+      type.type == Type::avg || type.type == Type::stats ||
+      type.type == Type::hll || type.type == Type::quantiles) &&
       (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)))
   {
       map_type = BPF_MAP_TYPE_PERCPU_HASH;
@@ -50,11 +52,39 @@ Map::Map(const std::string &name, const SizedType &type, const MapKey &key, int
     max_entries = 1;
     key_size = 4;
   }
+  else if (type.type == Type::ratelimit)
+  {
+    // token bucket state for each ratelimit() call site
+    map_type = BPF_MAP_TYPE_PERCPU_ARRAY;
+    key_size = 4;
+  }
+  else if (type.type == Type::scratch)
+  {
+    // buffers too large for the BPF stack, one for each call site using them
+    map_type = BPF_MAP_TYPE_PERCPU_ARRAY;
+    key_size = 4;
+  }
+  else if (type.type == Type::elapsed)
+  {
+    // the start time for the elapsed builtin, set when the program is run
+    map_type = BPF_MAP_TYPE_ARRAY;
+    max_entries = 1;
+    key_size = 4;
+  }
+  else if (type.type == Type::topk)
+  {
+    // count-min sketch cells, followed by (value, count) pairs for the
+    // heavy hitter table
+    map_type = BPF_MAP_TYPE_PERCPU_ARRAY;
+    max_entries = TOPK_SKETCH_DEPTH * TOPK_SKETCH_WIDTH + 2 * TOPK_SIZE;
+    key_size = 4;
+  }
   else
     map_type = BPF_MAP_TYPE_HASH;
 
   int value_size = type.size;
   int flags = 0;
+  max_entries_ = max_entries;
   mapfd_ = create_map(map_type, name.c_str(), key_size, value_size, max_entries, flags);
   if (mapfd_ < 0)
   {
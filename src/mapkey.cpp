@@ -1,5 +1,9 @@
+#include <cinttypes>
+#include <cstdio>
+
 #include "bpftrace.h"
 #include "mapkey.h"
+#include "utils.h"
 
 namespace bpftrace {
 
@@ -45,56 +49,95 @@ std::vector<std::string> MapKey::argument_value_list(BPFtrace &bpftrace,
 
 std::string MapKey::argument_value_list_str(BPFtrace &bpftrace,
     const std::vector<uint8_t> &data) const
+{
+  std::string str;
+  argument_value_list_append(str, bpftrace, data);
+  return str;
+}
+
+void MapKey::argument_value_list_append(std::string &str, BPFtrace &bpftrace,
+    const std::vector<uint8_t> &data) const
 {
   if (args_.empty())
-    return "";
-  return "[" + str_join(argument_value_list(bpftrace, data), ", ") + "]";
+    return;
+  str += "[";
+  int offset = 0;
+  for (size_t i = 0; i < args_.size(); i++)
+  {
+    if (i)
+      str += ", ";
+    argument_value_append(str, bpftrace, args_[i], &data[offset]);
+    offset += args_[i].size;
+  }
+  str += "]";
 }
 
 std::string MapKey::argument_value(BPFtrace &bpftrace,
     const SizedType &arg,
     const void *data)
+{
+  std::string str;
+  argument_value_append(str, bpftrace, arg, data);
+  return str;
+}
+
+void MapKey::argument_value_append(std::string &str, BPFtrace &bpftrace,
+    const SizedType &arg,
+    const void *data)
 {
   auto arg_data = static_cast<const uint8_t*>(data);
-  std::ostringstream ptr;
   switch (arg.type)
   {
     case Type::integer:
       switch (arg.size)
       {
         case 1:
-          return std::to_string(*(const int8_t*)data);
+          str_append_int(str, *(const int8_t*)data);
+          return;
         case 2:
-          return std::to_string(*(const int16_t*)data);
+          str_append_int(str, *(const int16_t*)data);
+          return;
         case 4:
-          return std::to_string(*(const int32_t*)data);
+          str_append_int(str, *(const int32_t*)data);
+          return;
         case 8:
-          return std::to_string(*(const int64_t*)data);
+          str_append_int(str, *(const int64_t*)data);
+          return;
         default:
           break;
       }
       break;
     case Type::kstack:
-      return bpftrace.get_stack(*(const uint64_t*)data, false, arg.stack_type, 4);
+      str += bpftrace.get_stack(*(const uint64_t*)data, false, arg.stack_type, 4);
+      return;
     case Type::ustack:
-      return bpftrace.get_stack(*(const uint64_t*)data, true, arg.stack_type, 4);
+      str += bpftrace.get_stack(*(const uint64_t*)data, true, arg.stack_type, 4);
+      return;
     case Type::ksym:
-      return bpftrace.resolve_ksym(*(const uint64_t*)data);
+      str += bpftrace.resolve_ksym_cached(*(const uint64_t*)data);
+      return;
     case Type::usym:
-      return bpftrace.resolve_usym(*(const uint64_t*)data, *(const uint64_t*)(arg_data + 8));
+      str += bpftrace.resolve_usym_cached(*(const uint64_t*)data, *(const uint64_t*)(arg_data + 8));
+      return;
     case Type::inet:
-      return bpftrace.resolve_inet(*(const int64_t*)data, (const uint8_t*)(arg_data + 8));
+      str += bpftrace.resolve_inet(*(const int64_t*)data, (const uint8_t*)(arg_data + 8));
+      return;
     case Type::username:
-      return bpftrace.resolve_uid(*(const uint64_t*)data);
+      str += bpftrace.resolve_uid(*(const uint64_t*)data);
+      return;
     case Type::probe:
-      return bpftrace.probe_ids_[*(const uint64_t*)data];
+      str += bpftrace.probe_ids_[*(const uint64_t*)data];
+      return;
     case Type::string:
-      return std::string((const char*)data);
+      str += (const char*)data;
+      return;
     case Type::cast:
       if (arg.is_pointer) {
         // use case: show me these pointer values
-        ptr << "0x" << std::hex << *(const int64_t*)data;
-        return ptr.str();
+        char ptr[24];
+        snprintf(ptr, sizeof(ptr), "0x%" PRIx64, *(const uint64_t*)data);
+        str += ptr;
+        return;
       }
       // fall through
     default:
@@ -22,11 +22,15 @@ public:
       const std::vector<uint8_t> &data) const;
   std::string argument_value_list_str(BPFtrace &bpftrace,
       const std::vector<uint8_t> &data) const;
-
-private:
+  // argument_value_list_str(), appended to str
+  void argument_value_list_append(std::string &str, BPFtrace &bpftrace,
+      const std::vector<uint8_t> &data) const;
   static std::string argument_value(BPFtrace &bpftrace,
       const SizedType &arg,
       const void *data);
+  static void argument_value_append(std::string &str, BPFtrace &bpftrace,
+      const SizedType &arg,
+      const void *data);
 };
 
 } // namespace bpftrace
@@ -1,24 +1,40 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
 #include "output.h"
 #include "bpftrace.h"
 #include "utils.h"
 
 namespace bpftrace {
 
-std::ostream& operator<<(std::ostream& out, MessageType type) {
+// Output built up in a buffer is written to the stream once it reaches this
+// size (per record for JSON, unless batching)
+const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+const char *message_type_name(MessageType type)
+{
   switch (type) {
-    case MessageType::map: out << "map"; break;
-    case MessageType::hist: out << "hist"; break;
-    case MessageType::stats: out << "stats"; break;
-    case MessageType::printf: out << "printf"; break;
-    case MessageType::time: out << "time"; break;
-    case MessageType::cat: out << "cat"; break;
-    case MessageType::join: out << "join"; break;
-    case MessageType::syscall: out << "syscall"; break;
-    case MessageType::attached_probes: out << "attached_probes"; break;
-    case MessageType::lost_events: out << "lost_events"; break;
-    default: out << "?";
+    case MessageType::map: return "map";
+    case MessageType::hist: return "hist";
+    case MessageType::stats: return "stats";
+    case MessageType::quantiles: return "quantiles";
+    case MessageType::printf: return "printf";
+    case MessageType::time: return "time";
+    case MessageType::cat: return "cat";
+    case MessageType::join: return "join";
+    case MessageType::syscall: return "syscall";
+    case MessageType::attached_probes: return "attached_probes";
+    case MessageType::lost_events: return "lost_events";
+    case MessageType::timings: return "timings";
+    case MessageType::map_delta: return "map_delta";
+    default: return "?";
   }
-  return out;
+}
+
+std::ostream& operator<<(std::ostream& out, MessageType type) {
+  return out << message_type_name(type);
 }
 
 std::string TextOutput::hist_index_label(int power)
@@ -79,6 +95,14 @@ std::string TextOutput::lhist_index_label(int number)
   return label.str();
 }
 
+bool Output::map_value_is_string(const IMap &map)
+{
+  return map.type_.type == Type::kstack || map.type_.type == Type::ustack ||
+         map.type_.type == Type::ksym || map.type_.type == Type::usym ||
+         map.type_.type == Type::inet || map.type_.type == Type::username ||
+         map.type_.type == Type::string || map.type_.type == Type::probe;
+}
+
 void Output::hist_prepare(const std::vector<uint64_t> &values, int &min_index, int &max_index, int &max_value) const
 {
   min_index = -1;
@@ -138,12 +162,20 @@ void Output::lhist_prepare(const std::vector<uint64_t> &values, int min, int max
 void TextOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                      const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &values_by_key) const
 {
+  // Entries are formatted straight into one buffer, which is written out
+  // whenever it fills up
+  std::string buf;
+  buf.reserve(OUTPUT_BUFFER_SIZE);
+  bool newline = map.type_.type != Type::kstack && map.type_.type != Type::ustack &&
+                 map.type_.type != Type::ksym && map.type_.type != Type::usym &&
+                 map.type_.type != Type::inet;
+
   uint32_t i = 0;
   size_t total = values_by_key.size();
   for (auto &pair : values_by_key)
   {
-    auto key = pair.first;
-    auto value = pair.second;
+    auto &key = pair.first;
+    auto &value = pair.second;
 
     if (top)
     {
@@ -151,58 +183,106 @@ void TextOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
         continue;
     }
 
-    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, key) << ": ";
-    out_ << bpftrace.map_value_to_str(map, value, div);
+    buf += map.name_;
+    map.key_.argument_value_list_append(buf, bpftrace, key);
+    buf += ": ";
+    bpftrace.map_value_append(buf, map, value, div);
+    if (newline)
+      buf += '\n';
 
-    if (map.type_.type != Type::kstack && map.type_.type != Type::ustack &&
-        map.type_.type != Type::ksym && map.type_.type != Type::usym &&
-        map.type_.type != Type::inet)
-      out_ << std::endl;
+    if (buf.size() >= OUTPUT_BUFFER_SIZE)
+    {
+      out_.write(buf.data(), buf.size());
+      buf.clear();
+    }
   }
   if (i == 0)
-    out_ << std::endl;
+    buf += '\n';
+  out_.write(buf.data(), buf.size());
+  out_.flush();
+}
+
+namespace {
+
+const int BAR_WIDTH = 52;
+// A bar of n '@'s, padded to BAR_WIDTH, starts at BAR_FILL[BAR_WIDTH - n]
+const std::string BAR_FILL = std::string(BAR_WIDTH, '@') + std::string(BAR_WIDTH, ' ');
+
+// Histograms are rendered on several threads once a map has this many keys
+const size_t MIN_PARALLEL_HISTS = 256;
+const unsigned MAX_RENDER_THREADS = 8;
+// Keys are rendered this many at a time, to bound the memory used
+const size_t HIST_BATCH_SIZE = 4096;
+
+// A bucket's header, e.g. "[4, 8)", padded as std::setw(16) << std::left would
+std::string bucket_header(const std::string &label)
+{
+  std::string header = label;
+  if (header.size() < 16)
+    header.append(16 - header.size(), ' ');
+  return header;
+}
+
+void append_bucket(std::string &buf, const std::string &header, uint64_t count,
+                   int bar_width)
+{
+  buf += header;
+  size_t start = buf.size();
+  str_append_uint(buf, count);
+  size_t len = buf.size() - start;
+  if (len < 8)
+    buf.insert(start, 8 - len, ' ');
+  buf += " |";
+  buf.append(BAR_FILL, BAR_WIDTH - bar_width, BAR_WIDTH);
+  buf += "|\n";
+}
+
+} // namespace
+
+const std::vector<std::string> &TextOutput::hist_headers()
+{
+  static const std::vector<std::string> headers = []() {
+    std::vector<std::string> headers;
+    headers.push_back(bucket_header("(..., 0)"));
+    headers.push_back(bucket_header("[0]"));
+    headers.push_back(bucket_header("[1]"));
+    for (int i = 3; i <= 64; i++)
+      headers.push_back(bucket_header("[" + hist_index_label(i-2) + ", " +
+                                      hist_index_label(i-2+1) + ")"));
+    return headers;
+  }();
+  return headers;
 }
 
-void TextOutput::hist(const std::vector<uint64_t> &values, uint32_t div) const
+std::vector<std::string> TextOutput::lhist_headers(int min, int max, int step)
+{
+  int buckets = (max - min) / step;
+  std::vector<std::string> headers;
+  headers.push_back(bucket_header("(..., " + lhist_index_label(min) + ")"));
+  for (int i = 1; i <= buckets; i++)
+    headers.push_back(bucket_header("[" + lhist_index_label((i - 1) * step + min) +
+                                    ", " + lhist_index_label(i * step + min) + ")"));
+  headers.push_back(bucket_header("[" + lhist_index_label(max) + ", ...)"));
+  return headers;
+}
+
+void TextOutput::hist(std::string &buf, const std::vector<uint64_t> &values, uint32_t div) const
 {
   int min_index, max_index, max_value;
   hist_prepare(values, min_index, max_index, max_value);
   if (max_index == -1)
     return;
 
+  const std::vector<std::string> &headers = hist_headers();
   for (int i = min_index; i <= max_index; i++)
   {
-    std::ostringstream header;
-    if (i == 0)
-    {
-      header << "(..., 0)";
-    }
-    else if (i == 1)
-    {
-      header << "[0]";
-    }
-    else if (i == 2)
-    {
-      header << "[1]";
-    }
-    else
-    {
-      header << "[" << hist_index_label(i-2);
-      header << ", " << hist_index_label(i-2+1) << ")";
-    }
-
-    int max_width = 52;
-    int bar_width = values.at(i)/(float)max_value*max_width;
-    std::string bar(bar_width, '@');
-
-    out_ << std::setw(16) << std::left << header.str()
-         << std::setw(8) << std::right << (values.at(i) / div)
-         << " |" << std::setw(max_width) << std::left << bar << "|"
-         << std::endl;
+    int bar_width = values.at(i)/(float)max_value*BAR_WIDTH;
+    append_bucket(buf, headers.at(i), values.at(i) / div, bar_width);
   }
 }
 
-void TextOutput::lhist(const std::vector<uint64_t> &values, int min, int max, int step) const
+void TextOutput::lhist(std::string &buf, const std::vector<uint64_t> &values, int min, int max, int step,
+                       const std::vector<std::string> &headers) const
 {
   int max_index, max_value, buckets, start_value, end_value;
   lhist_prepare(values, min, max, step, max_index, max_value, buckets, start_value, end_value);
@@ -211,24 +291,8 @@ void TextOutput::lhist(const std::vector<uint64_t> &values, int min, int max, in
 
   for (int i = start_value; i <= end_value; i++)
   {
-    int max_width = 52;
-    int bar_width = values.at(i)/(float)max_value*max_width;
-    std::ostringstream header;
-    if (i == 0) {
-      header << "(..., " << lhist_index_label(min) << ")";
-    } else if (i == (buckets + 1)) {
-      header << "[" << lhist_index_label(max) << ", ...)";
-    } else {
-      header << "[" << lhist_index_label((i - 1) * step + min);
-      header << ", " << lhist_index_label(i * step + min) << ")";
-    }
-
-    std::string bar(bar_width, '@');
-
-    out_ << std::setw(16) << std::left << header.str()
-         << std::setw(8) << std::right << values.at(i)
-         << " |" << std::setw(max_width) << std::left << bar << "|"
-         << std::endl;
+    int bar_width = values.at(i)/(float)max_value*BAR_WIDTH;
+    append_bucket(buf, headers.at(i), values.at(i), bar_width);
   }
 }
 
@@ -236,41 +300,91 @@ void TextOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
                           const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                           const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
 {
-  uint32_t i = 0;
-  for (auto &key_count : total_counts_by_key)
+  std::vector<std::string> headers;
+  if (map.type_.type == Type::lhist)
+    headers = lhist_headers(map.lqmin, map.lqmax, map.lqstep);
+
+  size_t first = 0;
+  if (top && values_by_key.size() > top)
+    first = values_by_key.size() - top;
+
+  // Keys are formatted here, as resolving them isn't thread safe. The
+  // histograms themselves are rendered into one string per key, in
+  // parallel for large maps, and written out in order.
+  std::vector<const std::vector<uint64_t> *> values;
+  std::vector<std::string> rendered;
+  for (size_t batch = first; batch < total_counts_by_key.size(); batch += HIST_BATCH_SIZE)
   {
-    auto &key = key_count.first;
-    auto &value = values_by_key.at(key);
-
-    if (top)
+    size_t count = std::min(HIST_BATCH_SIZE, total_counts_by_key.size() - batch);
+    values.resize(count);
+    rendered.resize(count);
+    for (size_t i = 0; i < count; i++)
     {
-      if (i++ < (values_by_key.size() - top))
-        continue;
+      auto &key = total_counts_by_key[batch + i].first;
+      values[i] = &values_by_key.at(key);
+      rendered[i].clear();
+      rendered[i] += map.name_;
+      map.key_.argument_value_list_append(rendered[i], bpftrace, key);
+      rendered[i] += ": \n";
     }
 
-    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, key) << ": " << std::endl;
-
-    if (map.type_.type == Type::hist)
-      hist(value, div);
-    else
-      lhist(value, map.lqmin, map.lqmax, map.lqstep);
-
-    out_ << std::endl;
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+      for (size_t i = next++; i < count; i = next++)
+      {
+        if (map.type_.type == Type::hist)
+          hist(rendered[i], *values[i], div);
+        else
+          lhist(rendered[i], *values[i], map.lqmin, map.lqmax, map.lqstep, headers);
+        rendered[i] += '\n';
+      }
+    };
+
+    size_t num_threads = 1;
+    if (count >= MIN_PARALLEL_HISTS)
+      num_threads = std::min<size_t>(
+          { count / (MIN_PARALLEL_HISTS / 2),
+            std::max(std::thread::hardware_concurrency(), 1U),
+            MAX_RENDER_THREADS });
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++)
+      threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+      thread.join();
+
+    std::string buf;
+    for (auto &str : rendered)
+    {
+      buf += str;
+      if (buf.size() >= OUTPUT_BUFFER_SIZE)
+      {
+        out_.write(buf.data(), buf.size());
+        buf.clear();
+      }
+    }
+    out_.write(buf.data(), buf.size());
   }
+  out_.flush();
 }
 
-void TextOutput::map_stats(BPFtrace &bpftrace, IMap &map,
+void TextOutput::map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                            const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
                            const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const
 {
-  for (auto &key_count : total_counts_by_key)
+  size_t skip = 0;
+  if (top && total_counts_by_key.size() > top)
+    skip = total_counts_by_key.size() - top;
+
+  for (size_t i = skip; i < total_counts_by_key.size(); i++)
   {
-    auto &key = key_count.first;
+    auto &key = total_counts_by_key[i].first;
     auto &value = values_by_key.at(key);
     out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, key) << ": ";
 
     int64_t count = (int64_t)value.at(0);
-    int64_t total = value.at(1);
+    int64_t total = value.at(1) / static_cast<int64_t>(div);
     int64_t average = 0;
 
     if (count != 0)
@@ -285,6 +399,32 @@ void TextOutput::map_stats(BPFtrace &bpftrace, IMap &map,
   out_ << std::endl;
 }
 
+void TextOutput::map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                               const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                               const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
+{
+  uint32_t i = 0;
+  for (auto &key_count : total_counts_by_key)
+  {
+    auto &key = key_count.first;
+    auto &value = values_by_key.at(key);
+
+    if (top)
+    {
+      if (i++ < (values_by_key.size() - top))
+        continue;
+    }
+
+    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, key) << ": ";
+    out_ << "count " << value.at(0);
+    for (size_t j = 0; j < QUANTILES.size(); j++)
+      out_ << ", " << QUANTILES.at(j).first << " " << value.at(j + 1) / div;
+    out_ << std::endl;
+  }
+
+  out_ << std::endl;
+}
+
 void TextOutput::message(MessageType type __attribute__((unused)), const std::string& msg, bool nl) const
 {
   out_ << msg;
@@ -305,42 +445,186 @@ void TextOutput::attached_probes(uint64_t num_probes) const
     out_ << "Attaching " << num_probes << " probes..." << std::endl;
 }
 
-std::string JsonOutput::json_escape(const std::string &str) const
+void TextOutput::map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                           const std::vector<MapValueChange> &changed,
+                           const std::vector<std::vector<uint8_t>> &removed) const
+{
+  bool counter = map.type_.type == Type::count || map.type_.type == Type::sum;
+  for (auto &change : changed)
+  {
+    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, change.key) << ": ";
+    if (!counter)
+      out_ << bpftrace.map_value_to_str(map, change.value, div);
+    else if (change.diff >= 0)
+      out_ << "+" << change.diff;
+    else
+      out_ << change.diff;
+
+    if (map.type_.type != Type::kstack && map.type_.type != Type::ustack &&
+        map.type_.type != Type::ksym && map.type_.type != Type::usym &&
+        map.type_.type != Type::inet)
+      out_ << std::endl;
+  }
+  for (auto &key : removed)
+    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, key) << ": (removed)" << std::endl;
+  out_ << std::endl;
+}
+
+void TextOutput::timings(const std::vector<TimedPhase> &phases) const
+{
+  auto precision = out_.precision();
+  out_ << std::endl << std::left << std::setw(32) << "Phase" << std::right
+       << std::setw(12) << "Time (ms)" << std::setw(16) << "Peak RSS (KB)"
+       << std::endl;
+  for (auto &phase : phases)
+  {
+    std::string name = std::string(2 * phase.depth, ' ') + phase.name;
+    if (phase.count > 1)
+      name += " (x" + std::to_string(phase.count) + ")";
+    out_ << std::left << std::setw(32) << name << std::right << std::fixed
+         << std::setprecision(2) << std::setw(12) << phase.elapsed_ms
+         << std::setw(16) << phase.peak_rss_kb << std::endl;
+  }
+  out_ << std::defaultfloat << std::setprecision(precision) << std::endl;
+}
+
+namespace {
+
+// Returns true if str holds a quote, a backslash or a control character.
+// Checks eight bytes at a time, so the common case of a clean string is
+// copied into the buffer in one go.
+bool json_needs_escape(const std::string &str)
+{
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  const char *data = str.data();
+  size_t len = str.size();
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    uint64_t quote = word ^ (ones * '"');
+    uint64_t backslash = word ^ (ones * '\\');
+    // The high bit of a byte is set if it is < 0x20, or if it was zeroed by
+    // the xor with '"' or '\\'
+    uint64_t found = ((word - ones * 0x20) & ~word) |
+                     ((quote - ones) & ~quote) |
+                     ((backslash - ones) & ~backslash);
+    if (found & highs)
+      return true;
+  }
+  for (; i < len; i++)
+  {
+    char c = data[i];
+    if (c == '"' || c == '\\' || ('\x00' <= c && c <= '\x1f'))
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+JsonOutput::JsonOutput(std::ostream& out, std::ostream& err, bool batch)
+  : Output(out, err), batch_(batch)
 {
-  std::ostringstream escaped;
+  buf_.reserve(OUTPUT_BUFFER_SIZE);
+}
+
+JsonOutput::~JsonOutput()
+{
+  flush_buffer();
+}
+
+void JsonOutput::append_string(const std::string &str) const
+{
+  buf_ += '"';
+  if (!json_needs_escape(str))
+  {
+    buf_ += str;
+    buf_ += '"';
+    return;
+  }
+
   for (const char &c : str)
   {
     switch (c)
     {
       case '"':
-        escaped << "\\\"";
+        buf_ += "\\\"";
         break;
 
       case '\\':
-        escaped << "\\\\";
+        buf_ += "\\\\";
         break;
 
       case '\n':
-        escaped << "\\n";
+        buf_ += "\\n";
         break;
 
       case '\r':
-        escaped << "\\r";
+        buf_ += "\\r";
         break;
 
       case '\t':
-        escaped << "\\t";
+        buf_ += "\\t";
         break;
 
       default:
         if ('\x00' <= c && c <= '\x1f') {
-          escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+          static const char hex[] = "0123456789abcdef";
+          buf_ += "\\u00";
+          buf_ += hex[c >> 4];
+          buf_ += hex[c & 0xf];
         } else {
-          escaped << c;
+          buf_ += c;
         }
     }
   }
-  return escaped.str();
+  buf_ += '"';
+}
+
+void JsonOutput::append_uint(uint64_t value) const
+{
+  str_append_uint(buf_, value);
+}
+
+void JsonOutput::append_int(int64_t value) const
+{
+  str_append_int(buf_, value);
+}
+
+void JsonOutput::append_double(double value) const
+{
+  // Matches the default formatting of std::ostream
+  char str[32];
+  int len = snprintf(str, sizeof(str), "%g", value);
+  buf_.append(str, len);
+}
+
+void JsonOutput::begin_record(MessageType type) const
+{
+  buf_ += "{\"type\": \"";
+  buf_ += message_type_name(type);
+  buf_ += "\", \"data\": ";
+}
+
+void JsonOutput::end_record() const
+{
+  buf_ += '\n';
+  if (!batch_ || buf_.size() >= OUTPUT_BUFFER_SIZE)
+    flush_buffer();
+}
+
+void JsonOutput::flush_buffer() const
+{
+  if (buf_.empty())
+    return;
+  out_.write(buf_.data(), buf_.size());
+  if (!batch_)
+    out_.flush();
+  buf_.clear();
 }
 
 void JsonOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
@@ -349,18 +633,20 @@ void JsonOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
   if (values_by_key.empty())
     return;
 
-  out_ << "{\"type\": \"" << MessageType::map << "\", \"data\": {";
-  out_ << "\"" << json_escape(map.name_) << "\": ";
+  begin_record(MessageType::map);
+  buf_ += "{";
+  append_string(map.name_);
+  buf_ += ": ";
   if (map.key_.size() > 0) // check if this map has keys
-    out_ << "{";
+    buf_ += "{";
 
   uint32_t i = 0;
   uint32_t j = 0;
   size_t total = values_by_key.size();
   for (auto &pair : values_by_key)
   {
-    auto key = pair.first;
-    auto value = pair.second;
+    auto &key = pair.first;
+    auto &value = pair.second;
 
     if (top)
     {
@@ -370,26 +656,26 @@ void JsonOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
 
     std::vector<std::string> args = map.key_.argument_value_list(bpftrace, key);
     if (i > 0)
-      out_ << ", ";
+      buf_ += ", ";
     if (args.size() > 0) {
-      out_ << "\"" << json_escape(str_join(args, ",")) << "\": ";
+      append_string(str_join(args, ","));
+      buf_ += ": ";
     }
 
-    if (map.type_.type == Type::kstack || map.type_.type == Type::ustack || map.type_.type == Type::ksym ||
-        map.type_.type == Type::usym || map.type_.type == Type::inet || map.type_.type == Type::username ||
-        map.type_.type == Type::string || map.type_.type == Type::probe) {
-        out_ << "\"" << json_escape(bpftrace.map_value_to_str(map, value, div)) << "\"";
+    if (map_value_is_string(map)) {
+        append_string(bpftrace.map_value_to_str(map, value, div));
     }
     else {
-      out_ << bpftrace.map_value_to_str(map, value, div);
+      bpftrace.map_value_append(buf_, map, value, div);
     }
 
     i++;
   }
 
   if (map.key_.size() > 0)
-    out_ << "}";
-  out_ << "}}" << std::endl;
+    buf_ += "}";
+  buf_ += "}}";
+  end_record();
 }
 
 void JsonOutput::hist(const std::vector<uint64_t> &values, uint32_t div) const
@@ -399,35 +685,40 @@ void JsonOutput::hist(const std::vector<uint64_t> &values, uint32_t div) const
   if (max_index == -1)
     return;
 
-  out_ << "[";
+  buf_ += "[";
   for (int i = min_index; i <= max_index; i++)
   {
     if (i > min_index)
-      out_ << ", ";
+      buf_ += ", ";
 
-    out_ << "{";
+    buf_ += "{";
     if (i == 0)
     {
-      out_ << "\"max\": -1, ";
+      buf_ += "\"max\": -1, ";
     }
     else if (i == 1)
     {
-      out_ << "\"min\": 0, \"max\": 0, ";
+      buf_ += "\"min\": 0, \"max\": 0, ";
     }
     else if (i == 2)
     {
-      out_ << "\"min\": 1, \"max\": 1, ";
+      buf_ += "\"min\": 1, \"max\": 1, ";
     }
     else
     {
       long low = 1 << (i-2);
       long high = (1 << (i-2+1)) - 1;
-      out_ << "\"min\": " << low << ", \"max\": " << high << ", ";
+      buf_ += "\"min\": ";
+      append_int(low);
+      buf_ += ", \"max\": ";
+      append_int(high);
+      buf_ += ", ";
     }
-    out_ << "\"count\": " << values.at(i) / div;
-    out_ << "}";
+    buf_ += "\"count\": ";
+    append_uint(values.at(i) / div);
+    buf_ += "}";
   }
-  out_ << "]";
+  buf_ += "]";
 }
 
 void JsonOutput::lhist(const std::vector<uint64_t> &values, int min, int max, int step) const
@@ -437,27 +728,35 @@ void JsonOutput::lhist(const std::vector<uint64_t> &values, int min, int max, in
   if (max_index == -1)
     return;
 
-  out_ << "[";
+  buf_ += "[";
   for (int i = start_value; i <= end_value; i++)
   {
     if (i > start_value)
-      out_ << ", ";
+      buf_ += ", ";
 
-    out_ << "{";
+    buf_ += "{";
     if (i == 0) {
-      out_ << "\"max\": " << min - 1 << ", ";
-
+      buf_ += "\"max\": ";
+      append_int(min - 1);
+      buf_ += ", ";
     } else if (i == (buckets + 1)) {
-      out_ << "\"min\": " << max << ", ";
+      buf_ += "\"min\": ";
+      append_int(max);
+      buf_ += ", ";
     } else {
       long low = (i - 1) * step + min;
       long high = i * step + min - 1;
-      out_ << "\"min\": " << low << ", \"max\": " << high << ", ";
+      buf_ += "\"min\": ";
+      append_int(low);
+      buf_ += ", \"max\": ";
+      append_int(high);
+      buf_ += ", ";
     }
-    out_ << "\"count\": " << values.at(i);
-    out_ << "}";
+    buf_ += "\"count\": ";
+    append_uint(values.at(i));
+    buf_ += "}";
   }
-  out_ << "]";
+  buf_ += "]";
 }
 
 void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
@@ -467,10 +766,12 @@ void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
   if (total_counts_by_key.empty())
     return;
 
-  out_ << "{\"type\": \"" << MessageType::hist << "\", \"data\": {";
-  out_ << "\"" << json_escape(map.name_) << "\": ";
+  begin_record(MessageType::hist);
+  buf_ += "{";
+  append_string(map.name_);
+  buf_ += ": ";
   if (map.key_.size() > 0) // check if this map has keys
-    out_ << "{";
+    buf_ += "{";
 
   uint32_t i = 0;
   uint32_t j = 0;
@@ -487,9 +788,10 @@ void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
 
     std::vector<std::string> args = map.key_.argument_value_list(bpftrace, key);
     if (i > 0)
-      out_ << ", ";
+      buf_ += ", ";
     if (args.size() > 0) {
-      out_ << "\"" << json_escape(str_join(args, ",")) << "\": ";
+      append_string(str_join(args, ","));
+      buf_ += ": ";
     }
 
     if (map.type_.type == Type::hist)
@@ -501,64 +803,175 @@ void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
   }
 
   if (map.key_.size() > 0)
-    out_ << "}";
-  out_ << "}}" << std::endl;
+    buf_ += "}";
+  buf_ += "}}";
+  end_record();
 }
 
-void JsonOutput::map_stats(BPFtrace &bpftrace, IMap &map,
+void JsonOutput::map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                            const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
                            const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const
 {
   if (total_counts_by_key.empty())
     return;
 
-  out_ << "{\"type\": \"" << MessageType::stats << "\", \"data\": {";
-  out_ << "\"" << json_escape(map.name_) << "\": ";
+  begin_record(MessageType::stats);
+  buf_ += "{";
+  append_string(map.name_);
+  buf_ += ": ";
   if (map.key_.size() > 0) // check if this map has keys
-    out_ << "{";
+    buf_ += "{";
 
-  uint32_t i = 0;
-  for (auto &key_count : total_counts_by_key)
+  size_t skip = 0;
+  if (top && total_counts_by_key.size() > top)
+    skip = total_counts_by_key.size() - top;
+
+  for (size_t i = skip; i < total_counts_by_key.size(); i++)
   {
-    auto &key = key_count.first;
+    auto &key = total_counts_by_key[i].first;
     auto &value = values_by_key.at(key);
 
     std::vector<std::string> args = map.key_.argument_value_list(bpftrace, key);
-    if (i > 0)
-      out_ << ", ";
+    if (i > skip)
+      buf_ += ", ";
     if (args.size() > 0) {
-      out_ << "    \"" << json_escape(str_join(args, ",")) << "\": ";
+      buf_ += "    ";
+      append_string(str_join(args, ","));
+      buf_ += ": ";
     }
 
     uint64_t count = value.at(0);
-    int64_t total = value.at(1);
+    int64_t total = value.at(1) / static_cast<int64_t>(div);
     int64_t average = 0;
 
     if (count != 0)
-      average = total / count;
+      average = total / static_cast<int64_t>(count);
 
     if (map.type_.type == Type::stats)
-      out_ << "{\"count\": " << count << ", \"average\": " <<  average << ", \"total\": " << total << "}";
+    {
+      buf_ += "{\"count\": ";
+      append_uint(count);
+      buf_ += ", \"average\": ";
+      append_int(average);
+      buf_ += ", \"total\": ";
+      append_int(total);
+      buf_ += "}";
+    }
     else
-      out_ << average;
+      append_int(average);
+  }
+
+  if (map.key_.size() > 0)
+    buf_ += "}";
+  buf_ += "}}";
+  end_record();
+}
+
+void JsonOutput::map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                               const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                               const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
+{
+  if (total_counts_by_key.empty())
+    return;
+
+  begin_record(MessageType::quantiles);
+  buf_ += "{";
+  append_string(map.name_);
+  buf_ += ": ";
+  if (map.key_.size() > 0) // check if this map has keys
+    buf_ += "{";
+
+  uint32_t i = 0;
+  uint32_t j = 0;
+  for (auto &key_count : total_counts_by_key)
+  {
+    auto &key = key_count.first;
+    auto &value = values_by_key.at(key);
+
+    if (top)
+    {
+      if (j++ < (values_by_key.size() - top))
+        continue;
+    }
+
+    std::vector<std::string> args = map.key_.argument_value_list(bpftrace, key);
+    if (i > 0)
+      buf_ += ", ";
+    if (args.size() > 0) {
+      append_string(str_join(args, ","));
+      buf_ += ": ";
+    }
+
+    buf_ += "{\"count\": ";
+    append_uint(value.at(0));
+    for (size_t k = 0; k < QUANTILES.size(); k++)
+    {
+      buf_ += ", \"";
+      buf_ += QUANTILES.at(k).first;
+      buf_ += "\": ";
+      append_uint(value.at(k + 1) / div);
+    }
+    buf_ += "}";
 
     i++;
   }
 
   if (map.key_.size() > 0)
-    out_ << "}";
-  out_ << "}}" << std::endl;
+    buf_ += "}";
+  buf_ += "}}";
+  end_record();
+}
+
+void JsonOutput::map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                           const std::vector<MapValueChange> &changed,
+                           const std::vector<std::vector<uint8_t>> &removed) const
+{
+  begin_record(MessageType::map_delta);
+  buf_ += "{";
+  append_string(map.name_);
+  buf_ += ": {\"changed\": {";
+  bool counter = map.type_.type == Type::count || map.type_.type == Type::sum;
+  for (size_t i = 0; i < changed.size(); i++)
+  {
+    if (i > 0)
+      buf_ += ", ";
+    append_string(str_join(map.key_.argument_value_list(bpftrace, changed[i].key), ","));
+    buf_ += ": ";
+    if (counter)
+      append_int(changed[i].diff);
+    else if (map_value_is_string(map))
+      append_string(bpftrace.map_value_to_str(map, changed[i].value, div));
+    else
+      buf_ += bpftrace.map_value_to_str(map, changed[i].value, div);
+  }
+  buf_ += "}, \"removed\": [";
+  for (size_t i = 0; i < removed.size(); i++)
+  {
+    if (i > 0)
+      buf_ += ", ";
+    append_string(str_join(map.key_.argument_value_list(bpftrace, removed[i]), ","));
+  }
+  buf_ += "]}}}";
+  end_record();
 }
 
 void JsonOutput::message(MessageType type, const std::string& msg, bool nl __attribute__((unused))) const
 {
-  out_ << "{\"type\": \"" << type << "\", \"data\": \"" << json_escape(msg) << "\"}" << std::endl;
+  begin_record(type);
+  append_string(msg);
+  buf_ += "}";
+  end_record();
 }
 
 void JsonOutput::message(MessageType type, const std::string& field, uint64_t value) const
 {
-  out_ << "{\"type\": \"" << type << "\", \"data\": " <<  "{\"" << field
-       << "\": " << value << "}" << "}" << std::endl;
+  begin_record(type);
+  buf_ += "{";
+  append_string(field);
+  buf_ += ": ";
+  append_uint(value);
+  buf_ += "}}";
+  end_record();
 }
 
 void JsonOutput::lost_events(uint64_t lost) const
@@ -571,4 +984,405 @@ void JsonOutput::attached_probes(uint64_t num_probes) const
   message(MessageType::attached_probes, "probes", num_probes);
 }
 
+void JsonOutput::timings(const std::vector<TimedPhase> &phases) const
+{
+  begin_record(MessageType::timings);
+  buf_ += "[";
+  for (size_t i = 0; i < phases.size(); i++)
+  {
+    auto &phase = phases[i];
+    if (i > 0)
+      buf_ += ", ";
+    buf_ += "{\"phase\": ";
+    append_string(phase.name);
+    buf_ += ", \"depth\": ";
+    append_int(phase.depth);
+    buf_ += ", \"count\": ";
+    append_uint(phase.count);
+    buf_ += ", \"ms\": ";
+    append_double(phase.elapsed_ms);
+    buf_ += ", \"peak_rss_kb\": ";
+    append_int(phase.peak_rss_kb);
+    buf_ += "}";
+  }
+  buf_ += "]}";
+  end_record();
+}
+
+BinaryOutput::BinaryOutput(std::ostream& out, std::ostream& err, bool batch)
+  : Output(out, err), batch_(batch)
+{
+  buf_.reserve(OUTPUT_BUFFER_SIZE);
+  buf_ += "BPFTRACE";
+  put_u32(buf_, 1); // format version
+}
+
+BinaryOutput::~BinaryOutput()
+{
+  out_.write(buf_.data(), buf_.size());
+  out_.flush();
+}
+
+uint32_t BinaryOutput::Dictionary::add(const std::string &str)
+{
+  auto inserted = index_.emplace(str, strings_.size());
+  if (inserted.second)
+    strings_.push_back(&inserted.first->first);
+  return inserted.first->second;
+}
+
+void BinaryOutput::Dictionary::write(std::string &out) const
+{
+  put_u32(out, strings_.size());
+  for (auto str : strings_)
+    put_string(out, *str);
+}
+
+// Integers are little-endian whatever the host, so dumps can be read on
+// another machine
+void BinaryOutput::put_u8(std::string &out, uint8_t value)
+{
+  out += static_cast<char>(value);
+}
+
+void BinaryOutput::put_u32(std::string &out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+    out += static_cast<char>(value >> (8 * i));
+}
+
+void BinaryOutput::put_u64(std::string &out, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+    out += static_cast<char>(value >> (8 * i));
+}
+
+void BinaryOutput::put_string(std::string &out, const std::string &str)
+{
+  put_u32(out, str.size());
+  out += str;
+}
+
+std::vector<BinaryOutput::Column> BinaryOutput::key_columns(
+    BPFtrace &bpftrace,
+    IMap &map,
+    const std::vector<const std::vector<uint8_t> *> &keys,
+    Dictionary &dict)
+{
+  std::vector<Column> columns;
+  size_t offset = 0;
+  for (size_t i = 0; i < map.key_.args_.size(); i++)
+  {
+    const SizedType &arg = map.key_.args_[i];
+    Column column;
+    column.name = "key" + std::to_string(i);
+    if (arg.type == Type::integer)
+      column.type = arg.is_signed ? ColumnType::int64 : ColumnType::uint64;
+    else if (arg.type == Type::cast && arg.is_pointer)
+      column.type = ColumnType::uint64;
+    else
+      column.type = ColumnType::string;
+
+    for (auto key : keys)
+    {
+      const uint8_t *data = key->data() + offset;
+      if (column.type == ColumnType::string)
+      {
+        put_u32(column.data, dict.add(MapKey::argument_value(bpftrace, arg, data)));
+        continue;
+      }
+
+      // Sign or zero extended to 64 bits
+      uint64_t value;
+      switch (arg.size)
+      {
+        case 1:
+          value = arg.is_signed ? static_cast<int64_t>(*(const int8_t*)data)
+                                : *(const uint8_t*)data;
+          break;
+        case 2:
+          value = arg.is_signed ? static_cast<int64_t>(*(const int16_t*)data)
+                                : *(const uint16_t*)data;
+          break;
+        case 4:
+          value = arg.is_signed ? static_cast<int64_t>(*(const int32_t*)data)
+                                : *(const uint32_t*)data;
+          break;
+        default:
+          value = *(const uint64_t*)data;
+          break;
+      }
+      put_u64(column.data, value);
+    }
+    columns.push_back(std::move(column));
+    offset += arg.size;
+  }
+  return columns;
+}
+
+BinaryOutput::ColumnType BinaryOutput::value_column_type(IMap &map)
+{
+  if (map_value_is_string(map))
+    return ColumnType::string;
+  if (map.type_.type == Type::count || map.type_.type == Type::max ||
+      map.type_.type == Type::topk || map.type_.type == Type::hll ||
+      ((map.type_.type == Type::sum || map.type_.type == Type::integer) &&
+       !map.type_.is_signed))
+    return ColumnType::uint64;
+  return ColumnType::int64;
+}
+
+std::string BinaryOutput::map_record(IMap &map, size_t rows, const Dictionary &dict,
+                                     const std::vector<Column> &columns,
+                                     const std::string &header)
+{
+  std::string payload;
+  put_string(payload, map.name_);
+  payload += header;
+  put_u32(payload, rows);
+  dict.write(payload);
+  put_u8(payload, columns.size());
+  for (auto &column : columns)
+  {
+    put_string(payload, column.name);
+    put_u8(payload, static_cast<uint8_t>(column.type));
+    payload += column.data;
+  }
+  return payload;
+}
+
+void BinaryOutput::write_record(MessageType type, const std::string &payload) const
+{
+  put_u8(buf_, static_cast<uint8_t>(type));
+  put_u32(buf_, payload.size());
+  buf_ += payload;
+  if (batch_ && buf_.size() < OUTPUT_BUFFER_SIZE)
+    return;
+
+  out_.write(buf_.data(), buf_.size());
+  if (!batch_)
+    out_.flush();
+  buf_.clear();
+}
+
+void BinaryOutput::map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                       const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &values_by_key) const
+{
+  if (values_by_key.empty())
+    return;
+
+  size_t skip = 0;
+  if (top && values_by_key.size() > top)
+    skip = values_by_key.size() - top;
+
+  std::vector<const std::vector<uint8_t> *> keys;
+  for (size_t i = skip; i < values_by_key.size(); i++)
+    keys.push_back(&values_by_key[i].first);
+
+  Dictionary dict;
+  auto columns = key_columns(bpftrace, map, keys, dict);
+
+  Column value{ "value", value_column_type(map), "" };
+
+  for (size_t i = skip; i < values_by_key.size(); i++)
+  {
+    auto &bytes = values_by_key[i].second;
+    if (value.type == ColumnType::string)
+      put_u32(value.data, dict.add(bpftrace.map_value_to_str(map, bytes, div)));
+    else
+      put_u64(value.data, bpftrace.map_value_to_int(map, bytes, div));
+  }
+  columns.push_back(std::move(value));
+
+  write_record(MessageType::map, map_record(map, keys.size(), dict, columns));
+}
+
+void BinaryOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                            const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                            const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
+{
+  if (total_counts_by_key.empty())
+    return;
+
+  size_t skip = 0;
+  if (top && total_counts_by_key.size() > top)
+    skip = total_counts_by_key.size() - top;
+
+  std::vector<const std::vector<uint8_t> *> keys;
+  for (size_t i = skip; i < total_counts_by_key.size(); i++)
+    keys.push_back(&total_counts_by_key[i].first);
+
+  Dictionary dict;
+  auto columns = key_columns(bpftrace, map, keys, dict);
+
+  // Every bucket is written: bucket 0 counts negative values and bucket i
+  // counts [2^(i-2), 2^(i-1)) for hist(). For lhist(), bucket 0 counts
+  // values below min, the last bucket values from max, and bucket i
+  // [min + (i-1)*step, min + i*step).
+  Column buckets{ "buckets", ColumnType::uint64_list, "" };
+  for (auto key : keys)
+  {
+    auto &values = values_by_key.at(*key);
+    put_u32(buckets.data, values.size());
+    for (uint64_t count : values)
+      put_u64(buckets.data, map.type_.type == Type::hist ? count / div : count);
+  }
+  columns.push_back(std::move(buckets));
+
+  std::string header;
+  put_u8(header, map.type_.type == Type::hist ? 0 : 1);
+  put_u64(header, map.lqmin);
+  put_u64(header, map.lqmax);
+  put_u64(header, map.lqstep);
+
+  write_record(MessageType::hist, map_record(map, keys.size(), dict, columns, header));
+}
+
+void BinaryOutput::map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                             const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
+                             const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const
+{
+  if (total_counts_by_key.empty())
+    return;
+
+  size_t skip = 0;
+  if (top && total_counts_by_key.size() > top)
+    skip = total_counts_by_key.size() - top;
+
+  std::vector<const std::vector<uint8_t> *> keys;
+  for (size_t i = skip; i < total_counts_by_key.size(); i++)
+    keys.push_back(&total_counts_by_key[i].first);
+
+  Dictionary dict;
+  auto columns = key_columns(bpftrace, map, keys, dict);
+
+  Column count{ "count", ColumnType::uint64, "" };
+  Column average{ "average", ColumnType::int64, "" };
+  Column total{ "total", ColumnType::int64, "" };
+  for (auto key : keys)
+  {
+    auto &value = values_by_key.at(*key);
+    uint64_t n = value.at(0);
+    int64_t sum = value.at(1) / static_cast<int64_t>(div);
+    put_u64(count.data, n);
+    put_u64(average.data, n ? sum / static_cast<int64_t>(n) : 0);
+    put_u64(total.data, sum);
+  }
+  columns.push_back(std::move(count));
+  columns.push_back(std::move(average));
+  columns.push_back(std::move(total));
+
+  write_record(MessageType::stats, map_record(map, keys.size(), dict, columns));
+}
+
+void BinaryOutput::map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                                 const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                                 const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
+{
+  if (total_counts_by_key.empty())
+    return;
+
+  size_t skip = 0;
+  if (top && total_counts_by_key.size() > top)
+    skip = total_counts_by_key.size() - top;
+
+  std::vector<const std::vector<uint8_t> *> keys;
+  for (size_t i = skip; i < total_counts_by_key.size(); i++)
+    keys.push_back(&total_counts_by_key[i].first);
+
+  Dictionary dict;
+  auto columns = key_columns(bpftrace, map, keys, dict);
+
+  std::vector<Column> values;
+  values.push_back({ "count", ColumnType::uint64, "" });
+  for (auto &quantile : QUANTILES)
+    values.push_back({ quantile.first, ColumnType::uint64, "" });
+  for (auto key : keys)
+  {
+    auto &value = values_by_key.at(*key);
+    put_u64(values[0].data, value.at(0));
+    for (size_t k = 1; k < values.size(); k++)
+      put_u64(values[k].data, value.at(k) / div);
+  }
+  for (auto &column : values)
+    columns.push_back(std::move(column));
+
+  write_record(MessageType::quantiles, map_record(map, keys.size(), dict, columns));
+}
+
+void BinaryOutput::map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                             const std::vector<MapValueChange> &changed,
+                             const std::vector<std::vector<uint8_t>> &removed) const
+{
+  std::vector<const std::vector<uint8_t> *> keys;
+  for (auto &change : changed)
+    keys.push_back(&change.key);
+  for (auto &key : removed)
+    keys.push_back(&key);
+
+  Dictionary dict;
+  auto columns = key_columns(bpftrace, map, keys, dict);
+
+  // count() and sum() maps have the (signed) difference since the last
+  // print, other maps their new value. Removed keys have a zero, or empty,
+  // value
+  bool counter = map.type_.type == Type::count || map.type_.type == Type::sum;
+  Column value{ "value", counter ? ColumnType::int64 : value_column_type(map), "" };
+  Column is_removed{ "removed", ColumnType::uint64, "" };
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    bool row_removed = i >= changed.size();
+    if (value.type == ColumnType::string)
+      put_u32(value.data, dict.add(row_removed ? "" : bpftrace.map_value_to_str(map, changed[i].value, div)));
+    else if (row_removed)
+      put_u64(value.data, 0);
+    else if (counter)
+      put_u64(value.data, changed[i].diff);
+    else
+      put_u64(value.data, bpftrace.map_value_to_int(map, changed[i].value, div));
+    put_u64(is_removed.data, row_removed);
+  }
+  columns.push_back(std::move(value));
+  columns.push_back(std::move(is_removed));
+
+  write_record(MessageType::map_delta, map_record(map, keys.size(), dict, columns));
+}
+
+void BinaryOutput::message(MessageType type, const std::string& msg, bool nl __attribute__((unused))) const
+{
+  std::string payload;
+  put_string(payload, msg);
+  write_record(type, payload);
+}
+
+void BinaryOutput::lost_events(uint64_t lost) const
+{
+  std::string payload;
+  put_u64(payload, lost);
+  write_record(MessageType::lost_events, payload);
+}
+
+void BinaryOutput::attached_probes(uint64_t num_probes) const
+{
+  std::string payload;
+  put_u64(payload, num_probes);
+  write_record(MessageType::attached_probes, payload);
+}
+
+void BinaryOutput::timings(const std::vector<TimedPhase> &phases) const
+{
+  std::string payload;
+  put_u32(payload, phases.size());
+  for (auto &phase : phases)
+  {
+    uint64_t elapsed_us = phase.elapsed_ms * 1000;
+    put_string(payload, phase.name);
+    put_u32(payload, phase.depth);
+    put_u64(payload, phase.count);
+    put_u64(payload, elapsed_us);
+    put_u64(payload, phase.peak_rss_kb);
+  }
+  write_record(MessageType::timings, payload);
+}
+
 } // namespace bpftrace
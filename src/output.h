@@ -4,28 +4,44 @@
 #include <iomanip>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "imap.h"
+#include "timings.h"
 
 namespace bpftrace {
 
 enum class MessageType
 {
-  // don't forget to update std::ostream& operator<<(std::ostream& out, MessageType type) in output.cpp
+  // don't forget to update message_type_name() in output.cpp. -f binary
+  // writes these values, so only append to the list
   map,
   hist,
   stats,
+  quantiles,
   printf,
   time,
   cat,
   join,
   syscall,
   attached_probes,
-  lost_events
+  lost_events,
+  timings,
+  map_delta
 };
 
+const char *message_type_name(MessageType type);
 std::ostream& operator<<(std::ostream& out, MessageType type);
 
+// A map entry which changed since the map was last printed
+struct MapValueChange
+{
+  std::vector<uint8_t> key;
+  std::vector<uint8_t> value;
+  // The difference from the last printed value, for count() and sum() maps
+  int64_t diff;
+};
+
 class Output
 {
 public:
@@ -41,17 +57,30 @@ public:
   virtual void map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                         const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                         const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const = 0;
-  virtual void map_stats(BPFtrace &bpftrace, IMap &map,
+  virtual void map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                          const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
                          const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const = 0;
+  // values_by_key holds the count followed by the value of each of QUANTILES
+  virtual void map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                             const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                             const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const = 0;
+  // The entries which changed since the map was last printed, and the keys
+  // which were removed
+  virtual void map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                         const std::vector<MapValueChange> &changed,
+                         const std::vector<std::vector<uint8_t>> &removed) const = 0;
 
   virtual void message(MessageType type, const std::string& msg, bool nl = true) const = 0;
   virtual void lost_events(uint64_t lost) const = 0;
   virtual void attached_probes(uint64_t num_probes) const = 0;
+  virtual void timings(const std::vector<TimedPhase> &phases) const = 0;
 
 protected:
   std::ostream &out_;
   std::ostream &err_;
+  // Map values which are printed as strings (stacks, symbols, ...) rather
+  // than numbers
+  static bool map_value_is_string(const IMap &map);
   void hist_prepare(const std::vector<uint64_t> &values, int &min_index, int &max_index, int &max_value) const;
   void lhist_prepare(const std::vector<uint64_t> &values, int min, int max, int step, int &max_index, int &max_value, int &buckets, int &start_value, int &end_value) const;
 };
@@ -65,44 +94,154 @@ public:
   void map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                 const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                 const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
-  void map_stats(BPFtrace &bpftrace, IMap &map,
+  void map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                  const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
                  const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const override;
+  void map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                     const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                     const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
+  void map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                 const std::vector<MapValueChange> &changed,
+                 const std::vector<std::vector<uint8_t>> &removed) const override;
 
   void message(MessageType type, const std::string& msg, bool nl = true) const override;
   void lost_events(uint64_t lost) const override;
   void attached_probes(uint64_t num_probes) const override;
+  void timings(const std::vector<TimedPhase> &phases) const override;
 
 private:
   static std::string hist_index_label(int power);
   static std::string lhist_index_label(int number);
-  void hist(const std::vector<uint64_t> &values, uint32_t div) const;
-  void lhist(const std::vector<uint64_t> &values, int min, int max, int step) const;
+  // The padded header of each bucket, by index into the values of hist()
+  // and lhist()
+  static const std::vector<std::string> &hist_headers();
+  static std::vector<std::string> lhist_headers(int min, int max, int step);
+  // Appends the histogram to buf. These are called from several threads
+  // at once by map_hist().
+  void hist(std::string &buf, const std::vector<uint64_t> &values, uint32_t div) const;
+  void lhist(std::string &buf, const std::vector<uint64_t> &values, int min, int max, int step,
+             const std::vector<std::string> &headers) const;
 };
 
 class JsonOutput : public Output {
 public:
-  explicit JsonOutput(std::ostream& out = std::cout, std::ostream& err = std::cerr) : Output(out, err) { }
+  // Each record is built in a reusable buffer and written to the stream in
+  // one go. With batch set (-B full), records are collected until the
+  // buffer fills instead of being flushed one line at a time.
+  explicit JsonOutput(std::ostream& out = std::cout, std::ostream& err = std::cerr, bool batch = false);
+  ~JsonOutput() override;
 
   void map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
            const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &values_by_key) const override;
   void map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                 const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                 const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
-  void map_stats(BPFtrace &bpftrace, IMap &map,
+  void map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                  const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
                  const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const override;
+  void map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                     const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                     const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
+  void map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                 const std::vector<MapValueChange> &changed,
+                 const std::vector<std::vector<uint8_t>> &removed) const override;
 
   void message(MessageType type, const std::string& msg, bool nl = true) const override;
   void message(MessageType type, const std::string& field, uint64_t value) const;
   void lost_events(uint64_t lost) const override;
   void attached_probes(uint64_t num_probes) const override;
+  void timings(const std::vector<TimedPhase> &phases) const override;
 
 private:
-  std::string json_escape(const std::string &str) const;
+  mutable std::string buf_;
+  bool batch_;
+
+  void append_string(const std::string &str) const; // quoted and escaped
+  void append_uint(uint64_t value) const;
+  void append_int(int64_t value) const;
+  void append_double(double value) const;
+  void begin_record(MessageType type) const;
+  void end_record() const;
+  void flush_buffer() const;
 
   void hist(const std::vector<uint64_t> &values, uint32_t div) const;
   void lhist(const std::vector<uint64_t> &values, int min, int max, int step) const;
 };
 
+// Compact binary output, for pipelines which post-process large maps.
+// Maps are written as typed columns of key fields and reduced values
+// instead of formatted text, and strings (comm, ksym, usym, ...) are
+// dictionary encoded. The layout is described under "Binary Output" in
+// the reference guide.
+class BinaryOutput : public Output {
+public:
+  explicit BinaryOutput(std::ostream& out = std::cout, std::ostream& err = std::cerr, bool batch = false);
+  ~BinaryOutput() override;
+
+  void map(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+           const std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> &values_by_key) const override;
+  void map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
+  void map_stats(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                 const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
+                 const std::vector<std::pair<std::vector<uint8_t>, int64_t>> &total_counts_by_key) const override;
+  void map_quantiles(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
+                     const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
+                     const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const override;
+  void map_delta(BPFtrace &bpftrace, IMap &map, uint32_t div,
+                 const std::vector<MapValueChange> &changed,
+                 const std::vector<std::vector<uint8_t>> &removed) const override;
+
+  void message(MessageType type, const std::string& msg, bool nl = true) const override;
+  void lost_events(uint64_t lost) const override;
+  void attached_probes(uint64_t num_probes) const override;
+  void timings(const std::vector<TimedPhase> &phases) const override;
+
+  enum class ColumnType : uint8_t
+  {
+    int64 = 1,
+    uint64 = 2,
+    string = 3,      // index into the record's dictionary
+    uint64_list = 4, // count followed by the values, e.g. histogram buckets
+  };
+
+private:
+  // Strings of a record, each written once and referenced by index
+  class Dictionary
+  {
+  public:
+    uint32_t add(const std::string &str);
+    void write(std::string &out) const;
+
+  private:
+    std::unordered_map<std::string, uint32_t> index_;
+    std::vector<const std::string *> strings_;
+  };
+
+  struct Column
+  {
+    std::string name;
+    ColumnType type;
+    std::string data;
+  };
+
+  mutable std::string buf_;
+  bool batch_;
+
+  static void put_u8(std::string &out, uint8_t value);
+  static void put_u32(std::string &out, uint32_t value);
+  static void put_u64(std::string &out, uint64_t value);
+  static void put_string(std::string &out, const std::string &str);
+
+  static std::vector<Column> key_columns(BPFtrace &bpftrace, IMap &map,
+                                         const std::vector<const std::vector<uint8_t> *> &keys,
+                                         Dictionary &dict);
+  static ColumnType value_column_type(IMap &map);
+  static std::string map_record(IMap &map, size_t rows, const Dictionary &dict,
+                                const std::vector<Column> &columns,
+                                const std::string &header = "");
+  void write_record(MessageType type, const std::string &payload) const;
+};
+
 } // namespace bpftrace
@@ -0,0 +1,920 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "llvm/Config/llvm-config.h"
+
+#include "attached_probe.h"
+#include "bpforc.h"
+#include "bpftrace.h"
+#include "codegen_llvm.h"
+#include "map.h"
+#include "program_cache.h"
+#include "utils.h"
+
+namespace bpftrace {
+
+namespace {
+
+const std::string CACHE_MAGIC = "bpftrace-program-cache";
+const std::string OBJECT_MAGIC = "bpftrace-object";
+// Bump when the layout of cache or object files changes
+const uint64_t CACHE_FORMAT_VERSION = 7;
+// Sanity limits on the size of any single item and on the number of items
+// in a list, in case of a corrupt file
+const uint64_t CACHE_ITEM_MAX = 1 << 30;
+const uint64_t CACHE_COUNT_MAX = 1 << 20;
+
+} // namespace
+
+class CacheWriter
+{
+public:
+  explicit CacheWriter(std::ostream &out) : out_(out) { }
+
+  void u64(uint64_t v)
+  {
+    out_.write(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  void str(const std::string &s)
+  {
+    u64(s.size());
+    out_.write(s.data(), s.size());
+  }
+
+  void bytes(const uint8_t *data, size_t size)
+  {
+    u64(size);
+    out_.write(reinterpret_cast<const char *>(data), size);
+  }
+
+  void type(const SizedType &t)
+  {
+    u64(static_cast<uint64_t>(t.type));
+    u64(static_cast<uint64_t>(t.elem_type));
+    u64(t.size);
+    u64(t.stack_type.limit);
+    u64(static_cast<uint64_t>(t.stack_type.mode));
+    u64(t.is_signed);
+    str(t.cast_type);
+    u64(t.is_internal);
+    u64(t.is_pointer);
+    u64(t.is_tparg);
+    u64(t.pointee_size);
+  }
+
+  void fields(const std::vector<Field> &fields)
+  {
+    u64(fields.size());
+    for (auto &field : fields)
+    {
+      type(field.type);
+      u64(field.offset);
+    }
+  }
+
+  void call_args(const std::vector<std::tuple<std::string, std::vector<Field>>> &args)
+  {
+    u64(args.size());
+    for (auto &arg : args)
+    {
+      str(std::get<0>(arg));
+      fields(std::get<1>(arg));
+    }
+  }
+
+  void strs(const std::vector<std::string> &strs)
+  {
+    u64(strs.size());
+    for (auto &s : strs)
+      str(s);
+  }
+
+  void probe(const Probe &p)
+  {
+    u64(static_cast<uint64_t>(p.type));
+    str(p.path);
+    str(p.attach_point);
+    str(p.orig_name);
+    str(p.name);
+    str(p.ns);
+    u64(p.loc);
+    u64(p.index);
+    u64(p.freq);
+    u64(p.pid);
+    u64(p.addr);
+    u64(p.len);
+    str(p.mode);
+    u64(p.use_cookie);
+    u64(p.cookie);
+  }
+
+  void probes(const std::vector<Probe> &probes)
+  {
+    u64(probes.size());
+    for (auto &p : probes)
+      probe(p);
+  }
+
+  // join, ratelimit and scratch maps are only created when needed
+  void optional_map(const std::unique_ptr<IMap> &map)
+  {
+    u64(map != nullptr);
+    if (map)
+    {
+      type(map->type_);
+      u64(map->max_entries_);
+      u64(map->mapfd_);
+    }
+  }
+
+private:
+  std::ostream &out_;
+};
+
+class CacheReader
+{
+public:
+  explicit CacheReader(std::istream &in) : in_(in) { }
+
+  bool ok() const
+  {
+    return in_.good();
+  }
+
+  uint64_t u64()
+  {
+    uint64_t v = 0;
+    in_.read(reinterpret_cast<char *>(&v), sizeof(v));
+    return v;
+  }
+
+  std::string str()
+  {
+    uint64_t size = u64();
+    if (!ok() || size > CACHE_ITEM_MAX)
+    {
+      in_.setstate(std::ios::failbit);
+      return "";
+    }
+    std::string s(size, '\0');
+    in_.read(&s[0], size);
+    return s;
+  }
+
+  std::vector<uint8_t> bytes()
+  {
+    uint64_t size = u64();
+    if (!ok() || size > CACHE_ITEM_MAX)
+    {
+      in_.setstate(std::ios::failbit);
+      return {};
+    }
+    std::vector<uint8_t> data(size);
+    in_.read(reinterpret_cast<char *>(data.data()), size);
+    return data;
+  }
+
+  // Reads a count of items, which must then be read one at a time
+  uint64_t count()
+  {
+    uint64_t n = u64();
+    if (!ok() || n > CACHE_COUNT_MAX)
+    {
+      in_.setstate(std::ios::failbit);
+      return 0;
+    }
+    return n;
+  }
+
+  SizedType type()
+  {
+    SizedType t;
+    t.type = static_cast<Type>(u64());
+    t.elem_type = static_cast<Type>(u64());
+    t.size = u64();
+    t.stack_type.limit = u64();
+    t.stack_type.mode = static_cast<StackMode>(u64());
+    t.is_signed = u64();
+    t.cast_type = str();
+    t.is_internal = u64();
+    t.is_pointer = u64();
+    t.is_tparg = u64();
+    t.pointee_size = u64();
+    return t;
+  }
+
+  std::vector<Field> fields()
+  {
+    std::vector<Field> fields(count());
+    for (auto &field : fields)
+    {
+      field.type = type();
+      field.offset = u64();
+    }
+    return fields;
+  }
+
+  std::vector<std::tuple<std::string, std::vector<Field>>> call_args()
+  {
+    std::vector<std::tuple<std::string, std::vector<Field>>> args;
+    uint64_t n = count();
+    for (uint64_t i = 0; i < n && ok(); i++)
+    {
+      std::string fmt = str();
+      args.emplace_back(fmt, fields());
+    }
+    return args;
+  }
+
+  std::vector<std::string> strs()
+  {
+    std::vector<std::string> strs(count());
+    for (auto &s : strs)
+      s = str();
+    return strs;
+  }
+
+  Probe probe()
+  {
+    Probe p;
+    p.type = static_cast<ProbeType>(u64());
+    p.path = str();
+    p.attach_point = str();
+    p.orig_name = str();
+    p.name = str();
+    p.ns = str();
+    p.loc = u64();
+    p.index = u64();
+    p.freq = u64();
+    p.pid = u64();
+    p.addr = u64();
+    p.len = u64();
+    p.mode = str();
+    p.use_cookie = u64();
+    p.cookie = u64();
+    return p;
+  }
+
+  std::vector<Probe> probes()
+  {
+    std::vector<Probe> probes(count());
+    for (auto &p : probes)
+      p = probe();
+    return probes;
+  }
+
+private:
+  std::istream &in_;
+};
+
+namespace {
+
+struct CachedMap
+{
+  SizedType type;
+  MapKey key;
+  int min = 0;
+  int max = 0;
+  int step = 0;
+  int max_entries = 0;
+  int fd = -1;
+};
+
+// Creates a map from its cached description, recording its new fd
+std::unique_ptr<IMap> create_cached_map(const std::string &name,
+                                        const CachedMap &cached,
+                                        std::map<int, int> &fds)
+{
+  auto map = std::make_unique<Map>(name, cached.type, cached.key,
+      cached.min, cached.max, cached.step, cached.max_entries);
+  if (map->mapfd_ < 0)
+    return nullptr;
+  fds[cached.fd] = map->mapfd_;
+  return map;
+}
+
+// Finds calls which are resolved against the running system at compile
+// time, so their programs are only valid within the same boot
+class PerBootCalls : public ast::Visitor
+{
+public:
+  bool found = false;
+
+  void visit(ast::Integer &) override { }
+  void visit(ast::PositionalParameter &) override { }
+  void visit(ast::String &) override { }
+  void visit(ast::Builtin &) override { }
+  void visit(ast::Identifier &) override { }
+  void visit(ast::StackMode &) override { }
+  void visit(ast::Call &call) override
+  {
+    if (call.func == "kaddr" || call.func == "cgroupid")
+      found = true;
+    visit_all(call.vargs);
+  }
+  void visit(ast::Map &map) override { visit_all(map.vargs); }
+  void visit(ast::Variable &) override { }
+  void visit(ast::Binop &binop) override
+  {
+    binop.left->accept(*this);
+    binop.right->accept(*this);
+  }
+  void visit(ast::Unop &unop) override { unop.expr->accept(*this); }
+  void visit(ast::Ternary &ternary) override
+  {
+    ternary.cond->accept(*this);
+    ternary.left->accept(*this);
+    ternary.right->accept(*this);
+  }
+  void visit(ast::FieldAccess &acc) override { acc.expr->accept(*this); }
+  void visit(ast::ArrayAccess &arr) override
+  {
+    arr.expr->accept(*this);
+    arr.indexpr->accept(*this);
+  }
+  void visit(ast::Cast &cast) override { cast.expr->accept(*this); }
+  void visit(ast::ExprStatement &expr) override { expr.expr->accept(*this); }
+  void visit(ast::AssignMapStatement &assignment) override
+  {
+    assignment.map->accept(*this);
+    assignment.expr->accept(*this);
+  }
+  void visit(ast::AssignVarStatement &assignment) override
+  {
+    assignment.expr->accept(*this);
+  }
+  void visit(ast::If &if_block) override
+  {
+    if_block.cond->accept(*this);
+    visit_all(if_block.stmts);
+    visit_all(if_block.else_stmts);
+  }
+  void visit(ast::Unroll &unroll) override { visit_all(unroll.stmts); }
+  void visit(ast::Predicate &pred) override { pred.expr->accept(*this); }
+  void visit(ast::AttachPoint &) override { }
+  void visit(ast::Probe &probe) override
+  {
+    if (probe.pred)
+      probe.pred->accept(*this);
+    visit_all(probe.stmts);
+  }
+  void visit(ast::Program &program) override
+  {
+    for (ast::Probe *probe : *program.probes)
+      probe->accept(*this);
+  }
+
+private:
+  template <typename T>
+  void visit_all(std::vector<T *> *nodes)
+  {
+    if (!nodes)
+      return;
+    for (T *node : *nodes)
+      node->accept(*this);
+  }
+};
+
+std::string file_contents(const std::string &path)
+{
+  std::ifstream file(path);
+  std::stringstream buf;
+  buf << file.rdbuf();
+  return buf.str();
+}
+
+std::string kernel_build()
+{
+  struct utsname utsname;
+  uname(&utsname);
+  return std::string(utsname.release) + " " + utsname.version;
+}
+
+std::string boot_id()
+{
+  return file_contents("/proc/sys/kernel/random/boot_id");
+}
+
+} // namespace
+
+ProgramCache::ProgramCache(const std::string &dir, const std::string &key)
+  : dir_(dir), key_(key)
+{
+  std::stringstream path;
+  path << dir_ << "/" << std::hex << std::setw(16) << std::setfill('0')
+       << std::hash<std::string>()(key_) << ".cache";
+  path_ = path.str();
+}
+
+std::string ProgramCache::make_key(BPFtrace &bpftrace,
+                                   ast::Program &program,
+                                   const std::vector<std::string> &extra_flags,
+                                   const std::vector<std::string> &include_files)
+{
+  std::stringstream key;
+  key << "bpftrace " << BPFTRACE_VERSION << std::endl;
+  key << "llvm " << LLVM_VERSION_MAJOR << std::endl;
+
+  struct utsname utsname;
+  uname(&utsname);
+  key << "kernel " << kernel_build() << " " << utsname.machine << std::endl;
+
+  key << "source " << bpftrace.source().size() << std::endl
+      << bpftrace.source() << std::endl;
+  for (size_t i = 1; i <= bpftrace.num_params(); i++)
+    key << "param " << bpftrace.get_param(i, true) << std::endl;
+
+  key << "strlen " << bpftrace.strlen_ << std::endl;
+  key << "mapmax " << bpftrace.mapmax_ << std::endl;
+  key << "join " << bpftrace.join_argnum_ << " " << bpftrace.join_argsize_ << std::endl;
+  key << "ordered " << bpftrace.ordered_output_ << std::endl;
+  key << "safe " << bpftrace.safe_mode_ << std::endl;
+  key << "btf " << bpftrace.force_btf_ << std::endl;
+  key << "pid " << bpftrace.pid_ << std::endl;
+  key << "cmd " << bpftrace.cmd_ << std::endl;
+
+  for (auto &flag : extra_flags)
+    key << "flag " << flag << std::endl;
+  for (auto &file : include_files)
+  {
+    std::string contents = file_contents(file);
+    key << "include " << file << " " << contents.size() << std::endl
+        << contents << std::endl;
+  }
+
+  for (auto probe : *program.probes)
+  {
+    for (auto attach_point : *probe->attach_points)
+    {
+      // user space probes resolve addresses from their target binaries
+      struct stat st;
+      if (!attach_point->target.empty() &&
+          stat(attach_point->target.c_str(), &st) == 0)
+      {
+        key << "target " << attach_point->target << " " << st.st_ino << " "
+            << st.st_size << " " << st.st_mtime << std::endl;
+      }
+    }
+  }
+  if (needs_same_boot(bpftrace, program))
+    key << "boot " << boot_id();
+
+  return key.str();
+}
+
+bool ProgramCache::needs_same_boot(BPFtrace &bpftrace, ast::Program &program)
+{
+  // Wildcards are expanded against the running kernel's functions, which
+  // change as modules are loaded, kaddr() and cgroupid() are resolved at
+  // compile time, and a -p pid only names the same process within a boot.
+  if (bpftrace.pid_)
+    return true;
+  for (auto probe : *program.probes)
+  {
+    for (auto attach_point : *probe->attach_points)
+    {
+      if (has_wildcard(attach_point->func))
+        return true;
+    }
+  }
+  PerBootCalls per_boot_calls;
+  program.accept(per_boot_calls);
+  return per_boot_calls.found;
+}
+
+std::unique_ptr<BpfOrc> ProgramCache::read_program(CacheReader &in,
+                                                   BPFtrace &bpftrace)
+{
+  auto probes = in.probes();
+  auto special_probes = in.probes();
+  auto probe_ids = in.strs();
+  auto printf_args = in.call_args();
+  auto system_args = in.call_args();
+  auto cat_args = in.call_args();
+  auto join_args = in.strs();
+  auto time_args = in.strs();
+  // The program's perf event records are timestamped for --ordered
+  bool ordered_output = in.u64();
+
+  std::map<std::string, CachedMap> maps;
+  uint64_t num_maps = in.count();
+  for (uint64_t i = 0; i < num_maps && in.ok(); i++)
+  {
+    std::string name = in.str();
+    CachedMap &map = maps[name];
+    map.type = in.type();
+    map.key.args_.resize(in.count());
+    for (auto &arg : map.key.args_)
+      arg = in.type();
+    map.min = in.u64();
+    map.max = in.u64();
+    map.step = in.u64();
+    map.max_entries = in.u64();
+    map.fd = in.u64();
+  }
+
+  std::vector<std::pair<StackType, int>> stack_maps;
+  uint64_t num_stack_maps = in.count();
+  for (uint64_t i = 0; i < num_stack_maps && in.ok(); i++)
+  {
+    StackType stack_type;
+    stack_type.limit = in.u64();
+    stack_type.mode = static_cast<StackMode>(in.u64());
+    stack_maps.emplace_back(stack_type, in.u64());
+  }
+
+  std::map<std::string, CachedMap> optional_maps;
+  for (auto &name : { "join", "ratelimit", "scratch", "elapsed" })
+  {
+    if (in.u64())
+    {
+      CachedMap &map = optional_maps[name];
+      map.type = in.type();
+      map.max_entries = in.u64();
+      map.fd = in.u64();
+    }
+  }
+  int perf_event_map_fd = in.u64();
+
+  std::map<std::string, std::vector<uint8_t>> sections;
+  uint64_t num_sections = in.count();
+  for (uint64_t i = 0; i < num_sections && in.ok(); i++)
+  {
+    std::string name = in.str();
+    sections[name] = in.bytes();
+  }
+
+  if (!in.ok())
+    return nullptr;
+
+  // Recreate the maps and point the programs at their new fds. Nothing is
+  // handed over to bpftrace until everything has succeeded.
+  std::map<int, int> fds;
+  std::map<std::string, std::unique_ptr<IMap>> new_maps;
+  for (auto &map : maps)
+  {
+    new_maps[map.first] = create_cached_map(map.first, map.second, fds);
+    if (!new_maps[map.first])
+      return nullptr;
+  }
+
+  std::unordered_map<StackType, std::unique_ptr<IMap>> new_stack_maps;
+  for (auto &stack_map : stack_maps)
+  {
+    auto map = std::make_unique<Map>(SizedType(Type::kstack, stack_map.first));
+    if (map->mapfd_ < 0)
+      return nullptr;
+    fds[stack_map.second] = map->mapfd_;
+    new_stack_maps[stack_map.first] = std::move(map);
+  }
+
+  std::map<std::string, std::unique_ptr<IMap>> new_optional_maps;
+  for (auto &map : optional_maps)
+  {
+    new_optional_maps[map.first] = create_cached_map(map.first, map.second, fds);
+    if (!new_optional_maps[map.first])
+      return nullptr;
+  }
+
+  auto perf_event_map = std::make_unique<Map>(BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+  if (perf_event_map->mapfd_ < 0)
+    return nullptr;
+  fds[perf_event_map_fd] = perf_event_map->mapfd_;
+
+  auto bpforc = std::make_unique<BpfOrc>(ast::CodegenLLVM::createTargetMachine());
+  for (auto &section : sections)
+  {
+    if (!relocate_map_fds(section.second, fds))
+      return nullptr;
+    bpforc->addSection(section.first, std::move(section.second));
+  }
+
+  // BEGIN and END are attached to this process
+  for (auto &probe : special_probes)
+    probe.pid = getpid();
+  for (auto &probe : probes)
+    probe.log_size = bpftrace.log_size_;
+  for (auto &probe : special_probes)
+    probe.log_size = bpftrace.log_size_;
+
+  bpftrace.probes_ = std::move(probes);
+  bpftrace.special_probes_ = std::move(special_probes);
+  bpftrace.probe_ids_ = std::move(probe_ids);
+  bpftrace.printf_args_ = std::move(printf_args);
+  bpftrace.system_args_ = std::move(system_args);
+  bpftrace.cat_args_ = std::move(cat_args);
+  bpftrace.join_args_ = std::move(join_args);
+  bpftrace.time_args_ = std::move(time_args);
+  bpftrace.ordered_output_ = ordered_output;
+  bpftrace.maps_ = std::move(new_maps);
+  bpftrace.stackid_maps_ = std::move(new_stack_maps);
+  bpftrace.join_map_ = std::move(new_optional_maps["join"]);
+  bpftrace.ratelimit_map_ = std::move(new_optional_maps["ratelimit"]);
+  bpftrace.scratch_map_ = std::move(new_optional_maps["scratch"]);
+  bpftrace.elapsed_map_ = std::move(new_optional_maps["elapsed"]);
+  bpftrace.perf_event_map_ = std::move(perf_event_map);
+
+  return bpforc;
+}
+
+void ProgramCache::write_program(CacheWriter &out,
+                                 BPFtrace &bpftrace,
+                                 const BpfOrc &bpforc)
+{
+  out.probes(bpftrace.probes_);
+  out.probes(bpftrace.special_probes_);
+  out.strs(bpftrace.probe_ids_);
+  out.call_args(bpftrace.printf_args_);
+  out.call_args(bpftrace.system_args_);
+  out.call_args(bpftrace.cat_args_);
+  out.strs(bpftrace.join_args_);
+  out.strs(bpftrace.time_args_);
+  out.u64(bpftrace.ordered_output_);
+
+  out.u64(bpftrace.maps_.size());
+  for (auto &map : bpftrace.maps_)
+  {
+    IMap &m = *map.second;
+    out.str(map.first);
+    out.type(m.type_);
+    out.u64(m.key_.args_.size());
+    for (auto &arg : m.key_.args_)
+      out.type(arg);
+    out.u64(m.lqmin);
+    out.u64(m.lqmax);
+    out.u64(m.lqstep);
+    out.u64(m.max_entries_);
+    out.u64(m.mapfd_);
+  }
+
+  out.u64(bpftrace.stackid_maps_.size());
+  for (auto &map : bpftrace.stackid_maps_)
+  {
+    out.u64(map.first.limit);
+    out.u64(static_cast<uint64_t>(map.first.mode));
+    out.u64(map.second->mapfd_);
+  }
+
+  out.optional_map(bpftrace.join_map_);
+  out.optional_map(bpftrace.ratelimit_map_);
+  out.optional_map(bpftrace.scratch_map_);
+  out.optional_map(bpftrace.elapsed_map_);
+  out.u64(bpftrace.perf_event_map_->mapfd_);
+
+  // Only the probe programs are needed to attach, see attach_probe()
+  std::vector<std::pair<std::string, std::tuple<uint8_t *, uintptr_t>>> sections;
+  for (auto &section : bpforc.sections_)
+  {
+    if (section.first.compare(0, 2, "s_") == 0)
+      sections.push_back(section);
+  }
+  out.u64(sections.size());
+  for (auto &section : sections)
+  {
+    out.str(section.first);
+    out.bytes(std::get<0>(section.second), std::get<1>(section.second));
+  }
+}
+
+std::unique_ptr<BpfOrc> ProgramCache::load(BPFtrace &bpftrace)
+{
+  if (!create_private_dir(dir_))
+    return nullptr;
+
+  std::ifstream file(path_, std::ios::binary);
+  if (file.fail())
+    return nullptr;
+
+  CacheReader in(file);
+  if (in.str() != CACHE_MAGIC || in.u64() != CACHE_FORMAT_VERSION ||
+      in.str() != key_)
+    return nullptr;
+
+  // Headers which clang found through the include paths aren't part of the
+  // key, so the entry is only used while they are all unchanged
+  for (uint64_t i = 0, n = in.count(); i < n; i++)
+  {
+    std::string header = in.str();
+    uint64_t hash = in.u64();
+    if (!in.ok() || std::hash<std::string>()(file_contents(header)) != hash)
+    {
+      if (bt_verbose)
+        std::cerr << "Ignoring stale program cache entry " << path_ << std::endl;
+      return nullptr;
+    }
+  }
+
+  auto bpforc = read_program(in, bpftrace);
+  if (!bpforc)
+  {
+    if (bt_verbose)
+      std::cerr << "Ignoring invalid program cache entry " << path_ << std::endl;
+    return nullptr;
+  }
+
+  if (bt_verbose)
+    std::cerr << "Loaded program from cache " << path_ << std::endl;
+
+  return bpforc;
+}
+
+void ProgramCache::save(BPFtrace &bpftrace, const BpfOrc &bpforc)
+{
+  if (!create_private_dir(dir_))
+    return;
+
+  // Write to a temporary file first so concurrent runs never see a
+  // partial entry
+  std::string tmp_path = path_ + ".tmp." + std::to_string(getpid());
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (file.fail())
+    return;
+
+  CacheWriter out(file);
+  out.str(CACHE_MAGIC);
+  out.u64(CACHE_FORMAT_VERSION);
+  out.str(key_);
+
+  // Headers built into bpftrace don't exist on disk and are covered by the
+  // bpftrace version in the key
+  std::vector<std::string> headers;
+  for (auto &header : bpftrace.c_headers_)
+  {
+    struct stat st;
+    if (stat(header.c_str(), &st) == 0)
+      headers.push_back(header);
+  }
+  out.u64(headers.size());
+  for (auto &header : headers)
+  {
+    out.str(header);
+    out.u64(std::hash<std::string>()(file_contents(header)));
+  }
+
+  write_program(out, bpftrace, bpforc);
+
+  file.close();
+  if (file.fail() || rename(tmp_path.c_str(), path_.c_str()) != 0)
+  {
+    if (bt_verbose)
+      std::cerr << "Could not write program cache " << path_ << ": "
+                << strerror(errno) << std::endl;
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  if (bt_verbose)
+    std::cerr << "Saved program to cache " << path_ << std::endl;
+}
+
+std::string ProgramCache::object_target()
+{
+  struct utsname utsname;
+  uname(&utsname);
+  std::stringstream target;
+  target << "bpftrace " << BPFTRACE_VERSION << std::endl;
+  target << "machine " << utsname.machine << std::endl;
+  return target.str();
+}
+
+bool ProgramCache::emit_object(BPFtrace &bpftrace,
+                               ast::Program &program,
+                               const BpfOrc &bpforc,
+                               const std::string &path)
+{
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (file.fail())
+  {
+    std::cerr << "Failed to open object file \"" << path << "\": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  CacheWriter out(file);
+  out.str(OBJECT_MAGIC);
+  out.u64(CACHE_FORMAT_VERSION);
+  out.str(object_target());
+  out.str(kernel_build());
+  out.str(needs_same_boot(bpftrace, program) ? boot_id() : "");
+  out.u64(bpftrace.safe_mode_);
+  write_program(out, bpftrace, bpforc);
+
+  file.close();
+  if (file.fail())
+  {
+    std::cerr << "Failed to write object file \"" << path << "\": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<BpfOrc> ProgramCache::load_object(BPFtrace &bpftrace,
+                                                  const std::string &path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (file.fail())
+  {
+    std::cerr << "Failed to open object file \"" << path << "\": "
+              << strerror(errno) << std::endl;
+    return nullptr;
+  }
+
+  CacheReader in(file);
+  if (in.str() != OBJECT_MAGIC || in.u64() != CACHE_FORMAT_VERSION)
+  {
+    std::cerr << "\"" << path << "\" is not a bpftrace object file, or was "
+              << "built by a different version of bpftrace" << std::endl;
+    return nullptr;
+  }
+  if (in.str() != object_target())
+  {
+    std::cerr << "Object file \"" << path << "\" was built by a different "
+              << "version of bpftrace or for a different architecture"
+              << std::endl;
+    return nullptr;
+  }
+
+  // Struct layouts and function names were resolved against the kernel
+  // which built the object, and anything needing the same boot (wildcard
+  // matches, kaddr(), cgroupid(), -p) against that boot
+  std::string kernel = in.str();
+  std::string boot = in.str();
+  bool safe_mode = in.u64();
+  if (in.ok() && kernel != kernel_build())
+  {
+    std::cerr << "Object file \"" << path << "\" was built for kernel "
+              << kernel << ", running " << kernel_build() << std::endl;
+    return nullptr;
+  }
+  if (in.ok() && !boot.empty() && boot != boot_id())
+  {
+    std::cerr << "Object file \"" << path << "\" uses wildcards, kaddr(), "
+              << "cgroupid() or -p, which were resolved in a previous boot. "
+              << "Compile it again." << std::endl;
+    return nullptr;
+  }
+
+  auto bpforc = read_program(in, bpftrace);
+  if (!bpforc)
+  {
+    std::cerr << "Failed to load object file \"" << path << "\"" << std::endl;
+    return nullptr;
+  }
+
+  // Otherwise the first system() call would abort bpftrace
+  if (bpftrace.safe_mode_ && (!safe_mode || !bpftrace.system_args_.empty()))
+  {
+    std::cerr << "Object file \"" << path << "\" was compiled with --unsafe, "
+              << "and can only be loaded with --unsafe" << std::endl;
+    return nullptr;
+  }
+
+  // Rather than failing to attach later
+  bpftrace.attach_cookie_ = attach_cookie_supported();
+  for (auto &probe : bpftrace.probes_)
+  {
+    if (probe.use_cookie && !bpftrace.attach_cookie_)
+    {
+      std::cerr << "Object file \"" << path << "\" shares programs between "
+                << "probes using BPF cookies, which this kernel doesn't "
+                << "support" << std::endl;
+      return nullptr;
+    }
+  }
+  return bpforc;
+}
+
+bool ProgramCache::relocate_map_fds(std::vector<uint8_t> &insns,
+                                    const std::map<int, int> &fds)
+{
+  size_t num_insns = insns.size() / sizeof(struct bpf_insn);
+  auto insn = reinterpret_cast<struct bpf_insn *>(insns.data());
+  for (size_t i = 0; i < num_insns; i++)
+  {
+    if (insn[i].code != (BPF_LD | BPF_DW | BPF_IMM))
+      continue;
+
+    // BPF_LD_IMM64 spans two instructions
+    if (insn[i].src_reg == BPF_PSEUDO_MAP_FD)
+    {
+      auto fd = fds.find(insn[i].imm);
+      if (fd == fds.end())
+        return false;
+      insn[i].imm = fd->second;
+    }
+    i++;
+  }
+  return true;
+}
+
+} // namespace bpftrace
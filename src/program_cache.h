@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast/ast.h"
+
+namespace bpftrace {
+
+class BPFtrace;
+class BpfOrc;
+class CacheReader;
+class CacheWriter;
+
+// On-disk cache of compiled programs, together with the state BPFtrace needs
+// to run them (probes, maps, printf arguments, ...). A cache hit skips the
+// tracepoint parser, clang, semantic analysis and LLVM entirely.
+//
+// Entries are keyed by everything which affects the generated code: the
+// script, its parameters and settings, the clang flags (and so the kernel
+// headers), the running kernel and the bpftrace version. The headers clang
+// read are stored in the entry and checked when it's loaded.
+//
+// The same format, with a looser header, is used for the standalone objects
+// written by --emit-object.
+class ProgramCache
+{
+public:
+  ProgramCache(const std::string &dir, const std::string &key);
+
+  static std::string make_key(BPFtrace &bpftrace,
+                              ast::Program &program,
+                              const std::vector<std::string> &extra_flags,
+                              const std::vector<std::string> &include_files);
+
+  // Returns nullptr on a cache miss, leaving bpftrace untouched
+  std::unique_ptr<BpfOrc> load(BPFtrace &bpftrace);
+  void save(BPFtrace &bpftrace, const BpfOrc &bpforc);
+
+  // Standalone compiled programs for --emit-object and --load-object. These
+  // are tied to the bpftrace version, the kernel and, for programs which
+  // resolve anything specific to the current boot, to that boot.
+  static bool emit_object(BPFtrace &bpftrace,
+                          ast::Program &program,
+                          const BpfOrc &bpforc,
+                          const std::string &path);
+  static std::unique_ptr<BpfOrc> load_object(BPFtrace &bpftrace,
+                                             const std::string &path);
+
+  // Rewrites the map fds loaded by BPF_LD_IMM64 instructions
+  static bool relocate_map_fds(std::vector<uint8_t> &insns,
+                               const std::map<int, int> &fds);
+
+private:
+  std::string dir_;
+  std::string key_;
+  std::string path_;
+
+  static std::string object_target();
+  static bool needs_same_boot(BPFtrace &bpftrace, ast::Program &program);
+  static std::unique_ptr<BpfOrc> read_program(CacheReader &in,
+                                              BPFtrace &bpftrace);
+  static void write_program(CacheWriter &out,
+                            BPFtrace &bpftrace,
+                            const BpfOrc &bpforc);
+};
+
+} // namespace bpftrace
@@ -5,12 +5,36 @@
 
 namespace bpftrace {
 
+// How to extract a bitfield: read read_bytes bytes from the field's offset,
+// shift right by access_rshift and apply mask
+struct Bitfield
+{
+  size_t read_bytes;
+  size_t access_rshift;
+  uint64_t mask;
+};
+
 class Field {
 public:
   SizedType type;
   int offset;
+  bool is_bitfield = false;
+  Bitfield bitfield;
 };
 
+// Sets the offset and bitfield of a field which starts bit_offset bits into
+// its struct and is bit_width bits wide. Returns false if the bitfield can't
+// be read with a single load of up to 8 bytes.
+inline bool set_bitfield(Field &field, size_t bit_offset, size_t bit_width)
+{
+  field.offset = bit_offset / 8;
+  field.is_bitfield = true;
+  field.bitfield.access_rshift = bit_offset % 8;
+  field.bitfield.read_bytes = (field.bitfield.access_rshift + bit_width + 7) / 8;
+  field.bitfield.mask = bit_width >= 64 ? ~0ULL : (1ULL << bit_width) - 1;
+  return field.bitfield.read_bytes <= 8;
+}
+
 using FieldsMap = std::map<std::string, Field>;
 
 class Struct
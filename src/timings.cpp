@@ -0,0 +1,74 @@
+#include <sys/resource.h>
+
+#include "output.h"
+#include "timings.h"
+
+namespace bpftrace {
+
+Timings bt_timings;
+
+Timings::Scope::Scope(Timings &timings, const std::string &name)
+  : timings_(timings)
+{
+  if (!timings_.enabled())
+    return;
+  index_ = timings_.begin(name);
+  start_ = std::chrono::steady_clock::now();
+}
+
+Timings::Scope::~Scope()
+{
+  if (index_ < 0)
+    return;
+  timings_.end(index_, std::chrono::steady_clock::now() - start_);
+}
+
+int Timings::begin(const std::string &name)
+{
+  int parent = open_.empty() ? -1 : open_.back();
+
+  // Repeated phases, like loading each probe, share an entry
+  int index = -1;
+  for (int i = phases_.size() - 1; i > parent; i--)
+  {
+    if (parents_[i] == parent && phases_[i].name == name)
+    {
+      index = i;
+      break;
+    }
+  }
+
+  if (index < 0)
+  {
+    index = phases_.size();
+    phases_.push_back({ name, static_cast<int>(open_.size()), 0, 0, 0 });
+    parents_.push_back(parent);
+  }
+  open_.push_back(index);
+  return index;
+}
+
+void Timings::end(int index, std::chrono::steady_clock::duration elapsed)
+{
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+
+  auto &phase = phases_[index];
+  phase.count++;
+  phase.elapsed_ms +=
+      std::chrono::duration<double, std::milli>(elapsed).count();
+  phase.peak_rss_kb = usage.ru_maxrss;
+
+  // Scopes are destroyed in reverse order, so this is the innermost phase
+  open_.pop_back();
+}
+
+void Timings::report(Output &out)
+{
+  if (!enabled_ || reported_)
+    return;
+  reported_ = true;
+  out.timings(phases_);
+}
+
+} // namespace bpftrace
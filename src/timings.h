@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bpftrace {
+
+class Output;
+
+struct TimedPhase
+{
+  std::string name;
+  int depth;
+  uint64_t count;      // times the phase ran, e.g. once per probe
+  double elapsed_ms;
+  long peak_rss_kb;    // process peak RSS when the phase last finished
+};
+
+// Wall clock time and peak RSS of each phase of bpftrace's startup, reported
+// with --timings. Phases nest, and repeated phases with the same parent are
+// added up.
+class Timings
+{
+public:
+  class Scope
+  {
+  public:
+    Scope(Timings &timings, const std::string &name);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope& operator=(const Scope &) = delete;
+
+  private:
+    Timings &timings_;
+    int index_ = -1;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  void enable() { enabled_ = true; }
+  bool enabled() const { return enabled_; }
+
+  // Prints the phases timed so far, only the first time it's called
+  void report(Output &out);
+
+private:
+  bool enabled_ = false;
+  bool reported_ = false;
+  std::vector<TimedPhase> phases_;
+  std::vector<int> parents_;
+  std::vector<int> open_;
+
+  int begin(const std::string &name);
+  void end(int index, std::chrono::steady_clock::duration elapsed);
+};
+
+extern Timings bt_timings;
+
+} // namespace bpftrace
@@ -1,18 +1,153 @@
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string.h>
-#include <glob.h>
+#include <thread>
+#include <unistd.h>
 
 #include "ast.h"
 #include "struct.h"
 #include "tracepoint_format_parser.h"
 #include "bpftrace.h"
+#include "utils.h"
 
 namespace bpftrace {
 
 std::set<std::string> TracepointFormatParser::struct_list;
 
-bool TracepointFormatParser::parse(ast::Program *program)
+namespace {
+
+const std::string FORMAT_CACHE_MAGIC = "bpftrace-tracepoint-formats";
+// Sanity limit on the size of a cached format file
+const size_t MAX_FORMAT_SIZE = 1 << 20;
+// Reading more format files at once stops helping well before this
+const unsigned MAX_READ_THREADS = 16;
+
+struct FormatFile
+{
+  std::string category;
+  std::string event_name;
+  std::string contents;
+  bool found = false;
+  int error = 0;
+};
+
+std::string format_file_path(const std::string &category, const std::string &event_name)
+{
+  return "/sys/kernel/debug/tracing/events/" + category + "/" + event_name + "/format";
+}
+
+std::string format_cache_key(const FormatFile &file)
+{
+  return file.category + ":" + file.event_name;
+}
+
+/*
+ * tracefs generates format files on every read, which is slow when a
+ * wildcard matches hundreds of tracepoints, so read them in parallel.
+ */
+void read_format_files(const std::vector<FormatFile *> &files)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&files, &next]()
+  {
+    for (size_t i = next++; i < files.size(); i = next++)
+    {
+      FormatFile &file = *files[i];
+      std::ifstream format_file(format_file_path(file.category, file.event_name));
+      if (format_file.fail())
+      {
+        file.error = errno;
+        continue;
+      }
+      file.contents.assign(std::istreambuf_iterator<char>(format_file),
+                           std::istreambuf_iterator<char>());
+      file.found = true;
+    }
+  };
+
+  size_t num_threads = std::min<size_t>(
+      { files.size(), std::max(std::thread::hardware_concurrency(), 1U), MAX_READ_THREADS });
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+std::string get_boot_id()
+{
+  std::ifstream file("/proc/sys/kernel/random/boot_id");
+  std::string boot_id;
+  std::getline(file, boot_id);
+  return boot_id;
+}
+
+/*
+ * Format files only change with the kernel, so they are cached in
+ * BPFTRACE_CACHE_DIR for as long as the same kernel keeps running. The
+ * file holds the boot id, then the size and contents of each format.
+ */
+std::map<std::string, std::string> load_format_cache(const std::string &path,
+                                                     const std::string &boot_id)
+{
+  std::map<std::string, std::string> formats;
+  std::ifstream file(path, std::ios::binary);
+  std::string magic, stored_boot_id;
+  if (!std::getline(file, magic) || magic != FORMAT_CACHE_MAGIC ||
+      !std::getline(file, stored_boot_id) || stored_boot_id != boot_id)
+    return {};
+
+  std::string key;
+  size_t size;
+  while (std::getline(file, key))
+  {
+    if (!(file >> size) || file.get() != '\n' || size > MAX_FORMAT_SIZE)
+      return {};
+    std::string contents(size, '\0');
+    if (!file.read(&contents[0], size))
+      return {};
+    formats[key] = std::move(contents);
+  }
+
+  if (bt_verbose)
+    std::cerr << "Loaded tracepoint formats from cache " << path << std::endl;
+  return formats;
+}
+
+void save_format_cache(const std::string &dir,
+                       const std::string &path,
+                       const std::string &boot_id,
+                       const std::map<std::string, std::string> &formats)
+{
+  if (!create_private_dir(dir))
+    return;
+
+  // Write to a temporary file first so concurrent runs never see a partial
+  // cache
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  file << FORMAT_CACHE_MAGIC << "\n" << boot_id << "\n";
+  for (auto &format : formats)
+    file << format.first << "\n" << format.second.size() << "\n" << format.second;
+  file.close();
+
+  if (file.fail() || rename(tmp_path.c_str(), path.c_str()) != 0)
+  {
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  if (bt_verbose)
+    std::cerr << "Saved tracepoint formats to cache " << path << std::endl;
+}
+
+} // namespace
+
+bool TracepointFormatParser::parse(ast::Program *program, BPFtrace &bpftrace)
 {
   std::vector<ast::Probe*> probes_with_tracepoint;
   for (ast::Probe *probe : *program->probes)
@@ -25,8 +160,10 @@ bool TracepointFormatParser::parse(ast::Program *program)
   if (probes_with_tracepoint.empty())
     return true;
 
+  // Work out which format files are needed, before reading any of them
   ast::TracepointArgsVisitor n{};
-  program->c_definitions += "#include <linux/types.h>\n";
+  std::vector<FormatFile> files;
+  std::vector<bool> is_wildcard;
   for (ast::Probe *probe : probes_with_tracepoint)
   {
     n.analyse(probe);
@@ -38,76 +175,125 @@ bool TracepointFormatParser::parse(ast::Program *program)
       {
         std::string &category = ap->target;
         std::string &event_name = ap->func;
-        std::string format_file_path = "/sys/kernel/debug/tracing/events/" + category + "/" + event_name + "/format";
-        glob_t glob_result;
 
         if (has_wildcard(event_name))
         {
           // tracepoint wildcard expansion, part 1 of 3. struct definitions.
-          memset(&glob_result, 0, sizeof(glob_result));
-          int ret = glob(format_file_path.c_str(), 0, NULL, &glob_result);
-          if (ret != 0)
+          std::set<std::string> matches;
+          try
           {
-            if (ret == GLOB_NOMATCH)
-            {
-              std::cerr << "ERROR: tracepoints not found: " << category << ":" << event_name << std::endl;
-              // helper message:
-              if (category == "syscall")
-                std::cerr << "Did you mean syscalls:" << event_name << "?" << std::endl;
-              if (bt_verbose) {
-                  std::cerr << strerror(errno) << ": " << format_file_path << std::endl;
-              }
-              return false;
-            }
-            else
-            {
-              // unexpected error
-              std::cerr << strerror(errno) << std::endl;
-              return false;
-            }
+            matches = bpftrace.find_wildcard_matches(*ap);
           }
-
-          for (size_t i = 0; i < glob_result.gl_pathc; ++i) {
-            std::string filename(glob_result.gl_pathv[i]);
-            std::ifstream format_file(filename);
-            std::string prefix("/sys/kernel/debug/tracing/events/" + category + "/");
-            std::string real_event = filename.substr(prefix.length(),
-                    filename.length() - std::string("/format").length() - prefix.length());
-
-            // Check to avoid adding the same struct more than once to definitions
-            std::string struct_name = get_struct_name(category, real_event);
-            if (!TracepointFormatParser::struct_list.count(struct_name))
-            {
-              program->c_definitions += get_tracepoint_struct(format_file, category, real_event);
-              TracepointFormatParser::struct_list.insert(struct_name);
-            }
+          catch (const WildcardException &e)
+          {
+            std::cerr << e.what() << std::endl;
+            return false;
           }
-          globfree(&glob_result);
-        }
-        else
-        {
-          // single tracepoint
-          std::ifstream format_file(format_file_path.c_str());
-          if (format_file.fail())
+          if (matches.empty())
           {
-            std::cerr << "ERROR: tracepoint not found: " << category << ":" << event_name << std::endl;
+            std::cerr << "ERROR: tracepoints not found: " << category << ":" << event_name << std::endl;
             // helper message:
             if (category == "syscall")
               std::cerr << "Did you mean syscalls:" << event_name << "?" << std::endl;
-            if (bt_verbose) {
-                std::cerr << strerror(errno) << ": " << format_file_path << std::endl;
-            }
             return false;
           }
-
-          // Check to avoid adding the same struct more than once to definitions
-          std::string struct_name = get_struct_name(category, event_name);
-          if (TracepointFormatParser::struct_list.insert(struct_name).second)
-            program->c_definitions += get_tracepoint_struct(format_file, category, event_name);
+          for (auto &match : matches)
+          {
+            files.emplace_back();
+            files.back().category = category;
+            files.back().event_name = match;
+            is_wildcard.push_back(true);
+          }
+        }
+        else
+        {
+          // single tracepoint
+          files.emplace_back();
+          files.back().category = category;
+          files.back().event_name = event_name;
+          is_wildcard.push_back(false);
         }
       }
     }
   }
+
+  std::string cache_path, boot_id;
+  std::map<std::string, std::string> cached_formats;
+  if (!bpftrace.cache_dir_.empty())
+  {
+    boot_id = get_boot_id();
+    if (!boot_id.empty())
+    {
+      cache_path = bpftrace.cache_dir_ + "/tracepoint_formats";
+      cached_formats = load_format_cache(cache_path, boot_id);
+    }
+  }
+
+  std::vector<FormatFile *> to_read;
+  for (auto &file : files)
+  {
+    auto cached = cached_formats.find(format_cache_key(file));
+    if (cached != cached_formats.end())
+    {
+      file.contents = cached->second;
+      file.found = true;
+    }
+    else
+      to_read.push_back(&file);
+  }
+  read_format_files(to_read);
+
+  bool need_types_header = true;
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    FormatFile &file = files[i];
+    if (!file.found)
+    {
+      // A wildcard match which has since disappeared fails at attach time
+      if (is_wildcard[i])
+        continue;
+      std::cerr << "ERROR: tracepoint not found: " << file.category << ":" << file.event_name << std::endl;
+      // helper message:
+      if (file.category == "syscall")
+        std::cerr << "Did you mean syscalls:" << file.event_name << "?" << std::endl;
+      if (bt_verbose) {
+          std::cerr << strerror(file.error) << ": " << format_file_path(file.category, file.event_name) << std::endl;
+      }
+      return false;
+    }
+
+    // Check to avoid adding the same struct more than once to definitions
+    std::string struct_name = get_struct_name(file.category, file.event_name);
+    if (!TracepointFormatParser::struct_list.insert(struct_name).second)
+      continue;
+
+    std::istringstream format_file(file.contents);
+    Struct tracepoint_struct;
+    if (get_tracepoint_struct(format_file, tracepoint_struct))
+    {
+      bpftrace.structs_[struct_name] = tracepoint_struct;
+      continue;
+    }
+
+    // Leave anything unusual to clang
+    if (need_types_header)
+    {
+      program->c_definitions += "#include <linux/types.h>\n";
+      need_types_header = false;
+    }
+    format_file.clear();
+    format_file.seekg(0);
+    program->c_definitions += get_tracepoint_struct(format_file, file.category, file.event_name);
+  }
+
+  if (!cache_path.empty() && !to_read.empty())
+  {
+    for (auto file : to_read)
+      if (file->found)
+        cached_formats[format_cache_key(*file)] = file->contents;
+    save_format_cache(bpftrace.cache_dir_, cache_path, boot_id, cached_formats);
+  }
+
   return true;
 }
 
@@ -163,6 +349,167 @@ std::string TracepointFormatParser::parse_field(const std::string &line)
   return "  " + field_type + " " + field_name + ";\n";
 }
 
+namespace {
+
+// Returns the value of "key:value;" in a format file line, searching from pos
+bool get_format_value(const std::string &line,
+                      const std::string &key,
+                      size_t pos,
+                      std::string &value)
+{
+  auto key_pos = line.find(key + ":", pos);
+  if (key_pos == std::string::npos)
+    return false;
+  auto semi_pos = line.find(';', key_pos);
+  if (semi_pos == std::string::npos)
+    return false;
+  key_pos += key.size() + 1;
+  value = line.substr(key_pos, semi_pos - key_pos);
+  return true;
+}
+
+// Drops qualifiers and normalises whitespace, e.g. "const char *"
+std::string normalise_type(const std::string &type)
+{
+  std::string spaced;
+  for (char c : type)
+  {
+    if (c == '*')
+      spaced += " * ";
+    else
+      spaced += c;
+  }
+
+  std::istringstream words(spaced);
+  std::string normalised;
+  for (std::string word; words >> word; )
+  {
+    if (word == "const" || word == "volatile")
+      continue;
+    if (!normalised.empty() && word != "*")
+      normalised += " ";
+    normalised += word;
+  }
+  return normalised;
+}
+
+// Size of a type which pointers in format files can point to, or 0 if it
+// isn't known
+size_t get_pointee_size(const std::string &type)
+{
+  static const std::map<std::string, size_t> sizes = {
+    { "void", 1 }, // as in GNU C
+    { "char", 1 }, { "signed char", 1 }, { "unsigned char", 1 },
+    { "short", 2 }, { "unsigned short", 2 },
+    { "int", 4 }, { "unsigned int", 4 }, { "unsigned", 4 },
+    { "long", sizeof(long) }, { "unsigned long", sizeof(long) },
+    { "long long", 8 }, { "unsigned long long", 8 },
+    { "u8", 1 }, { "s8", 1 }, { "__u8", 1 }, { "__s8", 1 },
+    { "u16", 2 }, { "s16", 2 }, { "__u16", 2 }, { "__s16", 2 },
+    { "u32", 4 }, { "s32", 4 }, { "__u32", 4 }, { "__s32", 4 },
+    { "u64", 8 }, { "s64", 8 }, { "__u64", 8 }, { "__s64", 8 },
+  };
+  if (!type.empty() && type.back() == '*')
+    return sizeof(uintptr_t);
+  auto size = sizes.find(type);
+  return size != sizes.end() ? size->second : 0;
+}
+
+bool is_aggregate(const std::string &type)
+{
+  return type.compare(0, 7, "struct ") == 0 || type.compare(0, 6, "union ") == 0;
+}
+
+} // namespace
+
+bool TracepointFormatParser::parse_field(const std::string &line,
+                                         std::string &name,
+                                         Field &field)
+{
+  std::string field_str, offset_str, size_str, signed_str;
+  if (!get_format_value(line, "field", 0, field_str))
+    return false;
+  auto pos = line.find(';', line.find("field:"));
+  if (!get_format_value(line, "offset", pos, offset_str) ||
+      !get_format_value(line, "size", pos, size_str) ||
+      !get_format_value(line, "signed", pos, signed_str))
+    return false;
+
+  auto field_type_end_pos = field_str.find_last_of("\t ");
+  if (field_type_end_pos == std::string::npos)
+    return false;
+  std::string field_type = normalise_type(field_str.substr(0, field_type_end_pos));
+  name = field_str.substr(field_type_end_pos + 1);
+
+  int size;
+  try
+  {
+    field.offset = std::stoi(offset_str);
+    size = std::stoi(size_str);
+  }
+  catch (const std::exception &)
+  {
+    return false;
+  }
+  bool is_signed = signed_str == "1";
+
+  if (field_type.find("__data_loc") != std::string::npos)
+  {
+    name = "data_loc_" + name;
+    field.type = SizedType(Type::integer, size, true);
+    return true;
+  }
+
+  auto bracket_pos = name.find('[');
+  if (bracket_pos != std::string::npos)
+  {
+    // Only one-dimensional arrays of known element types
+    size_t num_elems;
+    try
+    {
+      num_elems = std::stoul(name.substr(bracket_pos + 1));
+    }
+    catch (const std::exception &)
+    {
+      return false;
+    }
+    name = name.substr(0, bracket_pos);
+    if (num_elems == 0 || size % num_elems != 0 || is_aggregate(field_type) ||
+        field_type.find('[') != std::string::npos)
+      return false;
+
+    if (field_type == "char")
+    {
+      field.type = SizedType(Type::string, num_elems);
+      return true;
+    }
+    field.type = SizedType(Type::array, num_elems);
+    field.type.elem_type = Type::integer;
+    field.type.pointee_size = size / num_elems;
+    return true;
+  }
+
+  if (!field_type.empty() && field_type.back() == '*')
+  {
+    // Pointers to structs need their definition, which only clang has
+    std::string pointee = normalise_type(field_type.substr(0, field_type.size() - 1));
+    size_t pointee_size = get_pointee_size(pointee);
+    if (pointee_size == 0 || size != sizeof(uintptr_t))
+      return false;
+    field.type = SizedType(Type::integer, sizeof(uintptr_t));
+    field.type.is_pointer = true;
+    field.type.pointee_size = pointee_size;
+    return true;
+  }
+
+  // Anything else which isn't a struct is an integer, enum or a typedef of
+  // one. The format file gives its size and signedness.
+  if (is_aggregate(field_type) || (size != 1 && size != 2 && size != 4 && size != 8))
+    return false;
+  field.type = SizedType(Type::integer, size, is_signed);
+  return true;
+}
+
 std::string TracepointFormatParser::adjust_integer_types(const std::string &field_type, int size)
 {
   std::string new_type = field_type;
@@ -193,4 +540,38 @@ std::string TracepointFormatParser::get_tracepoint_struct(std::istream &format_f
   return format_struct;
 }
 
+bool TracepointFormatParser::get_tracepoint_struct(std::istream &format_file, Struct &result)
+{
+  result.size = 0;
+  size_t align = 1;
+  for (std::string line; getline(format_file, line); )
+  {
+    if (line.find("field:") == std::string::npos)
+      continue;
+
+    std::string name;
+    Field field;
+    if (!parse_field(line, name, field))
+      return false;
+
+    // Lay the struct out as clang would
+    size_t field_size = field.type.size;
+    size_t field_align = field.type.size;
+    if (field.type.type == Type::array)
+    {
+      field_size = field.type.size * field.type.pointee_size;
+      field_align = field.type.pointee_size;
+    }
+    else if (field.type.type == Type::string)
+      field_align = 1;
+    align = std::max(align, std::min<size_t>(field_align, 8));
+    result.size = std::max<int>(result.size, field.offset + field_size);
+
+    result.fields[name] = field;
+  }
+
+  result.size = (result.size + align - 1) / align * align;
+  return true;
+}
+
 } // namespace bpftrace
@@ -4,6 +4,7 @@
 #include <set>
 
 #include "ast/ast.h"
+#include "struct.h"
 
 namespace bpftrace {
 
@@ -116,19 +117,26 @@ private:
 };
 } // namespace ast
 
+class BPFtrace;
+
 class TracepointFormatParser
 {
 public:
-  static bool parse(ast::Program *program);
+  static bool parse(ast::Program *program, BPFtrace &bpftrace);
   static std::string get_struct_name(const std::string &category, const std::string &event_name);
 
 private:
   static std::string parse_field(const std::string &line);
+  static bool parse_field(const std::string &line, std::string &name, Field &field);
   static std::string adjust_integer_types(const std::string &field_type, int size);
   static std::set<std::string> struct_list;
 
 protected:
   static std::string get_tracepoint_struct(std::istream &format_file, const std::string &category, const std::string &event_name);
+  // Builds the struct straight from the format file, so it doesn't have to
+  // go through clang. Returns false if a field has a type which can only be
+  // understood by clang.
+  static bool get_tracepoint_struct(std::istream &format_file, Struct &result);
 };
 
 } // namespace bpftrace
@@ -73,12 +73,18 @@ std::string typestr(Type t)
     case Type::max:      return "max";      break;
     case Type::avg:      return "avg";      break;
     case Type::stats:    return "stats";    break;
+    case Type::topk:     return "topk";     break;
+    case Type::hll:      return "hll";      break;
+    case Type::quantiles: return "quantiles"; break;
     case Type::kstack:   return "kstack";   break;
     case Type::ustack:   return "ustack";   break;
     case Type::string:   return "string";   break;
     case Type::ksym:     return "ksym";     break;
     case Type::usym:     return "usym";     break;
     case Type::cast:     return "cast";     break;
+    case Type::ratelimit: return "ratelimit"; break;
+    case Type::scratch:  return "scratch";  break;
+    case Type::elapsed:  return "elapsed";  break;
     case Type::inet:     return "inet";     break;
     case Type::probe:    return "probe";    break;
     case Type::array:    return "array";    break;
@@ -5,6 +5,7 @@
 #include <string>
 #include <sys/types.h>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 namespace bpftrace {
@@ -14,6 +15,33 @@ const int DEFAULT_STACK_SIZE = 127;
 const int STRING_SIZE = 64;
 const int COMM_SIZE = 16;
 
+// str() buffers up to this size are kept on the 512 byte BPF stack. Larger
+// ones, and the printf() style arguments which carry them, are built in a
+// per-cpu scratch map instead.
+const int STACK_STRLEN_MAX = 200;
+const int STRLEN_MAX = 4096;
+
+// topk(): count-min sketch dimensions and size of the heavy hitter table
+const int TOPK_SKETCH_DEPTH = 4;
+const int TOPK_SKETCH_WIDTH = 1024;
+const int TOPK_SIZE = 16;
+
+// hll(): number of HyperLogLog registers is 2^HLL_PRECISION
+const int HLL_PRECISION = 8;
+
+// quantiles(): each power of 2 is split into 2^QUANTILES_SUB_BUCKET_BITS
+// linear buckets, bounding the relative error of a bucket
+const int QUANTILES_SUB_BUCKET_BITS = 4;
+
+// quantiles(): the quantiles reported for each key, with their labels
+const std::vector<std::pair<std::string, double>> QUANTILES =
+{
+  { "p50", 0.5 },
+  { "p90", 0.9 },
+  { "p99", 0.99 },
+  { "p999", 0.999 },
+};
+
 enum class Type
 {
   none,
@@ -26,6 +54,9 @@ enum class Type
   max,
   avg,
   stats,
+  topk,
+  hll,
+  quantiles,
   kstack,
   ustack,
   string,
@@ -33,6 +64,9 @@ enum class Type
   usym,
   cast,
   join,
+  ratelimit,
+  scratch,
+  elapsed,
   probe,
   username,
   inet,
@@ -155,6 +189,8 @@ public:
   uint64_t addr = 0;            // for watchpoint probes, start of region
   uint64_t len = 0;             // for watchpoint probes, size of region
   std::string mode;             // for watchpoint probes, watch mode (rwx)
+  bool use_cookie = false;      // program shared between matches, which
+  uint64_t cookie = 0;          // tell themselves apart by their probe id
 };
 
 const int RESERVED_IDS_PER_ASYNCACTION = 10000;
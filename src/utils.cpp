@@ -305,6 +305,33 @@ bool is_dir(const std::string& path)
   return S_ISDIR(buf.st_mode);
 }
 
+bool create_private_dir(const std::string &path)
+{
+  // Cached programs and headers are loaded as root, so only trust a
+  // directory which nobody else can write to
+  if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+  {
+    std::cerr << "Warning: could not create cache directory " << path << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    std::cerr << "Warning: cache " << path << " is not a directory" << std::endl;
+    return false;
+  }
+  if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+  {
+    std::cerr << "Warning: not using cache " << path
+              << ", it must be owned by the current user and not writable by others"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
 namespace {
   struct KernelHeaderTmpDir {
     KernelHeaderTmpDir(const std::string& prefix) : path{prefix + "XXXXXX"}
@@ -546,4 +573,47 @@ std::string str_join(const std::vector<std::string> &list, const std::string &de
   return str;
 }
 
+void str_append_uint(std::string &str, uint64_t value)
+{
+  // Two digits at a time, filled in from the end
+  static const char pairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+  char digits[20];
+  char *end = digits + sizeof(digits);
+  char *pos = end;
+  while (value >= 100)
+  {
+    unsigned int i = (value % 100) * 2;
+    value /= 100;
+    *--pos = pairs[i + 1];
+    *--pos = pairs[i];
+  }
+  if (value >= 10)
+  {
+    unsigned int i = value * 2;
+    *--pos = pairs[i + 1];
+    *--pos = pairs[i];
+  }
+  else
+  {
+    *--pos = '0' + value;
+  }
+  str.append(pos, end - pos);
+}
+
+void str_append_int(std::string &str, int64_t value)
+{
+  if (value < 0)
+  {
+    str += '-';
+    str_append_uint(str, -static_cast<uint64_t>(value));
+  }
+  else
+  {
+    str_append_uint(str, value);
+  }
+}
+
 } // namespace bpftrace
@@ -68,6 +68,7 @@ bool wildcard_match(const std::string &str, std::vector<std::string> &tokens, bo
 std::vector<int> get_online_cpus();
 std::vector<int> get_possible_cpus();
 bool is_dir(const std::string& path);
+bool create_private_dir(const std::string &path);
 std::tuple<std::string, std::string> get_kernel_dirs(const struct utsname& utsname);
 std::vector<std::string> get_kernel_cflags(
     const char* uname_machine,
@@ -79,6 +80,10 @@ std::string exec_system(const char* cmd);
 std::string resolve_binary_path(const std::string& cmd);
 void cat_file(const char *filename, size_t, std::ostream&);
 std::string str_join(const std::vector<std::string> &list, const std::string &delim);
+// Append the decimal form of value to str, like str += std::to_string(value)
+// without the temporary string
+void str_append_uint(std::string &str, uint64_t value);
+void str_append_int(std::string &str, int64_t value);
 
 // trim from end of string (right)
 inline std::string& rtrim(std::string& s)
@@ -0,0 +1,169 @@
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "gtest/gtest.h"
+#include "async_writer.h"
+
+namespace bpftrace {
+namespace test {
+namespace async_writer {
+
+class AsyncWriterTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    char path[] = "/tmp/bpftrace-async-writer-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = path;
+  }
+
+  void TearDown() override
+  {
+    unlink(path_.c_str());
+  }
+
+  std::string contents()
+  {
+    std::ifstream file(path_);
+    std::stringstream buf;
+    buf << file.rdbuf();
+    return buf.str();
+  }
+
+  std::string path_;
+};
+
+TEST_F(AsyncWriterTest, writes_records_in_order)
+{
+  AsyncWriter writer(1024 * 1024, 0, false);
+  ASSERT_TRUE(writer.open(path_));
+  std::ostream out(&writer);
+  for (int i = 0; i < 100; i++)
+    out << "record " << i << std::endl;
+  writer.close();
+
+  std::stringstream expected;
+  for (int i = 0; i < 100; i++)
+    expected << "record " << i << std::endl;
+  EXPECT_EQ(contents(), expected.str());
+  EXPECT_EQ(writer.dropped_records(), 0UL);
+}
+
+TEST_F(AsyncWriterTest, writes_unflushed_output_on_close)
+{
+  AsyncWriter writer(1024 * 1024, 0, false);
+  ASSERT_TRUE(writer.open(path_));
+  std::ostream out(&writer);
+  out << "no newline";
+  writer.close();
+
+  EXPECT_EQ(contents(), "no newline");
+}
+
+TEST_F(AsyncWriterTest, drops_records_which_do_not_fit)
+{
+  AsyncWriter writer(8, 0, false);
+  ASSERT_TRUE(writer.open(path_));
+  std::ostream out(&writer);
+  out << "too long for the buffer" << std::endl;
+  out << "short" << std::endl;
+  writer.close();
+
+  EXPECT_EQ(contents(), "short\n");
+  EXPECT_EQ(writer.dropped_records(), 1UL);
+  EXPECT_EQ(writer.dropped_bytes(), 24UL);
+}
+
+TEST_F(AsyncWriterTest, drops_whole_records)
+{
+  AsyncWriter writer(64, 0, false);
+  ASSERT_TRUE(writer.open(path_));
+  std::ostream out(&writer);
+  for (int i = 0; i < 1000; i++)
+    out << "record " << i << std::endl;
+  writer.close();
+
+  std::stringstream file(contents());
+  std::string line;
+  uint64_t lines = 0;
+  while (std::getline(file, line))
+  {
+    EXPECT_EQ(line.compare(0, 7, "record "), 0);
+    EXPECT_LT(std::stoi(line.substr(7)), 1000);
+    lines++;
+  }
+  EXPECT_EQ(lines + writer.dropped_records(), 1000UL);
+}
+
+TEST_F(AsyncWriterTest, blocks_instead_of_dropping)
+{
+  AsyncWriter writer(8, 0, false);
+  ASSERT_TRUE(writer.open(path_));
+  writer.set_blocking(true);
+  std::ostream out(&writer);
+  std::stringstream expected;
+  for (int i = 0; i < 100; i++)
+  {
+    out << "longer than the buffer " << i << std::endl;
+    expected << "longer than the buffer " << i << std::endl;
+  }
+  writer.close();
+
+  EXPECT_EQ(contents(), expected.str());
+  EXPECT_EQ(writer.dropped_records(), 0UL);
+}
+
+TEST_F(AsyncWriterTest, open_fails)
+{
+  AsyncWriter writer(1024 * 1024, 0, false);
+  EXPECT_FALSE(writer.open("/nonexistent/bpftrace-output"));
+}
+
+#ifdef HAVE_LIBZSTD
+TEST_F(AsyncWriterTest, compresses)
+{
+  AsyncWriter writer(1024 * 1024, 0, false, true);
+  ASSERT_TRUE(writer.open(path_));
+  std::ostream out(&writer);
+  std::stringstream expected;
+  for (int i = 0; i < 100; i++)
+  {
+    out << "record " << i << std::endl;
+    expected << "record " << i << std::endl;
+  }
+  writer.close();
+
+  std::string compressed = contents();
+  std::string decompressed;
+  ZSTD_DStream *stream = ZSTD_createDStream();
+  ZSTD_initDStream(stream);
+  ZSTD_inBuffer in = { compressed.data(), compressed.size(), 0 };
+  size_t ret = 0;
+  while (in.pos < in.size)
+  {
+    char buf[4096];
+    ZSTD_outBuffer out = { buf, sizeof(buf), 0 };
+    ret = ZSTD_decompressStream(stream, &out, &in);
+    ASSERT_FALSE(ZSTD_isError(ret));
+    decompressed.append(buf, out.pos);
+  }
+  ZSTD_freeDStream(stream);
+
+  // The frame was ended
+  EXPECT_EQ(ret, 0UL);
+  EXPECT_EQ(decompressed, expected.str());
+}
+#endif
+
+} // namespace async_writer
+} // namespace test
+} // namespace bpftrace
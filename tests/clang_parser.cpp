@@ -375,6 +375,34 @@ TEST(clang_parser, macro_preprocessor)
   EXPECT_EQ(macros["_UNDERSCORE"], "314");
 }
 
+TEST(clang_parser, bitfields)
+{
+  BPFtrace bpftrace;
+  parse("struct Foo { int a:8, b:8, c:16; }", bpftrace);
+
+  StructMap &structs = bpftrace.structs_;
+
+  ASSERT_EQ(structs.count("Foo"), 1U);
+  EXPECT_EQ(structs["Foo"].size, 4);
+  ASSERT_EQ(structs["Foo"].fields.size(), 3U);
+
+  EXPECT_TRUE(structs["Foo"].fields["a"].is_bitfield);
+  EXPECT_EQ(structs["Foo"].fields["a"].offset, 0);
+  EXPECT_EQ(structs["Foo"].fields["a"].bitfield.read_bytes, 1U);
+  EXPECT_EQ(structs["Foo"].fields["a"].bitfield.access_rshift, 0U);
+  EXPECT_EQ(structs["Foo"].fields["a"].bitfield.mask, 0xffU);
+
+  EXPECT_TRUE(structs["Foo"].fields["b"].is_bitfield);
+  EXPECT_EQ(structs["Foo"].fields["b"].offset, 1);
+  EXPECT_EQ(structs["Foo"].fields["b"].bitfield.read_bytes, 1U);
+  EXPECT_EQ(structs["Foo"].fields["b"].bitfield.mask, 0xffU);
+
+  EXPECT_TRUE(structs["Foo"].fields["c"].is_bitfield);
+  EXPECT_EQ(structs["Foo"].fields["c"].offset, 2);
+  EXPECT_EQ(structs["Foo"].fields["c"].bitfield.read_bytes, 2U);
+  EXPECT_EQ(structs["Foo"].fields["c"].bitfield.mask, 0xffffU);
+}
+
 TEST(clang_parser, parse_fail)
 {
   BPFtrace bpftrace;
@@ -466,6 +494,38 @@ TEST(clang_parser, btf)
   EXPECT_EQ(structs["Foo3"].fields["foo2"].offset, 8);
 }
 
+TEST(clang_parser, btf_accessed_pointers_only)
+{
+  char *path = strdup("/tmp/XXXXXX");
+  ASSERT_TRUE(path != NULL);
+
+  int fd = mkstemp(path);
+  ASSERT_TRUE(fd >= 0);
+
+  EXPECT_EQ(write(fd, btf_data, btf_data_len), btf_data_len);
+  close(fd);
+
+  ASSERT_EQ(setenv("BPFTRACE_BTF_TEST", path, true), 0);
+
+  BPFtrace bpftrace;
+  parse("", bpftrace, true,
+        "kprobe:sys_read {\n"
+        "  @x = ((struct Foo3 *) curtask)->foo1->a;\n"
+        "}");
+
+  // clear the environment
+  unsetenv("BPFTRACE_BTF_TEST");
+  std::remove(path);
+
+  // Foo2 is only reachable through foo2, which is never dereferenced
+  StructMap &structs = bpftrace.structs_;
+
+  ASSERT_EQ(structs.size(), 2U);
+  ASSERT_EQ(structs.count("Foo1"), 1U);
+  ASSERT_EQ(structs.count("Foo3"), 1U);
+  EXPECT_EQ(structs["Foo1"].fields.size(), 3U);
+}
+
 #endif // HAVE_LIBBPF_BTF_DUMP
 
 } // namespace clang_parser
@@ -6,17 +6,55 @@ namespace codegen {
 
 TEST(codegen, builtin_elapsed)
 {
-  /*
-   * TODO: add test. The problem that needs fixing first is that the codegen
-   * includes this line:
-   *
-   * %1 = add i64 %get_ns, -956821864668979
-   *
-   * That's the bpftrace epoch time, hardcoded in BPF. Which is what we want.
-   * But it varies between runs of bpftrace, so this line will change every
-   * time, causing the test to fail. We need a way to ignore this number
-   * in the test.
-   */
+  test("kprobe:f { @x = elapsed }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readnone) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %key = alloca i32, align 4
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %1 = bitcast i32* %key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i32 0, i32* %key, align 4
+  %elapsed_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i32* nonnull %key)
+  %elapsedcond = icmp eq i8* %elapsed_elem, null
+  br i1 %elapsedcond, label %elapsed.done, label %elapsed.found
+
+elapsed.found:                                    ; preds = %entry
+  %2 = bitcast i8* %elapsed_elem to i64*
+  %3 = load i64, i64* %2, align 8
+  br label %elapsed.done
+
+elapsed.done:                                     ; preds = %elapsed.found, %entry
+  %elapsed_start.0 = phi i64 [ %3, %elapsed.found ], [ 0, %entry ]
+  %get_ns = call i64 inttoptr (i64 5 to i64 ()*)()
+  %4 = sub i64 %get_ns, %elapsed_start.0
+  %5 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %5)
+  store i64 0, i64* %"@x_key", align 8
+  %6 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %6)
+  store i64 %4, i64* %"@x_val", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %5)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %6)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
 }
 
 } // namespace codegen
@@ -0,0 +1,52 @@
+#include "common.h"
+#include "../mocks.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+#ifdef HAVE_GET_ATTACH_COOKIE
+TEST(codegen, builtin_probe_attach_cookie)
+{
+  auto bpftrace = get_mock_bpftrace();
+  bpftrace->attach_cookie_ = true;
+
+  test(*bpftrace,
+      "kprobe:f* { @x = probe }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f*"(i8*) local_unnamed_addr section "s_kprobe:f*_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %get_attach_cookie = tail call i64 inttoptr (i64 174 to i64 (i8*)*)(i8* %0)
+  %1 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i64 0, i64* %"@x_key", align 8
+  %2 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %2)
+  store i64 %get_attach_cookie, i64* %"@x_val", align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %2)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+#endif // HAVE_GET_ATTACH_COOKIE
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "../mocks.h"
 
 namespace bpftrace {
 namespace test {
@@ -49,6 +50,62 @@ attributes #1 = { argmemonly nounwind }
 )EXPECTED");
 }
 
+TEST(codegen, builtin_probe_wild_multiple_matches)
+{
+  // Every match gets its own program, built from a single shared body
+  auto bpftrace = get_mock_bpftrace();
+
+  test(*bpftrace,
+      "kprobe:my_* { @x = probe }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:my_one"(i8* nocapture readnone) local_unnamed_addr section "s_kprobe:my_one_1" {
+entry:
+  %"@x_val.i" = alloca i64, align 8
+  %"@x_key.i" = alloca i64, align 8
+  %1 = bitcast i64* %"@x_key.i" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i64 0, i64* %"@x_key.i", align 8
+  %2 = bitcast i64* %"@x_val.i" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %2)
+  store i64 0, i64* %"@x_val.i", align 8
+  %pseudo.i = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem.i = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo.i, i64* nonnull %"@x_key.i", i64* nonnull %"@x_val.i", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %2)
+  ret i64 0
+}
+
+define i64 @"kprobe:my_two"(i8* nocapture readnone) local_unnamed_addr section "s_kprobe:my_two_2" {
+entry:
+  %"@x_val.i" = alloca i64, align 8
+  %"@x_key.i" = alloca i64, align 8
+  %1 = bitcast i64* %"@x_key.i" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i64 0, i64* %"@x_key.i", align 8
+  %2 = bitcast i64* %"@x_val.i" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %2)
+  store i64 1, i64* %"@x_val.i", align 8
+  %pseudo.i = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem.i = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo.i, i64* nonnull %"@x_key.i", i64* nonnull %"@x_val.i", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %2)
+  ret i64 0
+}
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
 } // namespace codegen
 } // namespace test
 } // namespace bpftrace
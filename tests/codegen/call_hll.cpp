@@ -0,0 +1,101 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_hll)
+{
+  test("kprobe:f { @x = hll(arg0); }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readonly) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %1 = getelementptr i8, i8* %0, i64 112
+  %arg0 = load i64, i8* %1, align 8
+  %2 = mul i64 %arg0, -7046029254386353131
+  %3 = lshr i64 %2, 32
+  %4 = xor i64 %3, %2
+  %5 = mul i64 %4, -2960836687051489901
+  %6 = lshr i64 %5, 32
+  %7 = xor i64 %6, %5
+  %8 = lshr i64 %5, 56
+  %9 = shl i64 %7, 8
+  %10 = icmp ult i64 %9, 4294967296
+  %11 = select i1 %10, i64 33, i64 1
+  %12 = shl i64 %7, 40
+  %13 = select i1 %10, i64 %12, i64 %9
+  %14 = icmp ult i64 %13, 281474976710656
+  %15 = or i64 %11, 16
+  %16 = select i1 %14, i64 %15, i64 %11
+  %17 = shl i64 %13, 16
+  %18 = select i1 %14, i64 %17, i64 %13
+  %19 = icmp ult i64 %18, 72057594037927936
+  %20 = or i64 %16, 8
+  %21 = select i1 %19, i64 %20, i64 %16
+  %22 = shl i64 %18, 8
+  %23 = select i1 %19, i64 %22, i64 %18
+  %24 = icmp ult i64 %23, 1152921504606846976
+  %25 = or i64 %21, 4
+  %26 = select i1 %24, i64 %25, i64 %21
+  %27 = shl i64 %23, 4
+  %28 = select i1 %24, i64 %27, i64 %23
+  %29 = icmp ult i64 %28, 4611686018427387904
+  %30 = add i64 %26, 2
+  %31 = select i1 %29, i64 %30, i64 %26
+  %32 = shl i64 %28, 2
+  %33 = select i1 %29, i64 %32, i64 %28
+  %34 = xor i64 %33, -1
+  %.lobit = lshr i64 %34, 63
+  %35 = add i64 %.lobit, %31
+  %36 = icmp ult i64 %35, 57
+  %37 = select i1 %36, i64 %35, i64 57
+  %38 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %38)
+  store i64 %8, i64* %"@x_key", align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i64* nonnull %"@x_key")
+  %map_lookup_cond = icmp eq i8* %lookup_elem, null
+  br i1 %map_lookup_cond, label %lookup_merge, label %lookup_success
+
+lookup_success:                                   ; preds = %entry
+  %39 = load i64, i8* %lookup_elem, align 8
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %entry, %lookup_success
+  %lookup_elem_val.0 = phi i64 [ %39, %lookup_success ], [ 0, %entry ]
+  %40 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %40)
+  %41 = icmp ugt i64 %37, %lookup_elem_val.0
+  br i1 %41, label %hll.gt, label %hll.le
+
+hll.gt:                                           ; preds = %lookup_merge
+  store i64 %37, i64* %"@x_val", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  br label %hll.le
+
+hll.le:                                           ; preds = %hll.gt, %lookup_merge
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %38)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %40)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -0,0 +1,97 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_quantiles)
+{
+  test("kprobe:f { @x = quantiles(arg0); }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readonly) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %1 = getelementptr i8, i8* %0, i64 112
+  %arg0 = load i64, i8* %1, align 8
+  %2 = icmp slt i64 %arg0, 0
+  br i1 %2, label %loglinear.exit, label %quantiles.is_not_less_than_zero.i
+
+quantiles.is_not_less_than_zero.i:                ; preds = %entry
+  %3 = icmp ult i64 %arg0, 32
+  br i1 %3, label %loglinear.exit, label %quantiles.is_not_small.i
+
+quantiles.is_not_small.i:                         ; preds = %quantiles.is_not_less_than_zero.i
+  %4 = icmp ugt i64 %arg0, 4294967295
+  %5 = select i1 %4, i64 32, i64 0
+  %6 = lshr i64 %arg0, %5
+  %7 = icmp ugt i64 %6, 65535
+  %8 = select i1 %7, i64 16, i64 0
+  %9 = lshr i64 %6, %8
+  %10 = or i64 %8, %5
+  %11 = icmp ugt i64 %9, 255
+  %12 = select i1 %11, i64 8, i64 0
+  %13 = lshr i64 %9, %12
+  %14 = or i64 %10, %12
+  %15 = icmp ugt i64 %13, 15
+  %16 = select i1 %15, i64 4, i64 0
+  %17 = lshr i64 %13, %16
+  %18 = or i64 %14, %16
+  %19 = icmp ugt i64 %17, 3
+  %20 = select i1 %19, i64 2, i64 0
+  %21 = lshr i64 %17, %20
+  %22 = or i64 %18, %20
+  %23 = icmp ugt i64 %21, 1
+  %24 = zext i1 %23 to i64
+  %25 = or i64 %22, %24
+  %26 = shl nuw nsw i64 %25, 4
+  %27 = add nsw i64 %25, -4
+  %28 = lshr i64 %arg0, %27
+  %29 = add i64 %26, -64
+  %30 = add i64 %29, %28
+  br label %loglinear.exit
+
+loglinear.exit:                                   ; preds = %quantiles.is_not_less_than_zero.i, %entry, %quantiles.is_not_small.i
+  %loglinear2 = phi i64 [ %30, %quantiles.is_not_small.i ], [ 0, %entry ], [ %arg0, %quantiles.is_not_less_than_zero.i ]
+  %31 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %31)
+  store i64 %loglinear2, i64* %"@x_key", align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i64* nonnull %"@x_key")
+  %map_lookup_cond = icmp eq i8* %lookup_elem, null
+  br i1 %map_lookup_cond, label %lookup_merge, label %lookup_success
+
+lookup_success:                                   ; preds = %loglinear.exit
+  %32 = load i64, i8* %lookup_elem, align 8
+  %phitmp = add i64 %32, 1
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %loglinear.exit, %lookup_success
+  %lookup_elem_val.0 = phi i64 [ %phitmp, %lookup_success ], [ 1, %loglinear.exit ]
+  %33 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %33)
+  store i64 %lookup_elem_val.0, i64* %"@x_val", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %31)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %33)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
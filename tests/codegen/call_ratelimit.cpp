@@ -0,0 +1,81 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_ratelimit)
+{
+  test("kprobe:f { @x = ratelimit(10); }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readnone) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %key = alloca i32, align 4
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %1 = bitcast i32* %key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i32 0, i32* %key, align 4
+  %ratelimit_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i32* nonnull %key)
+  %ratelimitcond = icmp eq i8* %ratelimit_elem, null
+  br i1 %ratelimitcond, label %ratelimit.done, label %ratelimit.found
+
+ratelimit.found:                                  ; preds = %entry
+  %2 = bitcast i8* %ratelimit_elem to i64*
+  %3 = getelementptr i8, i8* %ratelimit_elem, i64 8
+  %4 = bitcast i8* %3 to i64*
+  %5 = load i64, i64* %2, align 8
+  %6 = load i64, i64* %4, align 8
+  %get_ns = call i64 inttoptr (i64 5 to i64 ()*)()
+  %7 = sub i64 %get_ns, %6
+  %8 = icmp ugt i64 %7, 999999999
+  %9 = mul i64 %7, 10
+  %10 = udiv i64 %9, 1000000000
+  %11 = add i64 %10, %5
+  %12 = icmp ult i64 %11, 10
+  %13 = select i1 %12, i64 %11, i64 10
+  %14 = select i1 %8, i64 10, i64 %13
+  %15 = mul nuw nsw i64 %10, 100000000
+  %16 = add i64 %15, %6
+  %17 = select i1 %8, i64 %get_ns, i64 %16
+  %18 = icmp ne i64 %14, 0
+  %19 = add nsw i64 %14, -1
+  %20 = select i1 %18, i64 %19, i64 0
+  store i64 %20, i64* %2, align 8
+  store i64 %17, i64* %4, align 8
+  %21 = zext i1 %18 to i64
+  br label %ratelimit.done
+
+ratelimit.done:                                   ; preds = %ratelimit.found, %entry
+  %ratelimit_result.0 = phi i64 [ %21, %ratelimit.found ], [ 0, %entry ]
+  %22 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %22)
+  store i64 0, i64* %"@x_key", align 8
+  %23 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %23)
+  store i64 %ratelimit_result.0, i64* %"@x_val", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %22)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %23)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
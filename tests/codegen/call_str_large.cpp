@@ -0,0 +1,122 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_str_large_printf)
+{
+  // Strings over 200 bytes and the printf() arguments are built in the scratch map
+  BPFtrace bpftrace;
+  bpftrace.strlen_ = 256;
+
+  test(bpftrace,
+      "kprobe:f { printf(\"%s\\n\", str(arg0)) }",
+
+R"EXPECTED(%printf_t = type { i64, [256 x i8] }
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8*) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %key2 = alloca i32, align 4
+  %key = alloca i32, align 4
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %1 = bitcast i32* %key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i32 0, i32* %key, align 4
+  %scratch_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i32* nonnull %key)
+  %scratchcond = icmp eq i8* %scratch_elem, null
+  br i1 %scratchcond, label %scratch.missing, label %scratch.found
+
+scratch.found:                                    ; preds = %entry
+  %2 = bitcast i8* %scratch_elem to i64*
+  store i64 0, i64* %2, align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %3 = bitcast i32* %key2 to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %3)
+  store i32 1, i32* %key2, align 4
+  %scratch_elem3 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo1, i32* nonnull %key2)
+  %scratchcond6 = icmp eq i8* %scratch_elem3, null
+  br i1 %scratchcond6, label %scratch.missing, label %scratch.found4
+
+scratch.missing:                                  ; preds = %scratch.found, %entry
+  ret i64 0
+
+scratch.found4:                                   ; preds = %scratch.found
+  %4 = bitcast i8* %scratch_elem to %printf_t*
+  %5 = getelementptr i8, i8* %0, i64 112
+  %arg0 = load i64, i8* %5, align 8
+  %probe_read_str = call i64 inttoptr (i64 45 to i64 (i8*, i64, i8*)*)(i8* nonnull %scratch_elem3, i64 256, i64 %arg0)
+  %6 = getelementptr i8, i8* %scratch_elem, i64 8
+  %7 = bitcast i8* %6 to [256 x i8]*
+  %probe_read = call i64 inttoptr (i64 4 to i64 (i8*, i64, i8*)*)([256 x i8]* %7, i64 256, i8* nonnull %scratch_elem3)
+  %pseudo7 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %get_cpu_id = call i64 inttoptr (i64 8 to i64 ()*)()
+  %perf_event_output = call i64 inttoptr (i64 25 to i64 (i8*, i64, i64, %printf_t*, i64)*)(i8* %0, i64 %pseudo7, i64 %get_cpu_id, %printf_t* nonnull %4, i64 264)
+  ret i64 0
+}
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+TEST(codegen, call_str_large_map)
+{
+  // The map value is updated straight from the scratch map
+  BPFtrace bpftrace;
+  bpftrace.strlen_ = 256;
+
+  test(bpftrace,
+      "kprobe:f { @x = str(arg0) }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readonly) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_key" = alloca i64, align 8
+  %key = alloca i32, align 4
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %1 = bitcast i32* %key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i32 0, i32* %key, align 4
+  %scratch_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i32* nonnull %key)
+  %scratchcond = icmp eq i8* %scratch_elem, null
+  br i1 %scratchcond, label %scratch.missing, label %scratch.found
+
+scratch.missing:                                  ; preds = %entry
+  ret i64 0
+
+scratch.found:                                    ; preds = %entry
+  %2 = getelementptr i8, i8* %0, i64 112
+  %arg0 = load i64, i8* %2, align 8
+  %probe_read_str = call i64 inttoptr (i64 45 to i64 (i8*, i64, i8*)*)(i8* nonnull %scratch_elem, i64 256, i64 %arg0)
+  %3 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %3)
+  store i64 0, i64* %"@x_key", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i64* nonnull %"@x_key", i8* nonnull %scratch_elem, i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %3)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
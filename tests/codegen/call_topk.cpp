@@ -0,0 +1,645 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_topk)
+{
+  test("kprobe:f { @x = topk(arg0); }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8* nocapture readonly) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i32, align 4
+  %1 = getelementptr i8, i8* %0, i64 112
+  %arg0 = load i64, i8* %1, align 8
+  %2 = mul i64 %arg0, -7046029254386353131
+  %3 = lshr i64 %2, 32
+  %4 = xor i64 %3, %2
+  %5 = mul i64 %4, -2960836687051489901
+  %6 = lshr i64 %5, 32
+  %7 = xor i64 %6, %5
+  %8 = bitcast i32* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %8)
+  %9 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %9)
+  %10 = trunc i64 %7 to i32
+  %11 = and i32 %10, 1023
+  store i32 %11, i32* %"@x_key", align 4
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, i32* nonnull %"@x_key")
+  %map_lookup_cond = icmp eq i8* %lookup_elem, null
+  br i1 %map_lookup_cond, label %lookup_merge, label %lookup_success
+
+lookup_success:                                   ; preds = %entry
+  %12 = load i64, i8* %lookup_elem, align 8
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %entry, %lookup_success
+  %lookup_elem_val.0 = phi i64 [ %12, %lookup_success ], [ 0, %entry ]
+  %13 = add i64 %lookup_elem_val.0, 1
+  store i64 %13, i64* %"@x_val", align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo1, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  %14 = lshr i32 %10, 16
+  %15 = and i32 %14, 1023
+  %16 = or i32 %15, 1024
+  store i32 %16, i32* %"@x_key", align 4
+  %pseudo2 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem3 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo2, i32* nonnull %"@x_key")
+  %map_lookup_cond8 = icmp eq i8* %lookup_elem3, null
+  br i1 %map_lookup_cond8, label %lookup_merge6, label %lookup_success4
+
+lookup_success4:                                  ; preds = %lookup_merge
+  %17 = load i64, i8* %lookup_elem3, align 8
+  br label %lookup_merge6
+
+lookup_merge6:                                    ; preds = %lookup_merge, %lookup_success4
+  %lookup_elem_val7.0 = phi i64 [ %17, %lookup_success4 ], [ 0, %lookup_merge ]
+  %18 = add i64 %lookup_elem_val7.0, 1
+  store i64 %18, i64* %"@x_val", align 8
+  %pseudo9 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem10 = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo9, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  %19 = icmp ult i64 %18, %13
+  %20 = select i1 %19, i64 %18, i64 %13
+  %21 = trunc i64 %6 to i32
+  %22 = and i32 %21, 1023
+  %23 = or i32 %22, 2048
+  store i32 %23, i32* %"@x_key", align 4
+  %pseudo11 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem12 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo11, i32* nonnull %"@x_key")
+  %map_lookup_cond17 = icmp eq i8* %lookup_elem12, null
+  br i1 %map_lookup_cond17, label %lookup_merge15, label %lookup_success13
+
+lookup_success13:                                 ; preds = %lookup_merge6
+  %24 = load i64, i8* %lookup_elem12, align 8
+  br label %lookup_merge15
+
+lookup_merge15:                                   ; preds = %lookup_merge6, %lookup_success13
+  %lookup_elem_val16.0 = phi i64 [ %24, %lookup_success13 ], [ 0, %lookup_merge6 ]
+  %25 = add i64 %lookup_elem_val16.0, 1
+  store i64 %25, i64* %"@x_val", align 8
+  %pseudo18 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem19 = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo18, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  %26 = icmp ult i64 %25, %20
+  %27 = select i1 %26, i64 %25, i64 %20
+  %28 = lshr i64 %5, 48
+  %29 = trunc i64 %28 to i32
+  %30 = and i32 %29, 1023
+  %31 = or i32 %30, 3072
+  store i32 %31, i32* %"@x_key", align 4
+  %pseudo20 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem21 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo20, i32* nonnull %"@x_key")
+  %map_lookup_cond26 = icmp eq i8* %lookup_elem21, null
+  br i1 %map_lookup_cond26, label %lookup_merge24, label %lookup_success22
+
+lookup_success22:                                 ; preds = %lookup_merge15
+  %32 = load i64, i8* %lookup_elem21, align 8
+  br label %lookup_merge24
+
+lookup_merge24:                                   ; preds = %lookup_merge15, %lookup_success22
+  %lookup_elem_val25.0 = phi i64 [ %32, %lookup_success22 ], [ 0, %lookup_merge15 ]
+  %33 = add i64 %lookup_elem_val25.0, 1
+  store i64 %33, i64* %"@x_val", align 8
+  %pseudo27 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem28 = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo27, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  %34 = icmp ult i64 %33, %27
+  %35 = select i1 %34, i64 %33, i64 %27
+  store i32 4096, i32* %"@x_key", align 4
+  %pseudo29 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem30 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo29, i32* nonnull %"@x_key")
+  %map_lookup_cond35 = icmp eq i8* %lookup_elem30, null
+  br i1 %map_lookup_cond35, label %lookup_merge33, label %lookup_success31
+
+lookup_success31:                                 ; preds = %lookup_merge24
+  %36 = load i64, i8* %lookup_elem30, align 8
+  br label %lookup_merge33
+
+lookup_merge33:                                   ; preds = %lookup_merge24, %lookup_success31
+  %lookup_elem_val34.0 = phi i64 [ %36, %lookup_success31 ], [ 0, %lookup_merge24 ]
+  store i32 4097, i32* %"@x_key", align 4
+  %pseudo36 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem37 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo36, i32* nonnull %"@x_key")
+  %map_lookup_cond42 = icmp eq i8* %lookup_elem37, null
+  br i1 %map_lookup_cond42, label %lookup_merge40, label %lookup_success38
+
+lookup_success38:                                 ; preds = %lookup_merge33
+  %37 = load i64, i8* %lookup_elem37, align 8
+  br label %lookup_merge40
+
+lookup_merge40:                                   ; preds = %lookup_merge33, %lookup_success38
+  %lookup_elem_val41.0 = phi i64 [ %37, %lookup_success38 ], [ 0, %lookup_merge33 ]
+  %38 = icmp eq i64 %lookup_elem_val41.0, 0
+  %39 = icmp ne i64 %lookup_elem_val34.0, %arg0
+  %not. = or i1 %39, %38
+  %40 = sext i1 %not. to i64
+  store i32 4098, i32* %"@x_key", align 4
+  %pseudo43 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem44 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo43, i32* nonnull %"@x_key")
+  %map_lookup_cond49 = icmp eq i8* %lookup_elem44, null
+  br i1 %map_lookup_cond49, label %lookup_merge47, label %lookup_success45
+
+lookup_success45:                                 ; preds = %lookup_merge40
+  %41 = load i64, i8* %lookup_elem44, align 8
+  br label %lookup_merge47
+
+lookup_merge47:                                   ; preds = %lookup_merge40, %lookup_success45
+  %lookup_elem_val48.0 = phi i64 [ %41, %lookup_success45 ], [ 0, %lookup_merge40 ]
+  store i32 4099, i32* %"@x_key", align 4
+  %pseudo50 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem51 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo50, i32* nonnull %"@x_key")
+  %map_lookup_cond56 = icmp eq i8* %lookup_elem51, null
+  br i1 %map_lookup_cond56, label %lookup_merge54, label %lookup_success52
+
+lookup_success52:                                 ; preds = %lookup_merge47
+  %42 = load i64, i8* %lookup_elem51, align 8
+  br label %lookup_merge54
+
+lookup_merge54:                                   ; preds = %lookup_merge47, %lookup_success52
+  %lookup_elem_val55.0 = phi i64 [ %42, %lookup_success52 ], [ 0, %lookup_merge47 ]
+  %43 = icmp ne i64 %lookup_elem_val55.0, 0
+  %44 = icmp eq i64 %lookup_elem_val48.0, %arg0
+  %45 = and i1 %44, %43
+  %46 = select i1 %45, i64 1, i64 %40
+  %47 = icmp ult i64 %lookup_elem_val55.0, %lookup_elem_val41.0
+  %48 = zext i1 %47 to i64
+  %49 = select i1 %47, i64 %lookup_elem_val55.0, i64 %lookup_elem_val41.0
+  store i32 4100, i32* %"@x_key", align 4
+  %pseudo57 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem58 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo57, i32* nonnull %"@x_key")
+  %map_lookup_cond63 = icmp eq i8* %lookup_elem58, null
+  br i1 %map_lookup_cond63, label %lookup_merge61, label %lookup_success59
+
+lookup_success59:                                 ; preds = %lookup_merge54
+  %50 = load i64, i8* %lookup_elem58, align 8
+  br label %lookup_merge61
+
+lookup_merge61:                                   ; preds = %lookup_merge54, %lookup_success59
+  %lookup_elem_val62.0 = phi i64 [ %50, %lookup_success59 ], [ 0, %lookup_merge54 ]
+  store i32 4101, i32* %"@x_key", align 4
+  %pseudo64 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem65 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo64, i32* nonnull %"@x_key")
+  %map_lookup_cond70 = icmp eq i8* %lookup_elem65, null
+  br i1 %map_lookup_cond70, label %lookup_merge68, label %lookup_success66
+
+lookup_success66:                                 ; preds = %lookup_merge61
+  %51 = load i64, i8* %lookup_elem65, align 8
+  br label %lookup_merge68
+
+lookup_merge68:                                   ; preds = %lookup_merge61, %lookup_success66
+  %lookup_elem_val69.0 = phi i64 [ %51, %lookup_success66 ], [ 0, %lookup_merge61 ]
+  %52 = icmp ne i64 %lookup_elem_val69.0, 0
+  %53 = icmp eq i64 %lookup_elem_val62.0, %arg0
+  %54 = and i1 %53, %52
+  %55 = select i1 %54, i64 2, i64 %46
+  %56 = icmp ult i64 %lookup_elem_val69.0, %49
+  %57 = select i1 %56, i64 2, i64 %48
+  %58 = select i1 %56, i64 %lookup_elem_val69.0, i64 %49
+  store i32 4102, i32* %"@x_key", align 4
+  %pseudo71 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem72 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo71, i32* nonnull %"@x_key")
+  %map_lookup_cond77 = icmp eq i8* %lookup_elem72, null
+  br i1 %map_lookup_cond77, label %lookup_merge75, label %lookup_success73
+
+lookup_success73:                                 ; preds = %lookup_merge68
+  %59 = load i64, i8* %lookup_elem72, align 8
+  br label %lookup_merge75
+
+lookup_merge75:                                   ; preds = %lookup_merge68, %lookup_success73
+  %lookup_elem_val76.0 = phi i64 [ %59, %lookup_success73 ], [ 0, %lookup_merge68 ]
+  store i32 4103, i32* %"@x_key", align 4
+  %pseudo78 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem79 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo78, i32* nonnull %"@x_key")
+  %map_lookup_cond84 = icmp eq i8* %lookup_elem79, null
+  br i1 %map_lookup_cond84, label %lookup_merge82, label %lookup_success80
+
+lookup_success80:                                 ; preds = %lookup_merge75
+  %60 = load i64, i8* %lookup_elem79, align 8
+  br label %lookup_merge82
+
+lookup_merge82:                                   ; preds = %lookup_merge75, %lookup_success80
+  %lookup_elem_val83.0 = phi i64 [ %60, %lookup_success80 ], [ 0, %lookup_merge75 ]
+  %61 = icmp ne i64 %lookup_elem_val83.0, 0
+  %62 = icmp eq i64 %lookup_elem_val76.0, %arg0
+  %63 = and i1 %62, %61
+  %64 = select i1 %63, i64 3, i64 %55
+  %65 = icmp ult i64 %lookup_elem_val83.0, %58
+  %66 = select i1 %65, i64 3, i64 %57
+  %67 = select i1 %65, i64 %lookup_elem_val83.0, i64 %58
+  store i32 4104, i32* %"@x_key", align 4
+  %pseudo85 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem86 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo85, i32* nonnull %"@x_key")
+  %map_lookup_cond91 = icmp eq i8* %lookup_elem86, null
+  br i1 %map_lookup_cond91, label %lookup_merge89, label %lookup_success87
+
+lookup_success87:                                 ; preds = %lookup_merge82
+  %68 = load i64, i8* %lookup_elem86, align 8
+  br label %lookup_merge89
+
+lookup_merge89:                                   ; preds = %lookup_merge82, %lookup_success87
+  %lookup_elem_val90.0 = phi i64 [ %68, %lookup_success87 ], [ 0, %lookup_merge82 ]
+  store i32 4105, i32* %"@x_key", align 4
+  %pseudo92 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem93 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo92, i32* nonnull %"@x_key")
+  %map_lookup_cond98 = icmp eq i8* %lookup_elem93, null
+  br i1 %map_lookup_cond98, label %lookup_merge96, label %lookup_success94
+
+lookup_success94:                                 ; preds = %lookup_merge89
+  %69 = load i64, i8* %lookup_elem93, align 8
+  br label %lookup_merge96
+
+lookup_merge96:                                   ; preds = %lookup_merge89, %lookup_success94
+  %lookup_elem_val97.0 = phi i64 [ %69, %lookup_success94 ], [ 0, %lookup_merge89 ]
+  %70 = icmp ne i64 %lookup_elem_val97.0, 0
+  %71 = icmp eq i64 %lookup_elem_val90.0, %arg0
+  %72 = and i1 %71, %70
+  %73 = select i1 %72, i64 4, i64 %64
+  %74 = icmp ult i64 %lookup_elem_val97.0, %67
+  %75 = select i1 %74, i64 4, i64 %66
+  %76 = select i1 %74, i64 %lookup_elem_val97.0, i64 %67
+  store i32 4106, i32* %"@x_key", align 4
+  %pseudo99 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem100 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo99, i32* nonnull %"@x_key")
+  %map_lookup_cond105 = icmp eq i8* %lookup_elem100, null
+  br i1 %map_lookup_cond105, label %lookup_merge103, label %lookup_success101
+
+lookup_success101:                                ; preds = %lookup_merge96
+  %77 = load i64, i8* %lookup_elem100, align 8
+  br label %lookup_merge103
+
+lookup_merge103:                                  ; preds = %lookup_merge96, %lookup_success101
+  %lookup_elem_val104.0 = phi i64 [ %77, %lookup_success101 ], [ 0, %lookup_merge96 ]
+  store i32 4107, i32* %"@x_key", align 4
+  %pseudo106 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem107 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo106, i32* nonnull %"@x_key")
+  %map_lookup_cond112 = icmp eq i8* %lookup_elem107, null
+  br i1 %map_lookup_cond112, label %lookup_merge110, label %lookup_success108
+
+lookup_success108:                                ; preds = %lookup_merge103
+  %78 = load i64, i8* %lookup_elem107, align 8
+  br label %lookup_merge110
+
+lookup_merge110:                                  ; preds = %lookup_merge103, %lookup_success108
+  %lookup_elem_val111.0 = phi i64 [ %78, %lookup_success108 ], [ 0, %lookup_merge103 ]
+  %79 = icmp ne i64 %lookup_elem_val111.0, 0
+  %80 = icmp eq i64 %lookup_elem_val104.0, %arg0
+  %81 = and i1 %80, %79
+  %82 = select i1 %81, i64 5, i64 %73
+  %83 = icmp ult i64 %lookup_elem_val111.0, %76
+  %84 = select i1 %83, i64 5, i64 %75
+  %85 = select i1 %83, i64 %lookup_elem_val111.0, i64 %76
+  store i32 4108, i32* %"@x_key", align 4
+  %pseudo113 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem114 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo113, i32* nonnull %"@x_key")
+  %map_lookup_cond119 = icmp eq i8* %lookup_elem114, null
+  br i1 %map_lookup_cond119, label %lookup_merge117, label %lookup_success115
+
+lookup_success115:                                ; preds = %lookup_merge110
+  %86 = load i64, i8* %lookup_elem114, align 8
+  br label %lookup_merge117
+
+lookup_merge117:                                  ; preds = %lookup_merge110, %lookup_success115
+  %lookup_elem_val118.0 = phi i64 [ %86, %lookup_success115 ], [ 0, %lookup_merge110 ]
+  store i32 4109, i32* %"@x_key", align 4
+  %pseudo120 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem121 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo120, i32* nonnull %"@x_key")
+  %map_lookup_cond126 = icmp eq i8* %lookup_elem121, null
+  br i1 %map_lookup_cond126, label %lookup_merge124, label %lookup_success122
+
+lookup_success122:                                ; preds = %lookup_merge117
+  %87 = load i64, i8* %lookup_elem121, align 8
+  br label %lookup_merge124
+
+lookup_merge124:                                  ; preds = %lookup_merge117, %lookup_success122
+  %lookup_elem_val125.0 = phi i64 [ %87, %lookup_success122 ], [ 0, %lookup_merge117 ]
+  %88 = icmp ne i64 %lookup_elem_val125.0, 0
+  %89 = icmp eq i64 %lookup_elem_val118.0, %arg0
+  %90 = and i1 %89, %88
+  %91 = select i1 %90, i64 6, i64 %82
+  %92 = icmp ult i64 %lookup_elem_val125.0, %85
+  %93 = select i1 %92, i64 6, i64 %84
+  %94 = select i1 %92, i64 %lookup_elem_val125.0, i64 %85
+  store i32 4110, i32* %"@x_key", align 4
+  %pseudo127 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem128 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo127, i32* nonnull %"@x_key")
+  %map_lookup_cond133 = icmp eq i8* %lookup_elem128, null
+  br i1 %map_lookup_cond133, label %lookup_merge131, label %lookup_success129
+
+lookup_success129:                                ; preds = %lookup_merge124
+  %95 = load i64, i8* %lookup_elem128, align 8
+  br label %lookup_merge131
+
+lookup_merge131:                                  ; preds = %lookup_merge124, %lookup_success129
+  %lookup_elem_val132.0 = phi i64 [ %95, %lookup_success129 ], [ 0, %lookup_merge124 ]
+  store i32 4111, i32* %"@x_key", align 4
+  %pseudo134 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem135 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo134, i32* nonnull %"@x_key")
+  %map_lookup_cond140 = icmp eq i8* %lookup_elem135, null
+  br i1 %map_lookup_cond140, label %lookup_merge138, label %lookup_success136
+
+lookup_success136:                                ; preds = %lookup_merge131
+  %96 = load i64, i8* %lookup_elem135, align 8
+  br label %lookup_merge138
+
+lookup_merge138:                                  ; preds = %lookup_merge131, %lookup_success136
+  %lookup_elem_val139.0 = phi i64 [ %96, %lookup_success136 ], [ 0, %lookup_merge131 ]
+  %97 = icmp ne i64 %lookup_elem_val139.0, 0
+  %98 = icmp eq i64 %lookup_elem_val132.0, %arg0
+  %99 = and i1 %98, %97
+  %100 = select i1 %99, i64 7, i64 %91
+  %101 = icmp ult i64 %lookup_elem_val139.0, %94
+  %102 = select i1 %101, i64 7, i64 %93
+  %103 = select i1 %101, i64 %lookup_elem_val139.0, i64 %94
+  store i32 4112, i32* %"@x_key", align 4
+  %pseudo141 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem142 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo141, i32* nonnull %"@x_key")
+  %map_lookup_cond147 = icmp eq i8* %lookup_elem142, null
+  br i1 %map_lookup_cond147, label %lookup_merge145, label %lookup_success143
+
+lookup_success143:                                ; preds = %lookup_merge138
+  %104 = load i64, i8* %lookup_elem142, align 8
+  br label %lookup_merge145
+
+lookup_merge145:                                  ; preds = %lookup_merge138, %lookup_success143
+  %lookup_elem_val146.0 = phi i64 [ %104, %lookup_success143 ], [ 0, %lookup_merge138 ]
+  store i32 4113, i32* %"@x_key", align 4
+  %pseudo148 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem149 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo148, i32* nonnull %"@x_key")
+  %map_lookup_cond154 = icmp eq i8* %lookup_elem149, null
+  br i1 %map_lookup_cond154, label %lookup_merge152, label %lookup_success150
+
+lookup_success150:                                ; preds = %lookup_merge145
+  %105 = load i64, i8* %lookup_elem149, align 8
+  br label %lookup_merge152
+
+lookup_merge152:                                  ; preds = %lookup_merge145, %lookup_success150
+  %lookup_elem_val153.0 = phi i64 [ %105, %lookup_success150 ], [ 0, %lookup_merge145 ]
+  %106 = icmp ne i64 %lookup_elem_val153.0, 0
+  %107 = icmp eq i64 %lookup_elem_val146.0, %arg0
+  %108 = and i1 %107, %106
+  %109 = select i1 %108, i64 8, i64 %100
+  %110 = icmp ult i64 %lookup_elem_val153.0, %103
+  %111 = select i1 %110, i64 8, i64 %102
+  %112 = select i1 %110, i64 %lookup_elem_val153.0, i64 %103
+  store i32 4114, i32* %"@x_key", align 4
+  %pseudo155 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem156 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo155, i32* nonnull %"@x_key")
+  %map_lookup_cond161 = icmp eq i8* %lookup_elem156, null
+  br i1 %map_lookup_cond161, label %lookup_merge159, label %lookup_success157
+
+lookup_success157:                                ; preds = %lookup_merge152
+  %113 = load i64, i8* %lookup_elem156, align 8
+  br label %lookup_merge159
+
+lookup_merge159:                                  ; preds = %lookup_merge152, %lookup_success157
+  %lookup_elem_val160.0 = phi i64 [ %113, %lookup_success157 ], [ 0, %lookup_merge152 ]
+  store i32 4115, i32* %"@x_key", align 4
+  %pseudo162 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem163 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo162, i32* nonnull %"@x_key")
+  %map_lookup_cond168 = icmp eq i8* %lookup_elem163, null
+  br i1 %map_lookup_cond168, label %lookup_merge166, label %lookup_success164
+
+lookup_success164:                                ; preds = %lookup_merge159
+  %114 = load i64, i8* %lookup_elem163, align 8
+  br label %lookup_merge166
+
+lookup_merge166:                                  ; preds = %lookup_merge159, %lookup_success164
+  %lookup_elem_val167.0 = phi i64 [ %114, %lookup_success164 ], [ 0, %lookup_merge159 ]
+  %115 = icmp ne i64 %lookup_elem_val167.0, 0
+  %116 = icmp eq i64 %lookup_elem_val160.0, %arg0
+  %117 = and i1 %116, %115
+  %118 = select i1 %117, i64 9, i64 %109
+  %119 = icmp ult i64 %lookup_elem_val167.0, %112
+  %120 = select i1 %119, i64 9, i64 %111
+  %121 = select i1 %119, i64 %lookup_elem_val167.0, i64 %112
+  store i32 4116, i32* %"@x_key", align 4
+  %pseudo169 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem170 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo169, i32* nonnull %"@x_key")
+  %map_lookup_cond175 = icmp eq i8* %lookup_elem170, null
+  br i1 %map_lookup_cond175, label %lookup_merge173, label %lookup_success171
+
+lookup_success171:                                ; preds = %lookup_merge166
+  %122 = load i64, i8* %lookup_elem170, align 8
+  br label %lookup_merge173
+
+lookup_merge173:                                  ; preds = %lookup_merge166, %lookup_success171
+  %lookup_elem_val174.0 = phi i64 [ %122, %lookup_success171 ], [ 0, %lookup_merge166 ]
+  store i32 4117, i32* %"@x_key", align 4
+  %pseudo176 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem177 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo176, i32* nonnull %"@x_key")
+  %map_lookup_cond182 = icmp eq i8* %lookup_elem177, null
+  br i1 %map_lookup_cond182, label %lookup_merge180, label %lookup_success178
+
+lookup_success178:                                ; preds = %lookup_merge173
+  %123 = load i64, i8* %lookup_elem177, align 8
+  br label %lookup_merge180
+
+lookup_merge180:                                  ; preds = %lookup_merge173, %lookup_success178
+  %lookup_elem_val181.0 = phi i64 [ %123, %lookup_success178 ], [ 0, %lookup_merge173 ]
+  %124 = icmp ne i64 %lookup_elem_val181.0, 0
+  %125 = icmp eq i64 %lookup_elem_val174.0, %arg0
+  %126 = and i1 %125, %124
+  %127 = select i1 %126, i64 10, i64 %118
+  %128 = icmp ult i64 %lookup_elem_val181.0, %121
+  %129 = select i1 %128, i64 10, i64 %120
+  %130 = select i1 %128, i64 %lookup_elem_val181.0, i64 %121
+  store i32 4118, i32* %"@x_key", align 4
+  %pseudo183 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem184 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo183, i32* nonnull %"@x_key")
+  %map_lookup_cond189 = icmp eq i8* %lookup_elem184, null
+  br i1 %map_lookup_cond189, label %lookup_merge187, label %lookup_success185
+
+lookup_success185:                                ; preds = %lookup_merge180
+  %131 = load i64, i8* %lookup_elem184, align 8
+  br label %lookup_merge187
+
+lookup_merge187:                                  ; preds = %lookup_merge180, %lookup_success185
+  %lookup_elem_val188.0 = phi i64 [ %131, %lookup_success185 ], [ 0, %lookup_merge180 ]
+  store i32 4119, i32* %"@x_key", align 4
+  %pseudo190 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem191 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo190, i32* nonnull %"@x_key")
+  %map_lookup_cond196 = icmp eq i8* %lookup_elem191, null
+  br i1 %map_lookup_cond196, label %lookup_merge194, label %lookup_success192
+
+lookup_success192:                                ; preds = %lookup_merge187
+  %132 = load i64, i8* %lookup_elem191, align 8
+  br label %lookup_merge194
+
+lookup_merge194:                                  ; preds = %lookup_merge187, %lookup_success192
+  %lookup_elem_val195.0 = phi i64 [ %132, %lookup_success192 ], [ 0, %lookup_merge187 ]
+  %133 = icmp ne i64 %lookup_elem_val195.0, 0
+  %134 = icmp eq i64 %lookup_elem_val188.0, %arg0
+  %135 = and i1 %134, %133
+  %136 = select i1 %135, i64 11, i64 %127
+  %137 = icmp ult i64 %lookup_elem_val195.0, %130
+  %138 = select i1 %137, i64 11, i64 %129
+  %139 = select i1 %137, i64 %lookup_elem_val195.0, i64 %130
+  store i32 4120, i32* %"@x_key", align 4
+  %pseudo197 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem198 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo197, i32* nonnull %"@x_key")
+  %map_lookup_cond203 = icmp eq i8* %lookup_elem198, null
+  br i1 %map_lookup_cond203, label %lookup_merge201, label %lookup_success199
+
+lookup_success199:                                ; preds = %lookup_merge194
+  %140 = load i64, i8* %lookup_elem198, align 8
+  br label %lookup_merge201
+
+lookup_merge201:                                  ; preds = %lookup_merge194, %lookup_success199
+  %lookup_elem_val202.0 = phi i64 [ %140, %lookup_success199 ], [ 0, %lookup_merge194 ]
+  store i32 4121, i32* %"@x_key", align 4
+  %pseudo204 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem205 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo204, i32* nonnull %"@x_key")
+  %map_lookup_cond210 = icmp eq i8* %lookup_elem205, null
+  br i1 %map_lookup_cond210, label %lookup_merge208, label %lookup_success206
+
+lookup_success206:                                ; preds = %lookup_merge201
+  %141 = load i64, i8* %lookup_elem205, align 8
+  br label %lookup_merge208
+
+lookup_merge208:                                  ; preds = %lookup_merge201, %lookup_success206
+  %lookup_elem_val209.0 = phi i64 [ %141, %lookup_success206 ], [ 0, %lookup_merge201 ]
+  %142 = icmp ne i64 %lookup_elem_val209.0, 0
+  %143 = icmp eq i64 %lookup_elem_val202.0, %arg0
+  %144 = and i1 %143, %142
+  %145 = select i1 %144, i64 12, i64 %136
+  %146 = icmp ult i64 %lookup_elem_val209.0, %139
+  %147 = select i1 %146, i64 12, i64 %138
+  %148 = select i1 %146, i64 %lookup_elem_val209.0, i64 %139
+  store i32 4122, i32* %"@x_key", align 4
+  %pseudo211 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem212 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo211, i32* nonnull %"@x_key")
+  %map_lookup_cond217 = icmp eq i8* %lookup_elem212, null
+  br i1 %map_lookup_cond217, label %lookup_merge215, label %lookup_success213
+
+lookup_success213:                                ; preds = %lookup_merge208
+  %149 = load i64, i8* %lookup_elem212, align 8
+  br label %lookup_merge215
+
+lookup_merge215:                                  ; preds = %lookup_merge208, %lookup_success213
+  %lookup_elem_val216.0 = phi i64 [ %149, %lookup_success213 ], [ 0, %lookup_merge208 ]
+  store i32 4123, i32* %"@x_key", align 4
+  %pseudo218 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem219 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo218, i32* nonnull %"@x_key")
+  %map_lookup_cond224 = icmp eq i8* %lookup_elem219, null
+  br i1 %map_lookup_cond224, label %lookup_merge222, label %lookup_success220
+
+lookup_success220:                                ; preds = %lookup_merge215
+  %150 = load i64, i8* %lookup_elem219, align 8
+  br label %lookup_merge222
+
+lookup_merge222:                                  ; preds = %lookup_merge215, %lookup_success220
+  %lookup_elem_val223.0 = phi i64 [ %150, %lookup_success220 ], [ 0, %lookup_merge215 ]
+  %151 = icmp ne i64 %lookup_elem_val223.0, 0
+  %152 = icmp eq i64 %lookup_elem_val216.0, %arg0
+  %153 = and i1 %152, %151
+  %154 = select i1 %153, i64 13, i64 %145
+  %155 = icmp ult i64 %lookup_elem_val223.0, %148
+  %156 = select i1 %155, i64 13, i64 %147
+  %157 = select i1 %155, i64 %lookup_elem_val223.0, i64 %148
+  store i32 4124, i32* %"@x_key", align 4
+  %pseudo225 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem226 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo225, i32* nonnull %"@x_key")
+  %map_lookup_cond231 = icmp eq i8* %lookup_elem226, null
+  br i1 %map_lookup_cond231, label %lookup_merge229, label %lookup_success227
+
+lookup_success227:                                ; preds = %lookup_merge222
+  %158 = load i64, i8* %lookup_elem226, align 8
+  br label %lookup_merge229
+
+lookup_merge229:                                  ; preds = %lookup_merge222, %lookup_success227
+  %lookup_elem_val230.0 = phi i64 [ %158, %lookup_success227 ], [ 0, %lookup_merge222 ]
+  store i32 4125, i32* %"@x_key", align 4
+  %pseudo232 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem233 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo232, i32* nonnull %"@x_key")
+  %map_lookup_cond238 = icmp eq i8* %lookup_elem233, null
+  br i1 %map_lookup_cond238, label %lookup_merge236, label %lookup_success234
+
+lookup_success234:                                ; preds = %lookup_merge229
+  %159 = load i64, i8* %lookup_elem233, align 8
+  br label %lookup_merge236
+
+lookup_merge236:                                  ; preds = %lookup_merge229, %lookup_success234
+  %lookup_elem_val237.0 = phi i64 [ %159, %lookup_success234 ], [ 0, %lookup_merge229 ]
+  %160 = icmp ne i64 %lookup_elem_val237.0, 0
+  %161 = icmp eq i64 %lookup_elem_val230.0, %arg0
+  %162 = and i1 %161, %160
+  %163 = select i1 %162, i64 14, i64 %154
+  %164 = icmp ult i64 %lookup_elem_val237.0, %157
+  %165 = select i1 %164, i64 14, i64 %156
+  %166 = select i1 %164, i64 %lookup_elem_val237.0, i64 %157
+  store i32 4126, i32* %"@x_key", align 4
+  %pseudo239 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem240 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo239, i32* nonnull %"@x_key")
+  %map_lookup_cond245 = icmp eq i8* %lookup_elem240, null
+  br i1 %map_lookup_cond245, label %lookup_merge243, label %lookup_success241
+
+lookup_success241:                                ; preds = %lookup_merge236
+  %167 = load i64, i8* %lookup_elem240, align 8
+  br label %lookup_merge243
+
+lookup_merge243:                                  ; preds = %lookup_merge236, %lookup_success241
+  %lookup_elem_val244.0 = phi i64 [ %167, %lookup_success241 ], [ 0, %lookup_merge236 ]
+  store i32 4127, i32* %"@x_key", align 4
+  %pseudo246 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem247 = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo246, i32* nonnull %"@x_key")
+  %map_lookup_cond252 = icmp eq i8* %lookup_elem247, null
+  br i1 %map_lookup_cond252, label %lookup_merge250, label %lookup_success248
+
+lookup_success248:                                ; preds = %lookup_merge243
+  %168 = load i64, i8* %lookup_elem247, align 8
+  br label %lookup_merge250
+
+lookup_merge250:                                  ; preds = %lookup_merge243, %lookup_success248
+  %lookup_elem_val251.0 = phi i64 [ %168, %lookup_success248 ], [ 0, %lookup_merge243 ]
+  %169 = icmp ne i64 %lookup_elem_val251.0, 0
+  %170 = icmp eq i64 %lookup_elem_val244.0, %arg0
+  %171 = and i1 %170, %169
+  %172 = select i1 %171, i64 15, i64 %163
+  %173 = icmp ult i64 %lookup_elem_val251.0, %166
+  %174 = select i1 %173, i64 %lookup_elem_val251.0, i64 %166
+  %175 = icmp ne i64 %172, -1
+  %176 = icmp ugt i64 %35, %174
+  %177 = or i1 %176, %175
+  br i1 %177, label %topk.admit, label %topk.done
+
+topk.admit:                                       ; preds = %lookup_merge250
+  %178 = select i1 %173, i64 15, i64 %165
+  %179 = select i1 %175, i64 %172, i64 %178
+  %.tr = trunc i64 %179 to i32
+  %180 = shl nuw nsw i32 %.tr, 1
+  %181 = add nuw nsw i32 %180, 4096
+  store i32 %181, i32* %"@x_key", align 4
+  store i64 %arg0, i64* %"@x_val", align 8
+  %pseudo253 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem254 = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo253, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  %182 = add nuw nsw i32 %180, 4097
+  store i32 %182, i32* %"@x_key", align 4
+  store i64 %35, i64* %"@x_val", align 8
+  %pseudo255 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem256 = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo255, i32* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  br label %topk.done
+
+topk.done:                                        ; preds = %topk.admit, %lookup_merge250
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %8)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %9)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
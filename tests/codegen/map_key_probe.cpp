@@ -14,72 +14,72 @@ declare i64 @llvm.bpf.pseudo(i64, i64) #0
 ; Function Attrs: argmemonly nounwind
 declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
 
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
 define i64 @"tracepoint:syscalls:sys_enter_nanosleep"(i8* nocapture readnone) local_unnamed_addr section "s_tracepoint:syscalls:sys_enter_nanosleep_1" {
 entry:
-  %"@x_val" = alloca i64, align 8
-  %"@x_key1" = alloca [8 x i8], align 8
-  %"@x_key" = alloca [8 x i8], align 8
-  %1 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key", i64 0, i64 0
+  %"@x_val.i" = alloca i64, align 8
+  %"@x_key1.i" = alloca [8 x i8], align 8
+  %"@x_key.i" = alloca [8 x i8], align 8
+  %1 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key.i", i64 0, i64 0
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
   store i64 0, i8* %1, align 8
-  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, [8 x i8]* nonnull %"@x_key")
-  %map_lookup_cond = icmp eq i8* %lookup_elem, null
-  br i1 %map_lookup_cond, label %lookup_merge, label %lookup_success
+  %pseudo.i = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem.i = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo.i, [8 x i8]* nonnull %"@x_key.i")
+  %map_lookup_cond.i = icmp eq i8* %lookup_elem.i, null
+  br i1 %map_lookup_cond.i, label %"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit", label %lookup_success.i
 
-lookup_success:                                   ; preds = %entry
-  %2 = load i64, i8* %lookup_elem, align 8
+lookup_success.i:                                 ; preds = %entry
+  %2 = load i64, i8* %lookup_elem.i, align 8
   %phitmp = add i64 %2, 1
-  br label %lookup_merge
+  br label %"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit"
 
-lookup_merge:                                     ; preds = %entry, %lookup_success
-  %lookup_elem_val.0 = phi i64 [ %phitmp, %lookup_success ], [ 1, %entry ]
+"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit": ; preds = %entry, %lookup_success.i
+  %lookup_elem_val.i.0 = phi i64 [ %phitmp, %lookup_success.i ], [ 1, %entry ]
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
-  %3 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key1", i64 0, i64 0
+  %3 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key1.i", i64 0, i64 0
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %3)
   store i64 0, i8* %3, align 8
-  %4 = bitcast i64* %"@x_val" to i8*
+  %4 = bitcast i64* %"@x_val.i" to i8*
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %4)
-  store i64 %lookup_elem_val.0, i64* %"@x_val", align 8
-  %pseudo2 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo2, [8 x i8]* nonnull %"@x_key1", i64* nonnull %"@x_val", i64 0)
+  store i64 %lookup_elem_val.i.0, i64* %"@x_val.i", align 8
+  %pseudo2.i = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem.i = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo2.i, [8 x i8]* nonnull %"@x_key1.i", i64* nonnull %"@x_val.i", i64 0)
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %3)
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %4)
   ret i64 0
 }
 
-; Function Attrs: argmemonly nounwind
-declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
-
 define i64 @"tracepoint:syscalls:sys_enter_openat"(i8* nocapture readnone) local_unnamed_addr section "s_tracepoint:syscalls:sys_enter_openat_2" {
 entry:
-  %"@x_val" = alloca i64, align 8
-  %"@x_key1" = alloca [8 x i8], align 8
-  %"@x_key" = alloca [8 x i8], align 8
-  %1 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key", i64 0, i64 0
+  %"@x_val.i" = alloca i64, align 8
+  %"@x_key1.i" = alloca [8 x i8], align 8
+  %"@x_key.i" = alloca [8 x i8], align 8
+  %1 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key.i", i64 0, i64 0
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
   store i64 1, i8* %1, align 8
-  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo, [8 x i8]* nonnull %"@x_key")
-  %map_lookup_cond = icmp eq i8* %lookup_elem, null
-  br i1 %map_lookup_cond, label %lookup_merge, label %lookup_success
+  %pseudo.i = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem.i = call i8* inttoptr (i64 1 to i8* (i8*, i8*)*)(i64 %pseudo.i, [8 x i8]* nonnull %"@x_key.i")
+  %map_lookup_cond.i = icmp eq i8* %lookup_elem.i, null
+  br i1 %map_lookup_cond.i, label %"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit", label %lookup_success.i
 
-lookup_success:                                   ; preds = %entry
-  %2 = load i64, i8* %lookup_elem, align 8
+lookup_success.i:                                 ; preds = %entry
+  %2 = load i64, i8* %lookup_elem.i, align 8
   %phitmp = add i64 %2, 1
-  br label %lookup_merge
+  br label %"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit"
 
-lookup_merge:                                     ; preds = %entry, %lookup_success
-  %lookup_elem_val.0 = phi i64 [ %phitmp, %lookup_success ], [ 1, %entry ]
+"tracepoint:syscalls:sys_enter_nanosleep,tracepoint:syscalls:sys_enter_openat_body.exit": ; preds = %entry, %lookup_success.i
+  %lookup_elem_val.i.0 = phi i64 [ %phitmp, %lookup_success.i ], [ 1, %entry ]
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
-  %3 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key1", i64 0, i64 0
+  %3 = getelementptr inbounds [8 x i8], [8 x i8]* %"@x_key1.i", i64 0, i64 0
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %3)
   store i64 1, i8* %3, align 8
-  %4 = bitcast i64* %"@x_val" to i8*
+  %4 = bitcast i64* %"@x_val.i" to i8*
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %4)
-  store i64 %lookup_elem_val.0, i64* %"@x_val", align 8
-  %pseudo2 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo2, [8 x i8]* nonnull %"@x_key1", i64* nonnull %"@x_val", i64 0)
+  store i64 %lookup_elem_val.i.0, i64* %"@x_val.i", align 8
+  %pseudo2.i = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem.i = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo2.i, [8 x i8]* nonnull %"@x_key1.i", i64* nonnull %"@x_val.i", i64 0)
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %3)
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %4)
   ret i64 0
@@ -0,0 +1,155 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, ordered_output_printf)
+{
+  // The timestamp goes after the arguments, in a field of its own
+  BPFtrace bpftrace;
+  bpftrace.ordered_output_ = true;
+
+  test(bpftrace,
+      "kprobe:f { printf(\"hello %d\\n\", pid) }",
+
+R"EXPECTED(%printf_t = type { i64, i64, i64 }
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8*) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %printf_args = alloca %printf_t, align 8
+  %1 = bitcast %printf_t* %printf_args to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  %2 = getelementptr inbounds %printf_t, %printf_t* %printf_args, i64 0, i32 0
+  store i64 0, i64* %2, align 8
+  %get_pid_tgid = tail call i64 inttoptr (i64 14 to i64 ()*)()
+  %3 = lshr i64 %get_pid_tgid, 32
+  %4 = getelementptr inbounds %printf_t, %printf_t* %printf_args, i64 0, i32 1
+  store i64 %3, i64* %4, align 8
+  %5 = getelementptr inbounds %printf_t, %printf_t* %printf_args, i64 0, i32 2
+  %get_ns = tail call i64 inttoptr (i64 5 to i64 ()*)()
+  store i64 %get_ns, i64* %5, align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %get_cpu_id = tail call i64 inttoptr (i64 8 to i64 ()*)()
+  %perf_event_output = call i64 inttoptr (i64 25 to i64 (i8*, i64, i64, %printf_t*, i64)*)(i8* %0, i64 %pseudo, i64 %get_cpu_id, %printf_t* nonnull %printf_args, i64 24)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+TEST(codegen, ordered_output_time)
+{
+  // The timestamp goes after the time format id
+  BPFtrace bpftrace;
+  bpftrace.ordered_output_ = true;
+
+  test(bpftrace,
+      "kprobe:f { time() }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8*) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %perfdata = alloca [24 x i8], align 8
+  %1 = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 0
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i64 30004, [24 x i8]* %perfdata, align 8
+  %2 = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 8
+  store i64 0, i8* %2, align 8
+  %3 = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 16
+  %4 = bitcast i8* %3 to i64*
+  %get_ns = tail call i64 inttoptr (i64 5 to i64 ()*)()
+  store i64 %get_ns, i64* %4, align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %get_cpu_id = tail call i64 inttoptr (i64 8 to i64 ()*)()
+  %perf_event_output = call i64 inttoptr (i64 25 to i64 (i8*, i64, i64, [24 x i8]*, i64)*)(i8* %0, i64 %pseudo, i64 %get_cpu_id, [24 x i8]* nonnull %perfdata, i64 24)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+TEST(codegen, ordered_output_padding)
+{
+  // The 11 byte record is padded to 16 bytes, before the timestamp
+  BPFtrace bpftrace;
+  bpftrace.ordered_output_ = true;
+
+  test(bpftrace,
+      "kprobe:f { @x = 1; clear(@x) }",
+
+R"EXPECTED(; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8*) local_unnamed_addr section "s_kprobe:f_1" {
+entry:
+  %perfdata = alloca [24 x i8], align 8
+  %"@x_val" = alloca i64, align 8
+  %"@x_key" = alloca i64, align 8
+  %1 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %1)
+  store i64 0, i64* %"@x_key", align 8
+  %2 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %2)
+  store i64 1, i64* %"@x_val", align 8
+  %pseudo = tail call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i8*, i8*, i8*, i64)*)(i64 %pseudo, i64* nonnull %"@x_key", i64* nonnull %"@x_val", i64 0)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %1)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %2)
+  %3 = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 0
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* nonnull %3)
+  store i64 30002, [24 x i8]* %perfdata, align 8
+  %str.sroa.0.0..sroa_idx = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 8
+  store i8 64, i8* %str.sroa.0.0..sroa_idx, align 8
+  %str.sroa.4.0..sroa_idx = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 9
+  store i8 120, i8* %str.sroa.4.0..sroa_idx, align 1
+  %str.sroa.5.0..sroa_idx = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 10
+  store i8 0, i8* %str.sroa.5.0..sroa_idx, align 2
+  %4 = getelementptr inbounds [24 x i8], [24 x i8]* %perfdata, i64 0, i64 16
+  %5 = bitcast i8* %4 to i64*
+  %get_ns = call i64 inttoptr (i64 5 to i64 ()*)()
+  store i64 %get_ns, i64* %5, align 8
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %get_cpu_id = call i64 inttoptr (i64 8 to i64 ()*)()
+  %perf_event_output = call i64 inttoptr (i64 25 to i64 (i8*, i64, i64, [24 x i8]*, i64)*)(i8* %0, i64 %pseudo1, i64 %get_cpu_id, [24 x i8]* nonnull %perfdata, i64 24)
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* nonnull %3)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
+)EXPECTED");
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
@@ -0,0 +1,109 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "event_reorder.h"
+
+namespace bpftrace {
+namespace test {
+namespace event_reorder {
+
+// A record as output with --ordered: the payload, then its timestamp
+static std::vector<uint8_t> record(const std::string &payload,
+                                   uint64_t timestamp)
+{
+  std::vector<uint8_t> data(payload.begin(), payload.end());
+  data.resize(payload.size() + sizeof(timestamp));
+  memcpy(data.data() + payload.size(), &timestamp, sizeof(timestamp));
+  return data;
+}
+
+static void push(EventReorder &reorder, const std::string &payload,
+                 uint64_t timestamp)
+{
+  auto data = record(payload, timestamp);
+  reorder.push(data.data(), data.size());
+}
+
+class Collector
+{
+public:
+  EventReorder::Handler handler()
+  {
+    return [this](void *data, int size) {
+      released.emplace_back(static_cast<char*>(data), size);
+    };
+  }
+
+  std::vector<std::string> released;
+};
+
+TEST(event_reorder, releases_in_timestamp_order)
+{
+  EventReorder reorder(100, 1024);
+  Collector collector;
+  push(reorder, "c", 30);
+  push(reorder, "a", 10);
+  push(reorder, "b", 20);
+  reorder.release_all(collector.handler());
+
+  EXPECT_EQ(collector.released, std::vector<std::string>({ "a", "b", "c" }));
+  EXPECT_EQ(reorder.size(), 0UL);
+}
+
+TEST(event_reorder, keeps_read_order_for_equal_timestamps)
+{
+  EventReorder reorder(100, 1024);
+  Collector collector;
+  push(reorder, "first", 10);
+  push(reorder, "second", 10);
+  push(reorder, "third", 10);
+  reorder.release_all(collector.handler());
+
+  EXPECT_EQ(collector.released,
+            std::vector<std::string>({ "first", "second", "third" }));
+}
+
+TEST(event_reorder, holds_events_within_window)
+{
+  EventReorder reorder(100, 1024);
+  Collector collector;
+  push(reorder, "a", 1000);
+  push(reorder, "b", 1050);
+  push(reorder, "c", 1150);
+
+  reorder.release(1120, collector.handler());
+  EXPECT_EQ(collector.released, std::vector<std::string>({ "a" }));
+
+  // A late record from another CPU still goes before those held back
+  push(reorder, "late", 1040);
+  reorder.release(1300, collector.handler());
+  EXPECT_EQ(collector.released,
+            std::vector<std::string>({ "a", "late", "b", "c" }));
+}
+
+TEST(event_reorder, releases_oldest_beyond_max_events)
+{
+  EventReorder reorder(1000, 2);
+  Collector collector;
+  push(reorder, "a", 10);
+  push(reorder, "b", 20);
+  push(reorder, "c", 30);
+
+  reorder.release(0, collector.handler());
+  EXPECT_EQ(collector.released, std::vector<std::string>({ "a" }));
+  EXPECT_EQ(reorder.size(), 2UL);
+}
+
+TEST(event_reorder, ignores_short_records)
+{
+  EventReorder reorder(100, 1024);
+  uint32_t data = 0;
+  reorder.push(&data, sizeof(data));
+  EXPECT_EQ(reorder.size(), 0UL);
+}
+
+} // namespace event_reorder
+} // namespace test
+} // namespace bpftrace
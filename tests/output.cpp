@@ -0,0 +1,172 @@
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "bpftrace.h"
+#include "fake_map.h"
+#include "output.h"
+#include "utils.h"
+
+namespace bpftrace {
+namespace test {
+namespace output {
+
+// Reads back the little-endian encoding written by BinaryOutput
+class Reader
+{
+public:
+  explicit Reader(const std::string &data) : data_(data) { }
+
+  uint8_t u8()
+  {
+    return static_cast<uint8_t>(data_.at(pos_++));
+  }
+
+  uint32_t u32()
+  {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+      value |= static_cast<uint32_t>(u8()) << (8 * i);
+    return value;
+  }
+
+  uint64_t u64()
+  {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+      value |= static_cast<uint64_t>(u8()) << (8 * i);
+    return value;
+  }
+
+  std::string str(size_t size)
+  {
+    std::string value = data_.substr(pos_, size);
+    pos_ += size;
+    return value;
+  }
+
+  std::string str()
+  {
+    return str(u32());
+  }
+
+  bool done() const
+  {
+    return pos_ == data_.size();
+  }
+
+private:
+  const std::string &data_;
+  size_t pos_ = 0;
+};
+
+// A per-cpu value, all on the first CPU
+static std::vector<uint8_t> percpu_value(uint64_t value)
+{
+  std::vector<uint8_t> bytes(8 * get_possible_cpus().size());
+  memcpy(bytes.data(), &value, sizeof(value));
+  return bytes;
+}
+
+TEST(output, binary_map)
+{
+  // @x[(uint16)key0, (int8)key1] = count()
+  FakeMap map(SizedType(Type::count, 8));
+  map.name_ = "@x";
+  map.type_ = SizedType(Type::count, 8);
+  map.key_.args_ = { SizedType(Type::integer, 2, false),
+                     SizedType(Type::integer, 1, true) };
+
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key = {
+    { { 0xfe, 0xff, 0xfe }, percpu_value(5) },
+    { { 0x01, 0x00, 0x03 }, percpu_value(7) },
+  };
+
+  std::stringstream out;
+  {
+    BPFtrace bpftrace;
+    BinaryOutput output(out);
+    output.map(bpftrace, map, 0, 1, values_by_key);
+  }
+
+  std::string data = out.str();
+  Reader in(data);
+  EXPECT_EQ(in.str(8), "BPFTRACE");
+  EXPECT_EQ(in.u32(), 1U);
+
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(MessageType::map));
+  EXPECT_EQ(in.u32(), data.size() - 17);
+  EXPECT_EQ(in.str(), "@x");
+  EXPECT_EQ(in.u32(), 2U); // rows
+  EXPECT_EQ(in.u32(), 0U); // dictionary
+  ASSERT_EQ(in.u8(), 3U);  // columns
+
+  // Unsigned keys are zero extended, signed ones sign extended
+  EXPECT_EQ(in.str(), "key0");
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(BinaryOutput::ColumnType::uint64));
+  EXPECT_EQ(in.u64(), 0xfffeUL);
+  EXPECT_EQ(in.u64(), 1UL);
+
+  EXPECT_EQ(in.str(), "key1");
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(BinaryOutput::ColumnType::int64));
+  EXPECT_EQ(static_cast<int64_t>(in.u64()), -2L);
+  EXPECT_EQ(in.u64(), 3UL);
+
+  EXPECT_EQ(in.str(), "value");
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(BinaryOutput::ColumnType::uint64));
+  EXPECT_EQ(in.u64(), 5UL);
+  EXPECT_EQ(in.u64(), 7UL);
+
+  EXPECT_TRUE(in.done());
+}
+
+TEST(output, binary_string_keys_use_the_dictionary)
+{
+  // @x[comm] = 1, with the same comm twice
+  FakeMap map(SizedType(Type::integer, 8, true));
+  map.name_ = "@x";
+  map.type_ = SizedType(Type::integer, 8, true);
+  map.key_.args_ = { SizedType(Type::string, 4) };
+
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key = {
+    { { 'a', 'b', 0, 0 }, percpu_value(-1) },
+    { { 'a', 'b', 0, 0 }, percpu_value(1) },
+  };
+
+  std::stringstream out;
+  {
+    BPFtrace bpftrace;
+    BinaryOutput output(out);
+    output.map(bpftrace, map, 0, 1, values_by_key);
+  }
+
+  std::string data = out.str();
+  Reader in(data);
+  in.str(8);
+  in.u32();
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(MessageType::map));
+  in.u32();
+  EXPECT_EQ(in.str(), "@x");
+  EXPECT_EQ(in.u32(), 2U);
+  ASSERT_EQ(in.u32(), 1U);
+  EXPECT_EQ(in.str(), "ab");
+  ASSERT_EQ(in.u8(), 2U);
+
+  EXPECT_EQ(in.str(), "key0");
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(BinaryOutput::ColumnType::string));
+  EXPECT_EQ(in.u32(), 0U);
+  EXPECT_EQ(in.u32(), 0U);
+
+  EXPECT_EQ(in.str(), "value");
+  EXPECT_EQ(in.u8(), static_cast<uint8_t>(BinaryOutput::ColumnType::int64));
+  EXPECT_EQ(static_cast<int64_t>(in.u64()), -1L);
+  EXPECT_EQ(in.u64(), 1UL);
+
+  EXPECT_TRUE(in.done());
+}
+
+} // namespace output
+} // namespace test
+} // namespace bpftrace
@@ -137,6 +137,10 @@ TEST(semantic_analyser, builtin_functions)
   test("kprobe:f { @x = max(pid) }", 0);
   test("kprobe:f { @x = avg(pid) }", 0);
   test("kprobe:f { @x = stats(pid) }", 0);
+  test("kprobe:f { @x = topk(pid) }", 0);
+  test("kprobe:f { @x = hll(pid) }", 0);
+  test("kprobe:f { @x = cardinality(pid) }", 0);
+  test("kprobe:f { @x = quantiles(pid) }", 0);
   test("kprobe:f { @x = 1; delete(@x) }", 0);
   test("kprobe:f { @x = 1; print(@x) }", 0);
   test("kprobe:f { @x = 1; clear(@x) }", 0);
@@ -159,6 +163,8 @@ TEST(semantic_analyser, builtin_functions)
   test("kprobe:f { ustack(1) }", 0);
   test("kprobe:f { fake() }", 1);
   test("kprobe:f { cat(\"/proc/uptime\") }", 0);
+  test("kprobe:f { sample(1/100) }", 0);
+  test("kprobe:f { ratelimit(10) }", 0);
 }
 
 TEST(semantic_analyser, undefined_map)
@@ -345,6 +351,40 @@ TEST(semantic_analyser, call_stats)
   test("kprobe:f { stats(123); }", 1);
 }
 
+TEST(semantic_analyser, call_topk)
+{
+  test("kprobe:f { @x = topk(pid); }", 0);
+  test("kprobe:f { @x = topk(kstack); }", 0);
+  test("kprobe:f { @x = topk(ustack); }", 0);
+  test("kprobe:f { @x = topk(); }", 1);
+  test("kprobe:f { @x = topk(pid, 10); }", 1);
+  test("kprobe:f { topk(pid); }", 1);
+  test("kprobe:f { @x[comm] = topk(pid); }", 1);
+  test("kprobe:f { @x = topk(comm); }", 1);
+}
+
+TEST(semantic_analyser, call_hll)
+{
+  test("kprobe:f { @x = hll(pid); }", 0);
+  test("kprobe:f { @x[comm] = hll(tid); }", 0);
+  test("kprobe:f { @x = hll(ustack); }", 0);
+  test("kprobe:f { @x = cardinality(pid); }", 0);
+  test("kprobe:f { @x = hll(); }", 1);
+  test("kprobe:f { @x = hll(pid, tid); }", 1);
+  test("kprobe:f { hll(pid); }", 1);
+  test("kprobe:f { @x = hll(comm); }", 1);
+}
+
+TEST(semantic_analyser, call_quantiles)
+{
+  test("kprobe:f { @x = quantiles(123); }", 0);
+  test("kprobe:f { @x[comm] = quantiles(nsecs); }", 0);
+  test("kprobe:f { @x = quantiles(); }", 1);
+  test("kprobe:f { @x = quantiles(1, 2); }", 1);
+  test("kprobe:f { quantiles(123); }", 1);
+  test("kprobe:f { @x = quantiles(comm); }", 10);
+}
+
 TEST(semantic_analyser, call_delete)
 {
   test("kprobe:f { @x = 1; delete(@x); }", 0);
@@ -424,6 +464,20 @@ TEST(semantic_analyser, call_str_2_expr)
   test("kprobe:f { @x = str(arg0, arg1); }", 0);
 }
 
+TEST(semantic_analyser, call_str_large)
+{
+  auto bpftrace = get_mock_bpftrace();
+  bpftrace->strlen_ = 1024;
+  test(*bpftrace, "kprobe:f { printf(\"%s %s\\n\", str(arg0), str(arg1)); }", 0);
+  test(*bpftrace, "kprobe:f { @x = str(arg0); }", 0);
+  test(*bpftrace, "kprobe:f { @x[str(arg0)] = count(); }", 10);
+  test(*bpftrace, "kprobe:f { $x = str(arg0); }", 10);
+  test(*bpftrace, "kprobe:f { @x = str(arg0); print(@x); clear(@x); }", 0);
+  test(*bpftrace, "kprobe:f { @x[pid] = str(arg0); delete(@x[pid]); }", 0);
+  test(*bpftrace, "kprobe:f { @x = str(arg0); printf(\"%s\\n\", @x); }", 10);
+  test(*bpftrace, "kprobe:f { @x = str(arg0); @y = @x; }", 10);
+}
+
 TEST(semantic_analyser, call_sym)
 {
   test("kprobe:f { ksym(arg0); }", 0);
@@ -523,6 +577,27 @@ TEST(semantic_analyser, call_cat)
   test("kprobe:f { @x = cat(\"/proc/loadavg\"); }", 1);
 }
 
+TEST(semantic_analyser, call_sample)
+{
+  test("kprobe:f /sample(1/100)/ { @x = count(); }", 0);
+  test("kprobe:f { if (sample(3/4)) { @x = count(); } }", 0);
+  test("kprobe:f /sample(1/1)/ { @x = count(); }", 0);
+  test("kprobe:f /sample()/ { @x = count(); }", 1);
+  test("kprobe:f /sample(100)/ { @x = count(); }", 1);
+  test("kprobe:f /sample(2/1)/ { @x = count(); }", 1);
+  test("kprobe:f /sample(1/0)/ { @x = count(); }", 1);
+  test("kprobe:f /sample(1/pid)/ { @x = count(); }", 1);
+}
+
+TEST(semantic_analyser, call_ratelimit)
+{
+  test("kprobe:f /ratelimit(10)/ { printf(\"hi\\n\"); }", 0);
+  test("kprobe:f /ratelimit(1)/ { @x = count(); } kprobe:g /ratelimit(5)/ { @y = count(); }", 0);
+  test("kprobe:f /ratelimit()/ { @x = count(); }", 1);
+  test("kprobe:f /ratelimit(0)/ { @x = count(); }", 1);
+  test("kprobe:f /ratelimit(pid)/ { @x = count(); }", 1);
+}
+
 TEST(semantic_analyser, map_reassignment)
 {
   test("kprobe:f { @x = 1; @x = 2; }", 0);
@@ -12,6 +12,11 @@ public:
   {
     return get_tracepoint_struct(format_file, category, event_name);
   }
+
+  static bool get_tracepoint_struct_public(std::istream &format_file, Struct &result)
+  {
+    return get_tracepoint_struct(format_file, result);
+  }
 };
 
 TEST(tracepoint_format_parser, tracepoint_struct)
@@ -149,6 +154,64 @@ TEST(tracepoint_format_parser, adjust_integer_types)
   EXPECT_EQ(expected, result);
 }
 
+TEST(tracepoint_format_parser, direct_struct)
+{
+  std::string input =
+    "name: sys_enter_read\n"
+    "ID: 650\n"
+    "format:\n"
+    "	field:unsigned short common_type;	offset:0;	size:2;	signed:0;\n"
+    "	field:int common_pid;	offset:4;	size:4;	signed:1;\n"
+    "\n"
+    "	field:unsigned int fd;	offset:16;	size:8;	signed:0;\n"
+    "	field:const char * buf;	offset:24;	size:8;	signed:0;\n"
+    "	field:char comm[16];	offset:32;	size:16;	signed:1;\n"
+    "	field:int int_array[2];	offset:48;	size:8;	signed:1;\n"
+    "	field:__data_loc char[] msg;	offset:56;	size:4;	signed:1;\n"
+    "\n"
+    "print fmt: \"fd: 0x%08lx\", ((unsigned long)(REC->fd))\n";
+
+  std::istringstream format_file(input);
+  Struct result;
+  ASSERT_TRUE(MockTracepointFormatParser::get_tracepoint_struct_public(format_file, result));
+
+  EXPECT_EQ(result.size, 64);
+  ASSERT_EQ(result.fields.size(), 7U);
+
+  EXPECT_EQ(result.fields["common_type"].type, SizedType(Type::integer, 2, false));
+  EXPECT_EQ(result.fields["common_type"].offset, 0);
+  EXPECT_EQ(result.fields["common_pid"].type, SizedType(Type::integer, 4, true));
+  EXPECT_EQ(result.fields["common_pid"].offset, 4);
+  EXPECT_EQ(result.fields["fd"].type, SizedType(Type::integer, 8, false));
+  EXPECT_EQ(result.fields["fd"].offset, 16);
+
+  EXPECT_TRUE(result.fields["buf"].type.is_pointer);
+  EXPECT_EQ(result.fields["buf"].type.pointee_size, 1U);
+  EXPECT_EQ(result.fields["buf"].offset, 24);
+
+  EXPECT_EQ(result.fields["comm"].type, SizedType(Type::string, 16));
+  EXPECT_EQ(result.fields["comm"].offset, 32);
+
+  EXPECT_EQ(result.fields["int_array"].type.type, Type::array);
+  EXPECT_EQ(result.fields["int_array"].type.size, 2U);
+  EXPECT_EQ(result.fields["int_array"].type.pointee_size, 4U);
+  EXPECT_EQ(result.fields["int_array"].offset, 48);
+
+  EXPECT_EQ(result.fields["data_loc_msg"].type, SizedType(Type::integer, 4, true));
+  EXPECT_EQ(result.fields["data_loc_msg"].offset, 56);
+}
+
+TEST(tracepoint_format_parser, direct_struct_needs_clang)
+{
+  std::string input =
+    "	field:int common_pid;	offset:4;	size:4;	signed:1;\n"
+    "	field:struct file * file;	offset:8;	size:8;	signed:0;\n";
+
+  std::istringstream format_file(input);
+  Struct result;
+  EXPECT_FALSE(MockTracepointFormatParser::get_tracepoint_struct_public(format_file, result));
+}
+
 } // namespace tracepoint_format_parser
 } // namespace test
 } // namespace bpftrace
@@ -71,6 +71,28 @@ TEST(utils, wildcard_match)
   EXPECT_EQ(wildcard_match("foobarbiz", tokens_foo_biz, false, false), true);
 }
 
+TEST(utils, str_append_int)
+{
+  std::string str = "x";
+  str_append_uint(str, 0);
+  str_append_uint(str, 7);
+  str_append_uint(str, 42);
+  str_append_uint(str, 100);
+  EXPECT_EQ(str, "x0742100");
+
+  str.clear();
+  str_append_uint(str, UINT64_MAX);
+  EXPECT_EQ(str, "18446744073709551615");
+
+  str.clear();
+  str_append_int(str, -1);
+  str += " ";
+  str_append_int(str, INT64_MIN);
+  str += " ";
+  str_append_int(str, INT64_MAX);
+  EXPECT_EQ(str, "-1 -9223372036854775808 9223372036854775807");
+}
+
 } // namespace ast
 } // namespace test
 } // namespace bpftrace